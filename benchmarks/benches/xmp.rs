@@ -0,0 +1,189 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+// Run with `cargo bench` from the benchmarks directory. To run one group,
+// name it: `cargo bench -- open_only_xmp/jpeg`.
+
+use std::fs;
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use tempfile::TempDir;
+use xmp_toolkit::{
+    scan_file, OpenFileOptions, SerializeOptions, XmpEdit, XmpFile, XmpFileFormat, XmpMeta,
+    XMP_NS_DC, XMP_NS_XMP,
+};
+use xmp_toolkit_benchmarks::{self as corpus, Corpus, Metadata};
+
+fn open_and_read(c: &mut Criterion) {
+    let corpus = Corpus::build();
+
+    for (group_name, extra) in [
+        ("open_xmp", OpenFileOptions::empty()),
+        ("open_only_xmp", OpenFileOptions::OPEN_ONLY_XMP),
+    ]
+    .iter()
+    {
+        let mut group = c.benchmark_group(*group_name);
+        for sample in corpus.samples.iter() {
+            let flags = OpenFileOptions::OPEN_FOR_READ | sample.open_flags | *extra;
+            group.bench_with_input(
+                BenchmarkId::from_parameter(&sample.name),
+                &sample.path,
+                |b, path| {
+                    b.iter(|| {
+                        let mut f = XmpFile::new();
+                        f.open_file(path, XmpFileFormat::Unknown, flags).unwrap();
+                        let m = f.xmp();
+                        f.close();
+                        m
+                    })
+                },
+            );
+        }
+        group.finish();
+    }
+
+    let mut group = c.benchmark_group("scan_file");
+    for sample in corpus.samples.iter() {
+        if sample.open_flags == OpenFileOptions::OPEN_USE_PACKET_SCANNING {
+            group.bench_with_input(
+                BenchmarkId::from_parameter(&sample.name),
+                &sample.path,
+                |b, path| b.iter(|| scan_file(path).unwrap()),
+            );
+        }
+    }
+    group.finish();
+}
+
+fn parse_and_serialize(c: &mut Criterion) {
+    for kind in [Metadata::Light, Metadata::Heavy].iter() {
+        let m = corpus::metadata(*kind);
+        let packet = corpus::packet(&m);
+        let id = format!("{:?}", kind).to_lowercase();
+
+        let mut group = c.benchmark_group("parse");
+        group.throughput(Throughput::Bytes(packet.len() as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(&id), &packet, |b, p| {
+            b.iter(|| XmpMeta::from_packet(p).unwrap())
+        });
+        group.finish();
+
+        let mut group = c.benchmark_group("serialize");
+        group.throughput(Throughput::Bytes(packet.len() as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(&id), &m, |b, m| {
+            b.iter(|| m.to_packet(SerializeOptions::empty()).unwrap())
+        });
+        group.finish();
+    }
+}
+
+fn properties(c: &mut Criterion) {
+    const COUNT: usize = 1_000;
+
+    let names: Vec<String> = (0..COUNT).map(|i| format!("Prop{}", i)).collect();
+    let ns = "http://ns.example.com/bench/1.0/";
+    XmpMeta::register_namespace(ns, "bench").unwrap();
+
+    let mut m = corpus::metadata(Metadata::Heavy);
+    for n in names.iter() {
+        m.set_property(ns, n, "value");
+    }
+
+    let mut group = c.benchmark_group("properties");
+    group.throughput(Throughput::Elements(COUNT as u64));
+
+    group.bench_function("get", |b| {
+        b.iter(|| names.iter().filter(|n| m.property(ns, n).is_some()).count())
+    });
+
+    group.bench_function("get_into", |b| {
+        let mut value = String::new();
+        b.iter(|| {
+            names
+                .iter()
+                .filter(|n| m.property_into(ns, n, &mut value))
+                .count()
+        })
+    });
+
+    group.bench_function("get_heavy_array_items", |b| {
+        b.iter(|| {
+            (1..=COUNT)
+                .filter(|i| m.property(XMP_NS_DC, &format!("subject[{}]", i)).is_some())
+                .count()
+        })
+    });
+
+    group.bench_function("set", |b| {
+        b.iter(|| {
+            for n in names.iter() {
+                m.set_property(ns, n, "new value");
+            }
+        })
+    });
+
+    group.bench_function("set_batched", |b| {
+        let mut edit = XmpEdit::new();
+        for n in names.iter() {
+            edit.set(ns, n, "batched value");
+        }
+        b.iter(|| m.apply(&edit).unwrap())
+    });
+
+    group.finish();
+}
+
+fn write(c: &mut Criterion) {
+    let corpus = Corpus::build();
+    let scratch = TempDir::new().unwrap();
+
+    let mut update = corpus::metadata(Metadata::Light);
+    update.set_property(XMP_NS_XMP, "Label", "updated by benchmark");
+
+    let mut group = c.benchmark_group("put_xmp_and_close");
+    for sample in corpus.samples.iter() {
+        let target = scratch.path().join(sample.path.file_name().unwrap());
+        let flags = OpenFileOptions::OPEN_FOR_UPDATE | sample.open_flags;
+
+        group.bench_with_input(
+            BenchmarkId::from_parameter(&sample.name),
+            &sample.path,
+            |b, path| {
+                b.iter_batched(
+                    || {
+                        fs::copy(path, &target).unwrap();
+                        let mut f = XmpFile::new();
+                        f.open_file(&target, XmpFileFormat::Unknown, flags).unwrap();
+                        f
+                    },
+                    |mut f| {
+                        f.put_xmp(&update);
+                        f.close();
+                    },
+                    BatchSize::PerIteration,
+                )
+            },
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    open_and_read,
+    parse_and_serialize,
+    properties,
+    write
+);
+criterion_main!(benches);
@@ -0,0 +1,632 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+//! Builds the benchmark corpus in a temporary directory.
+//!
+//! Only one real file is checked in (tests/fixtures/Purple Square.psd), so
+//! the other formats are synthesized: a minimal, valid file is written for
+//! each format, optionally padded with inert payload (image or audio data,
+//! an mdat box, and so on), and then the XMP Toolkit itself writes the
+//! metadata into it. The XMP is thus laid out exactly as each handler
+//! would lay it out in a real file.
+//!
+//! The "jpeg-exif" and "tiff-exif" files also carry the legacy blocks a
+//! camera or an older editor would write: Exif (with an Exif IFD) and IPTC
+//! IIM, the latter in a Photoshop APP13 segment for JPEG and in the
+//! IPTC-NAA tag for TIFF. Opening them includes the handlers'
+//! reconciliation of those blocks with the XMP.
+
+use std::fs;
+use std::path::{Path, PathBuf};
+
+use tempfile::TempDir;
+use xmp_toolkit::{
+    OpenFileOptions, PropertyFlags, SerializeOptions, XmpEdit, XmpFile, XmpFileFormat, XmpMeta,
+    XMP_NS_DC, XMP_NS_XMP,
+};
+
+// Payload added to the "large" variant of each file.
+const LARGE_PAYLOAD: usize = 16 * 1024 * 1024;
+
+// The number of keywords in "heavy" metadata.
+const HEAVY_KEYWORDS: usize = 2_000;
+
+/// Which metadata a corpus file carries.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Metadata {
+    /// A dozen simple properties.
+    Light,
+
+    /// The light properties plus thousands of array items.
+    Heavy,
+}
+
+/// One file in the corpus.
+pub struct Sample {
+    /// A short name such as "jpeg/large", used as the benchmark ID.
+    pub name: String,
+    pub path: PathBuf,
+    pub open_flags: OpenFileOptions,
+}
+
+pub struct Corpus {
+    pub samples: Vec<Sample>,
+    _dir: TempDir,
+}
+
+// (name, extension, builder) for each synthesized format. Each builder
+// returns a file with no XMP and `payload` bytes of inert content.
+const FORMATS: &[(&str, &str, fn(usize) -> Vec<u8>)] = &[
+    ("jpeg", "jpg", jpeg),
+    ("jpeg-exif", "jpg", jpeg_exif),
+    ("png", "png", png),
+    ("tiff", "tif", tiff),
+    ("tiff-exif", "tif", tiff_exif),
+    ("mp4", "mp4", mp4),
+    ("wav", "wav", wav),
+    ("aiff", "aif", aiff),
+    ("mp3", "mp3", mp3),
+    ("svg", "svg", svg),
+];
+
+impl Corpus {
+    /// Builds every sample. Formats whose handler is not compiled in (or
+    /// that fail to build for any other reason) are left out with a note.
+    pub fn build() -> Corpus {
+        let dir = TempDir::new().unwrap();
+        let mut samples = Vec::new();
+
+        for (name, ext, builder) in FORMATS.iter() {
+            for (variant, payload, metadata) in [
+                ("light", 0, Metadata::Light),
+                ("heavy", 0, Metadata::Heavy),
+                ("large", LARGE_PAYLOAD, Metadata::Light),
+            ]
+            .iter()
+            {
+                let path = dir.path().join(format!("{}-{}.{}", name, variant, ext));
+                fs::write(&path, builder(*payload)).unwrap();
+                add_smart(
+                    &mut samples,
+                    format!("{}/{}", name, variant),
+                    path,
+                    *metadata,
+                );
+            }
+        }
+
+        let psd = fixture_path("Purple Square.psd");
+        let path = dir.path().join("psd-light.psd");
+        fs::copy(&psd, &path).unwrap();
+        add_smart(&mut samples, "psd/light".to_owned(), path, Metadata::Light);
+
+        let path = dir.path().join("psd-heavy.psd");
+        fs::copy(&psd, &path).unwrap();
+        add_smart(&mut samples, "psd/heavy".to_owned(), path, Metadata::Heavy);
+
+        // Packet scanning: the packet is simply embedded in opaque data.
+        for (variant, payload) in [("light", 0), ("large", LARGE_PAYLOAD)].iter() {
+            let path = dir.path().join(format!("scanned-{}.bin", variant));
+            let mut data = vec![0u8; *payload];
+            data.extend_from_slice(&packet(&metadata(Metadata::Light)));
+            data.extend_from_slice(&[0u8; 64]);
+            fs::write(&path, data).unwrap();
+
+            samples.push(Sample {
+                name: format!("scanned/{}", variant),
+                path,
+                open_flags: OpenFileOptions::OPEN_USE_PACKET_SCANNING,
+            });
+        }
+
+        Corpus { samples, _dir: dir }
+    }
+}
+
+/// Returns the metadata used throughout the benchmarks.
+pub fn metadata(kind: Metadata) -> XmpMeta {
+    let mut m = XmpMeta::new();
+
+    let mut edit = XmpEdit::new();
+    edit.set(XMP_NS_XMP, "CreatorTool", "xmp_toolkit benchmarks")
+        .set(XMP_NS_XMP, "Label", "benchmark")
+        .set_i64(XMP_NS_XMP, "Rating", 3)
+        .set(XMP_NS_XMP, "Nickname", "corpus")
+        .set(XMP_NS_DC, "format", "application/octet-stream")
+        .append(
+            XMP_NS_DC,
+            "creator",
+            PropertyFlags::ARRAY_IS_ORDERED,
+            "Jane Doe",
+        )
+        .append(
+            XMP_NS_DC,
+            "publisher",
+            PropertyFlags::empty(),
+            "Example Press",
+        )
+        .append(XMP_NS_DC, "subject", PropertyFlags::empty(), "benchmark");
+
+    if kind == Metadata::Heavy {
+        for i in 0..HEAVY_KEYWORDS {
+            edit.append(
+                XMP_NS_DC,
+                "subject",
+                PropertyFlags::empty(),
+                &format!("keyword number {}", i),
+            );
+        }
+    }
+
+    m.apply(&edit).unwrap();
+    m
+}
+
+/// Serializes metadata as a writable packet with the default padding.
+pub fn packet(m: &XmpMeta) -> Vec<u8> {
+    m.to_packet(SerializeOptions::empty()).unwrap()
+}
+
+fn fixture_path(name: &str) -> PathBuf {
+    let mut path = PathBuf::from(env!("CARGO_MANIFEST_DIR"));
+    path.push("../tests/fixtures");
+    path.push(name);
+    path
+}
+
+// Has the toolkit write the metadata into `path`, and adds it to the
+// corpus if that worked.
+fn add_smart(samples: &mut Vec<Sample>, name: String, path: PathBuf, kind: Metadata) {
+    if stamp(&path, &metadata(kind)) {
+        samples.push(Sample {
+            name,
+            path,
+            open_flags: OpenFileOptions::OPEN_USE_SMART_HANDLER,
+        });
+    } else {
+        eprintln!("skipping {}: no handler could update the file", name);
+    }
+}
+
+fn stamp(path: &Path, m: &XmpMeta) -> bool {
+    let mut f = XmpFile::new();
+    let flags = OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER;
+    if f.open_file(path, XmpFileFormat::Unknown, flags).is_err() || !f.can_put_xmp(m) {
+        return false;
+    }
+    f.put_xmp(m);
+    f.close();
+    true
+}
+
+// --- Minimal files for each format
+
+fn be16(v: u16) -> [u8; 2] {
+    v.to_be_bytes()
+}
+
+fn be32(v: u32) -> [u8; 4] {
+    v.to_be_bytes()
+}
+
+fn le16(v: u16) -> [u8; 2] {
+    v.to_le_bytes()
+}
+
+fn le32(v: u32) -> [u8; 4] {
+    v.to_le_bytes()
+}
+
+fn jpeg(payload: usize) -> Vec<u8> {
+    jpeg_image(payload, false)
+}
+
+fn jpeg_exif(payload: usize) -> Vec<u8> {
+    jpeg_image(payload, true)
+}
+
+fn jpeg_image(payload: usize, legacy: bool) -> Vec<u8> {
+    fn segment(d: &mut Vec<u8>, marker: u8, data: &[u8]) {
+        d.extend_from_slice(&[0xFF, marker]);
+        d.extend_from_slice(&be16(2 + data.len() as u16));
+        d.extend_from_slice(data);
+    }
+
+    let mut d = vec![0xFF, 0xD8];
+
+    // APP0 (JFIF), 1x1 pixel aspect ratio.
+    d.extend_from_slice(&[0xFF, 0xE0, 0x00, 0x10]);
+    d.extend_from_slice(b"JFIF\0");
+    d.extend_from_slice(&[0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00]);
+
+    if legacy {
+        // APP1 (Exif) and APP13 (Photoshop image resources, holding IPTC).
+        let exif = tiff_stream(Vec::new(), true, 0);
+        segment(&mut d, 0xE1, &[&b"Exif\0\0"[..], &exif].concat());
+        segment(&mut d, 0xED, &photoshop_iptc());
+    }
+
+    // SOF0: 8 bits, 1x1, one component.
+    d.extend_from_slice(&[0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x00, 0x01, 0x00, 0x01]);
+    d.extend_from_slice(&[0x01, 0x01, 0x11, 0x00]);
+
+    // SOS, then the (inert) entropy-coded data.
+    d.extend_from_slice(&[0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00]);
+    d.resize(d.len() + payload.max(2), 0);
+
+    d.extend_from_slice(&[0xFF, 0xD9]);
+    d
+}
+
+fn png(payload: usize) -> Vec<u8> {
+    fn chunk(d: &mut Vec<u8>, kind: &[u8; 4], data: &[u8]) {
+        d.extend_from_slice(&be32(data.len() as u32));
+        let start = d.len();
+        d.extend_from_slice(kind);
+        d.extend_from_slice(data);
+        let crc = crc32(&d[start..]);
+        d.extend_from_slice(&be32(crc));
+    }
+
+    let mut d = vec![0x89, b'P', b'N', b'G', 0x0D, 0x0A, 0x1A, 0x0A];
+
+    let mut ihdr = Vec::new();
+    ihdr.extend_from_slice(&be32(1));
+    ihdr.extend_from_slice(&be32(1));
+    ihdr.extend_from_slice(&[8, 0, 0, 0, 0]);
+    chunk(&mut d, b"IHDR", &ihdr);
+
+    chunk(&mut d, b"IDAT", &vec![0u8; payload.max(1)]);
+    chunk(&mut d, b"IEND", &[]);
+    d
+}
+
+fn tiff(payload: usize) -> Vec<u8> {
+    tiff_image(payload, false)
+}
+
+fn tiff_exif(payload: usize) -> Vec<u8> {
+    tiff_image(payload, true)
+}
+
+fn tiff_image(payload: usize, legacy: bool) -> Vec<u8> {
+    let strip = payload.max(1) as u32;
+    let mut primary = vec![
+        long(256, strip), // ImageWidth
+        long(257, 1),     // ImageLength
+        short(258, 8),    // BitsPerSample
+        short(259, 1),    // Compression: none
+        short(262, 1),    // PhotometricInterpretation: black is zero
+        long(273, 0),     // StripOffsets: filled in by tiff_stream
+        long(278, 1),     // RowsPerStrip
+        long(279, strip), // StripByteCounts
+    ];
+    if legacy {
+        primary.push(undefined(33723, &iptc())); // IPTC-NAA
+    }
+    tiff_stream(primary, legacy, strip as usize)
+}
+
+// --- TIFF streams, for TIFF files and for Exif in JPEG
+
+// One IFD entry; `data` holds the little-endian value bytes.
+struct Entry {
+    tag: u16,
+    kind: u16,
+    count: u32,
+    data: Vec<u8>,
+}
+
+fn ascii(tag: u16, value: &str) -> Entry {
+    let mut data = value.as_bytes().to_vec();
+    data.push(0);
+    Entry {
+        tag,
+        kind: 2,
+        count: data.len() as u32,
+        data,
+    }
+}
+
+fn short(tag: u16, value: u16) -> Entry {
+    Entry {
+        tag,
+        kind: 3,
+        count: 1,
+        data: le16(value).to_vec(),
+    }
+}
+
+fn long(tag: u16, value: u32) -> Entry {
+    Entry {
+        tag,
+        kind: 4,
+        count: 1,
+        data: le32(value).to_vec(),
+    }
+}
+
+fn rational(tag: u16, numerator: u32, denominator: u32) -> Entry {
+    let mut data = le32(numerator).to_vec();
+    data.extend_from_slice(&le32(denominator));
+    Entry {
+        tag,
+        kind: 5,
+        count: 1,
+        data,
+    }
+}
+
+fn undefined(tag: u16, data: &[u8]) -> Entry {
+    Entry {
+        tag,
+        kind: 7,
+        count: data.len() as u32,
+        data: data.to_vec(),
+    }
+}
+
+// Lays out an IFD that starts `offset` bytes into the TIFF stream, with
+// its out-of-line values right after it. `entries` must be sorted by tag.
+fn ifd(offset: u32, entries: &[Entry]) -> Vec<u8> {
+    let mut d = Vec::new();
+    let mut values = Vec::new();
+    let values_offset = offset + 2 + entries.len() as u32 * 12 + 4;
+
+    d.extend_from_slice(&le16(entries.len() as u16));
+    for e in entries.iter() {
+        d.extend_from_slice(&le16(e.tag));
+        d.extend_from_slice(&le16(e.kind));
+        d.extend_from_slice(&le32(e.count));
+        if e.data.len() <= 4 {
+            let mut inline = e.data.clone();
+            inline.resize(4, 0);
+            d.extend_from_slice(&inline);
+        } else {
+            d.extend_from_slice(&le32(values_offset + values.len() as u32));
+            values.extend_from_slice(&e.data);
+            if values.len() % 2 == 1 {
+                values.push(0);
+            }
+        }
+    }
+    d.extend_from_slice(&le32(0)); // no next IFD
+    d.extend_from_slice(&values);
+    d
+}
+
+// Returns a little-endian TIFF stream whose primary IFD holds `primary`,
+// followed by `tail` bytes of image data. An entry with tag 273
+// (StripOffsets) is pointed at that data. With `exif`, the primary IFD also
+// gets the tags a camera writes, and an Exif IFD is added.
+fn tiff_stream(mut primary: Vec<Entry>, exif: bool, tail: usize) -> Vec<u8> {
+    let mut exif_entries = Vec::new();
+    if exif {
+        primary.push(ascii(270, "A purple square on a white ground"));
+        primary.push(ascii(271, "Example Camera Co."));
+        primary.push(ascii(272, "EX-100"));
+        primary.push(ascii(306, "2021:06:01 12:34:56"));
+        primary.push(ascii(315, "Jane Doe"));
+        primary.push(ascii(33432, "Copyright 2021 Jane Doe"));
+        primary.push(long(34665, 0)); // Exif IFD: filled in below
+
+        exif_entries = vec![
+            rational(33434, 1, 125),             // ExposureTime
+            rational(33437, 28, 10),             // FNumber
+            short(34855, 200),                   // ISOSpeedRatings
+            undefined(36864, b"0230"),           // ExifVersion
+            ascii(36867, "2021:06:01 12:34:56"), // DateTimeOriginal
+            ascii(36868, "2021:06:01 12:34:56"), // DateTimeDigitized
+            rational(37386, 50, 1),              // FocalLength
+            undefined(40960, b"0100"),           // FlashpixVersion
+            short(40961, 1),                     // ColorSpace: sRGB
+        ];
+    }
+    primary.sort_by_key(|e| e.tag);
+
+    // Offsets are only patched below, so the sizes are already final.
+    let exif_offset = 8 + ifd(8, &primary).len() as u32;
+    let exif_ifd = if exif {
+        ifd(exif_offset, &exif_entries)
+    } else {
+        Vec::new()
+    };
+    let tail_offset = exif_offset + exif_ifd.len() as u32;
+
+    for e in primary.iter_mut() {
+        match e.tag {
+            273 => e.data = le32(tail_offset).to_vec(),
+            34665 => e.data = le32(exif_offset).to_vec(),
+            _ => {}
+        }
+    }
+
+    let mut d = vec![b'I', b'I', 42, 0];
+    d.extend_from_slice(&le32(8));
+    d.extend_from_slice(&ifd(8, &primary));
+    d.extend_from_slice(&exif_ifd);
+    d.resize(d.len() + tail, 0);
+    d
+}
+
+// --- IPTC IIM
+
+// Returns IPTC IIM records as an older editor would write them.
+fn iptc() -> Vec<u8> {
+    fn dataset(d: &mut Vec<u8>, record: u8, number: u8, value: &[u8]) {
+        d.extend_from_slice(&[0x1C, record, number]);
+        d.extend_from_slice(&be16(value.len() as u16));
+        d.extend_from_slice(value);
+    }
+
+    let mut d = Vec::new();
+    dataset(&mut d, 1, 90, b"\x1B%G"); // CodedCharacterSet: UTF-8
+    dataset(&mut d, 2, 0, &be16(4)); // RecordVersion
+    dataset(&mut d, 2, 5, b"Purple Square"); // ObjectName
+    for keyword in ["purple", "square", "benchmark"].iter() {
+        dataset(&mut d, 2, 25, keyword.as_bytes()); // Keywords
+    }
+    dataset(&mut d, 2, 55, b"20210601"); // DateCreated
+    dataset(&mut d, 2, 60, b"123456+0000"); // TimeCreated
+    dataset(&mut d, 2, 80, b"Jane Doe"); // By-line
+    dataset(&mut d, 2, 116, b"Copyright 2021 Jane Doe"); // CopyrightNotice
+    dataset(&mut d, 2, 120, b"A purple square on a white ground"); // Caption
+    d
+}
+
+// Returns an APP13 payload: a Photoshop image resource block holding the
+// IPTC records (resource 0x0404).
+fn photoshop_iptc() -> Vec<u8> {
+    let iptc = iptc();
+
+    let mut d = b"Photoshop 3.0\0".to_vec();
+    d.extend_from_slice(b"8BIM");
+    d.extend_from_slice(&be16(0x0404));
+    d.extend_from_slice(&[0, 0]); // empty name, padded to even length
+    d.extend_from_slice(&be32(iptc.len() as u32));
+    d.extend_from_slice(&iptc);
+    if iptc.len() % 2 == 1 {
+        d.push(0);
+    }
+    d
+}
+
+fn mp4(payload: usize) -> Vec<u8> {
+    let mut d = Vec::new();
+
+    d.extend_from_slice(&be32(24));
+    d.extend_from_slice(b"ftypisom");
+    d.extend_from_slice(&be32(0x200));
+    d.extend_from_slice(b"isommp42");
+
+    // moov containing only an mvhd (version 0).
+    let mut mvhd = Vec::new();
+    mvhd.extend_from_slice(&[0; 4]); // version and flags
+    mvhd.extend_from_slice(&be32(0)); // creation time
+    mvhd.extend_from_slice(&be32(0)); // modification time
+    mvhd.extend_from_slice(&be32(1000)); // time scale
+    mvhd.extend_from_slice(&be32(0)); // duration
+    mvhd.extend_from_slice(&be32(0x0001_0000)); // rate 1.0
+    mvhd.extend_from_slice(&be16(0x0100)); // volume 1.0
+    mvhd.extend_from_slice(&[0; 10]);
+    for v in [0x0001_0000, 0, 0, 0, 0x0001_0000, 0, 0, 0, 0x4000_0000].iter() {
+        mvhd.extend_from_slice(&be32(*v));
+    }
+    mvhd.extend_from_slice(&[0; 24]);
+    mvhd.extend_from_slice(&be32(1)); // next track ID
+
+    d.extend_from_slice(&be32(8 + 8 + mvhd.len() as u32));
+    d.extend_from_slice(b"moov");
+    d.extend_from_slice(&be32(8 + mvhd.len() as u32));
+    d.extend_from_slice(b"mvhd");
+    d.extend_from_slice(&mvhd);
+
+    d.extend_from_slice(&be32(8 + payload as u32));
+    d.extend_from_slice(b"mdat");
+    d.resize(d.len() + payload, 0);
+    d
+}
+
+fn wav(payload: usize) -> Vec<u8> {
+    let data = payload.max(2) & !1;
+
+    let mut d = Vec::new();
+    d.extend_from_slice(b"RIFF");
+    d.extend_from_slice(&le32((4 + 8 + 16 + 8 + data) as u32));
+    d.extend_from_slice(b"WAVE");
+
+    // 16-bit mono PCM at 44.1 kHz.
+    d.extend_from_slice(b"fmt ");
+    d.extend_from_slice(&le32(16));
+    d.extend_from_slice(&le16(1));
+    d.extend_from_slice(&le16(1));
+    d.extend_from_slice(&le32(44_100));
+    d.extend_from_slice(&le32(88_200));
+    d.extend_from_slice(&le16(2));
+    d.extend_from_slice(&le16(16));
+
+    d.extend_from_slice(b"data");
+    d.extend_from_slice(&le32(data as u32));
+    d.resize(d.len() + data, 0);
+    d
+}
+
+fn aiff(payload: usize) -> Vec<u8> {
+    let data = payload.max(2) & !1;
+
+    let mut d = Vec::new();
+    d.extend_from_slice(b"FORM");
+    d.extend_from_slice(&be32((4 + 8 + 18 + 8 + 8 + data) as u32));
+    d.extend_from_slice(b"AIFF");
+
+    // 16-bit mono at 44.1 kHz (as an 80-bit extended float).
+    d.extend_from_slice(b"COMM");
+    d.extend_from_slice(&be32(18));
+    d.extend_from_slice(&be16(1));
+    d.extend_from_slice(&be32((data / 2) as u32));
+    d.extend_from_slice(&be16(16));
+    d.extend_from_slice(&[0x40, 0x0E, 0xAC, 0x44, 0, 0, 0, 0, 0, 0]);
+
+    d.extend_from_slice(b"SSND");
+    d.extend_from_slice(&be32((8 + data) as u32));
+    d.extend_from_slice(&be32(0));
+    d.extend_from_slice(&be32(0));
+    d.resize(d.len() + data, 0);
+    d
+}
+
+fn mp3(payload: usize) -> Vec<u8> {
+    // An empty ID3v2.3 tag, followed by silent MPEG-1 Layer III frames
+    // (128 kbit/s, 44.1 kHz: 417 bytes each).
+    let mut d = b"ID3\x03\x00\x00\x00\x00\x00\x00".to_vec();
+
+    let frames = (payload / 417).max(1);
+    for _ in 0..frames {
+        d.extend_from_slice(&[0xFF, 0xFB, 0x90, 0x64]);
+        d.resize(d.len() + 413, 0);
+    }
+    d
+}
+
+fn svg(payload: usize) -> Vec<u8> {
+    let mut d = br#"<?xml version="1.0" encoding="UTF-8"?>
+<svg xmlns="http://www.w3.org/2000/svg" width="100" height="100">
+<title>benchmark</title>
+"#
+    .to_vec();
+
+    // Roughly `payload` bytes of drawing.
+    let rect = br#"<rect x="0" y="0" width="1" height="1"/>
+"#;
+    for _ in 0..payload / rect.len() {
+        d.extend_from_slice(rect);
+    }
+
+    d.extend_from_slice(b"</svg>\n");
+    d
+}
+
+fn crc32(data: &[u8]) -> u32 {
+    let mut crc = !0u32;
+    for b in data {
+        crc ^= *b as u32;
+        for _ in 0..8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ 0xEDB8_8320
+            } else {
+                crc >> 1
+            };
+        }
+    }
+    !crc
+}
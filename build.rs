@@ -85,7 +85,6 @@ fn main() {
                 .flag("/wd4996")
                 .include("external/xmp_toolkit/XMPCore/resource/win")
                 .include("external/xmp_toolkit/XMPFiles/resource/win")
-                .file("external/xmp_toolkit/XMPCore/source/WXMPIterator.cpp")
                 .file("external/xmp_toolkit/source/Host_IO-Win.cpp")
                 .file("external/xmp_toolkit/XMPFiles/source/PluginHandler/OS_Utils_WIN.cpp");
         }
@@ -214,6 +213,7 @@ fn main() {
         .file("external/xmp_toolkit/source/XMP_ProgressTracker.cpp")
         .file("external/xmp_toolkit/XMPCore/source/ExpatAdapter.cpp")
         .file("external/xmp_toolkit/XMPCore/source/ParseRDF.cpp")
+        .file("external/xmp_toolkit/XMPCore/source/WXMPIterator.cpp")
         .file("external/xmp_toolkit/XMPCore/source/WXMPMeta.cpp")
         .file("external/xmp_toolkit/XMPCore/source/WXMPUtils.cpp")
         .file("external/xmp_toolkit/XMPCore/source/XMPCore_Impl.cpp")
@@ -223,34 +223,11 @@ fn main() {
         .file("external/xmp_toolkit/XMPCore/source/XMPMeta-Parse.cpp")
         .file("external/xmp_toolkit/XMPCore/source/XMPMeta-Serialize.cpp")
         .file("external/xmp_toolkit/XMPCore/source/XMPUtils.cpp")
-        .file("external/xmp_toolkit/XMPCore/source/XMPUtils-FileInfo.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/AIFF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/ASF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/Basic_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/FLV_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/GIF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/InDesign_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/JPEG_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/MP3_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/MPEG2_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/MPEG4_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/P2_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/PNG_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/PostScript_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/PSD_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/RIFF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/Scanner_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/SonyHDV_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/SVG_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/SWF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/TIFF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/Trivial_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/UCF_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/WAVE_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/XDCAM_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/XDCAMEX_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/XDCAMFAM_Handler.cpp")
-        .file("external/xmp_toolkit/XMPFiles/source/FileHandlers/XDCAMSAM_Handler.cpp")
+        .file("external/xmp_toolkit/XMPCore/source/XMPUtils-FileInfo.cpp");
+
+    add_file_handlers(&mut xmp_config);
+
+    xmp_config
         .file("external/xmp_toolkit/XMPFiles/source/FormatSupport/AIFF/AIFFBehavior.cpp")
         .file("external/xmp_toolkit/XMPFiles/source/FormatSupport/AIFF/AIFFMetadata.cpp")
         .file("external/xmp_toolkit/XMPFiles/source/FormatSupport/AIFF/AIFFReconcile.cpp")
@@ -319,10 +296,78 @@ fn main() {
         .file("external/xmp_toolkit/third-party/zlib/uncompr.c")
         .file("external/xmp_toolkit/third-party/zlib/zutil.c")
         .file("src/ffi.cpp")
+        .file("src/memory_io.cpp")
         .file("external/xmp_toolkit/third-party/zuid/interfaces/MD5.cpp")
         .compile("libxmp.a");
 }
 
+// File handlers are compiled in by group, as chosen by the `photo-handlers`,
+// `media-handlers`, and `misc-handlers` features. The XMP Toolkit's
+// handler registry has matching `Enable*Handlers` switches, so a group that
+// is left out is neither compiled nor registered at startup.
+fn add_file_handlers(config: &mut cc::Build) {
+    // Needed for packet scanning and for formats without smart handlers.
+    let always = ["Basic_Handler", "Scanner_Handler", "Trivial_Handler"];
+
+    let photo = [
+        "GIF_Handler",
+        "JPEG_Handler",
+        "PNG_Handler",
+        "PSD_Handler",
+        "TIFF_Handler",
+    ];
+
+    let media = [
+        "AIFF_Handler",
+        "ASF_Handler",
+        "FLV_Handler",
+        "MP3_Handler",
+        "MPEG2_Handler",
+        "MPEG4_Handler",
+        "P2_Handler",
+        "RIFF_Handler",
+        "SonyHDV_Handler",
+        "SWF_Handler",
+        "WAVE_Handler",
+        "XDCAM_Handler",
+        "XDCAMEX_Handler",
+        "XDCAMFAM_Handler",
+        "XDCAMSAM_Handler",
+    ];
+
+    let misc = [
+        "InDesign_Handler",
+        "PostScript_Handler",
+        "SVG_Handler",
+        "UCF_Handler",
+    ];
+
+    let groups: [(&str, &str, &[&str]); 4] = [
+        ("", "", &always),
+        ("PHOTO_HANDLERS", "EnablePhotoHandlers", &photo),
+        ("MEDIA_HANDLERS", "EnableDynamicMediaHandlers", &media),
+        ("MISC_HANDLERS", "EnableMiscHandlers", &misc),
+    ];
+
+    for (feature, switch, handlers) in groups.iter() {
+        let enabled =
+            feature.is_empty() || env::var_os(format!("CARGO_FEATURE_{}", feature)).is_some();
+
+        if !switch.is_empty() {
+            config.define(switch, if enabled { "1" } else { "0" });
+        }
+
+        if enabled {
+            for h in handlers.iter() {
+                config.file(format!(
+                    "external/xmp_toolkit/XMPFiles/source/FileHandlers/{}.cpp",
+                    h
+                ));
+            }
+        }
+    }
+}
+
 fn copy_external_to_third_party(from_path: &str, to_path: &str) {
     use fs_extra::dir::{copy, CopyOptions};
 
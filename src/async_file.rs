@@ -0,0 +1,445 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::collections::VecDeque;
+use std::future::Future;
+use std::panic::{self, AssertUnwindSafe};
+use std::path::PathBuf;
+use std::pin::Pin;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::task::{Context, Poll, Waker};
+use std::thread;
+
+use crate::xmp_file::{
+    CloseOptions, CloseReport, OpenFileOptions, XmpFile, XmpFileError, XmpFileFormat,
+};
+use crate::xmp_meta::XmpMeta;
+
+type Job = Box<dyn FnOnce() + Send>;
+
+/// A small, bounded pool of threads that runs `AsyncXmpFile` operations.
+///
+/// Calls into the XMP Toolkit block, and many of them contend for locks
+/// inside the toolkit, so running them on an async runtime's general
+/// blocking pool (one thread hop per call, with effectively unbounded
+/// parallelism) wastes threads. An `XmpExecutor` instead:
+///
+/// * runs every operation on a given file on the same worker thread, so
+///   consecutive calls on a file cost no thread hops beyond the first;
+///
+/// * has each worker take all of its queued operations at once when it
+///   wakes, so that bursts of small requests are run back to back;
+///
+/// * gives each worker a bounded queue. When the queue is full, new
+///   operations wait (without blocking the async task's thread) until it
+///   drains, so callers feel backpressure instead of piling up work.
+///
+/// The futures returned by `AsyncXmpFile` don't depend on any particular
+/// async runtime. Cloning an `XmpExecutor` is cheap and shares the same
+/// threads, which exit once every clone and every `AsyncXmpFile` using
+/// them is dropped.
+#[derive(Clone)]
+pub struct XmpExecutor {
+    inner: Arc<ExecutorInner>,
+}
+
+struct ExecutorInner {
+    workers: Vec<Arc<Worker>>,
+    next_worker: AtomicUsize,
+}
+
+struct Worker {
+    state: Mutex<WorkerState>,
+    available: Condvar,
+    queue_depth: usize,
+    shutdown: AtomicBool,
+}
+
+struct WorkerState {
+    jobs: VecDeque<Job>,
+    blocked_submitters: Vec<Waker>,
+}
+
+impl Drop for ExecutorInner {
+    fn drop(&mut self) {
+        for w in self.workers.iter() {
+            w.shutdown.store(true, Ordering::Release);
+            w.available.notify_all();
+        }
+    }
+}
+
+impl Default for XmpExecutor {
+    /// Creates an executor with 4 threads and a queue of 32 operations
+    /// per thread.
+    fn default() -> Self {
+        XmpExecutor::new(4, 32)
+    }
+}
+
+impl XmpExecutor {
+    /// Creates an executor with `threads` worker threads, each of which
+    /// accepts up to `queue_depth` pending operations.
+    ///
+    /// Both values are raised to at least 1.
+    pub fn new(threads: usize, queue_depth: usize) -> XmpExecutor {
+        let workers: Vec<Arc<Worker>> = (0..threads.max(1))
+            .map(|_| {
+                Arc::new(Worker {
+                    state: Mutex::new(WorkerState {
+                        jobs: VecDeque::new(),
+                        blocked_submitters: Vec::new(),
+                    }),
+                    available: Condvar::new(),
+                    queue_depth: queue_depth.max(1),
+                    shutdown: AtomicBool::new(false),
+                })
+            })
+            .collect();
+
+        for (i, w) in workers.iter().enumerate() {
+            let w = w.clone();
+            thread::Builder::new()
+                .name(format!("xmp-toolkit-{}", i))
+                .spawn(move || w.run())
+                .expect("failed to start XMP executor thread");
+        }
+
+        XmpExecutor {
+            inner: Arc::new(ExecutorInner {
+                workers,
+                next_worker: AtomicUsize::new(0),
+            }),
+        }
+    }
+
+    // Chooses the worker for a newly opened file.
+    fn assign_worker(&self) -> Arc<Worker> {
+        let workers = &self.inner.workers;
+        let i = self.inner.next_worker.fetch_add(1, Ordering::Relaxed) % workers.len();
+        workers[i].clone()
+    }
+}
+
+impl Worker {
+    fn run(&self) {
+        loop {
+            let batch: Vec<Job> = {
+                let mut state = self.state.lock().unwrap();
+                while state.jobs.is_empty() {
+                    if self.shutdown.load(Ordering::Acquire) {
+                        return;
+                    }
+                    state = self.available.wait(state).unwrap();
+                }
+
+                for w in state.blocked_submitters.drain(..) {
+                    w.wake();
+                }
+                state.jobs.drain(..).collect()
+            };
+
+            for job in batch {
+                job();
+            }
+        }
+    }
+}
+
+// The result of an operation, handed from the worker to the future.
+// A panic in the operation is carried as `Err` and resumed by the future.
+struct Slot<T> {
+    value: Option<thread::Result<T>>,
+    waker: Option<Waker>,
+}
+
+// A future that submits `job` to `worker` (waiting for room in its queue)
+// and then waits for the job's result.
+struct Task<T> {
+    worker: Arc<Worker>,
+    job: Option<Job>,
+    slot: Arc<Mutex<Slot<T>>>,
+}
+
+fn submit<T, F>(worker: &Arc<Worker>, f: F) -> Task<T>
+where
+    T: Send + 'static,
+    F: FnOnce() -> T + Send + 'static,
+{
+    let slot = Arc::new(Mutex::new(Slot {
+        value: None,
+        waker: None,
+    }));
+
+    let job_slot = slot.clone();
+    let job: Job = Box::new(move || {
+        // Catch a panic here so that it doesn't take down the worker
+        // (and with it every other file assigned to that worker).
+        let value = panic::catch_unwind(AssertUnwindSafe(f));
+        let mut slot = job_slot.lock().unwrap();
+        slot.value = Some(value);
+        if let Some(w) = slot.waker.take() {
+            w.wake();
+        }
+    });
+
+    Task {
+        worker: worker.clone(),
+        job: Some(job),
+        slot,
+    }
+}
+
+impl<T> Future for Task<T> {
+    type Output = T;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<T> {
+        let this = self.get_mut();
+
+        if this.job.is_some() {
+            let mut state = this.worker.state.lock().unwrap();
+            if state.jobs.len() >= this.worker.queue_depth {
+                state.blocked_submitters.push(cx.waker().clone());
+                return Poll::Pending;
+            }
+            state.jobs.push_back(this.job.take().unwrap());
+            this.worker.available.notify_one();
+        }
+
+        let mut slot = this.slot.lock().unwrap();
+        match slot.value.take() {
+            Some(Ok(value)) => Poll::Ready(value),
+            Some(Err(payload)) => {
+                drop(slot);
+                panic::resume_unwind(payload)
+            }
+            None => {
+                slot.waker = Some(cx.waker().clone());
+                Poll::Pending
+            }
+        }
+    }
+}
+
+/// An `XmpFile` whose operations run on an `XmpExecutor` and return futures.
+///
+/// Available with the `async` feature. Each method behaves like the
+/// `XmpFile` method of the same name. All operations on one `AsyncXmpFile`
+/// run, in the order they are started, on the same executor thread.
+///
+/// If an operation panics, the panic is resumed in the task awaiting it;
+/// the executor thread carries on with other work.
+pub struct AsyncXmpFile {
+    file: Arc<Mutex<XmpFile>>,
+    worker: Arc<Worker>,
+
+    // Keeps the executor's threads running while the file is open,
+    // even if every `XmpExecutor` handle has been dropped.
+    _executor: Arc<ExecutorInner>,
+}
+
+impl AsyncXmpFile {
+    /// Opens a file; see `XmpFile::open_file()`.
+    pub async fn open<P: Into<PathBuf>>(
+        executor: &XmpExecutor,
+        path: P,
+        format: XmpFileFormat,
+        flags: OpenFileOptions,
+    ) -> Result<AsyncXmpFile, XmpFileError> {
+        let path = path.into();
+        let worker = executor.assign_worker();
+
+        let file = submit(&worker, move || {
+            let mut f = XmpFile::new();
+            f.open_file(&path, format, flags).map(|_| f)
+        })
+        .await?;
+
+        Ok(AsyncXmpFile {
+            file: Arc::new(Mutex::new(file)),
+            worker,
+            _executor: executor.inner.clone(),
+        })
+    }
+
+    /// Retrieves the XMP metadata from the file; see `XmpFile::xmp()`.
+    pub async fn xmp(&self) -> Option<XmpMeta> {
+        let file = self.file.clone();
+        submit(&self.worker, move || file.lock().unwrap().xmp()).await
+    }
+
+    /// Supplies new XMP metadata for the file; see `XmpFile::put_xmp()`.
+    ///
+    /// The file is not written until it is closed.
+    pub async fn put_xmp(&self, meta: XmpMeta) {
+        let file = self.file.clone();
+        submit(&self.worker, move || file.lock().unwrap().put_xmp(&meta)).await
+    }
+
+    /// Closes the file, writing any changes; see `XmpFile::close_with()`.
+    pub async fn close(&self, options: CloseOptions) -> Result<CloseReport, XmpFileError> {
+        let file = self.file.clone();
+        submit(&self.worker, move || {
+            file.lock().unwrap().close_with(options)
+        })
+        .await
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::sync::atomic::AtomicUsize;
+    use std::task::{RawWaker, RawWakerVTable};
+    use std::thread::Thread;
+
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    // A minimal executor for the tests, so that they don't need
+    // an async runtime.
+    fn block_on<F: Future>(mut future: F) -> F::Output {
+        fn clone(data: *const ()) -> RawWaker {
+            let thread = unsafe { Arc::from_raw(data as *const Thread) };
+            let copy = thread.clone();
+            std::mem::forget(thread);
+            RawWaker::new(Arc::into_raw(copy) as *const (), &VTABLE)
+        }
+        fn wake(data: *const ()) {
+            let thread = unsafe { Arc::from_raw(data as *const Thread) };
+            thread.unpark();
+        }
+        fn wake_by_ref(data: *const ()) {
+            let thread = unsafe { &*(data as *const Thread) };
+            thread.unpark();
+        }
+        fn drop(data: *const ()) {
+            unsafe { Arc::from_raw(data as *const Thread) };
+        }
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, wake, wake_by_ref, drop);
+
+        let data = Arc::into_raw(Arc::new(thread::current())) as *const ();
+        let waker = unsafe { Waker::from_raw(RawWaker::new(data, &VTABLE)) };
+        let mut cx = Context::from_waker(&waker);
+
+        let mut future = unsafe { Pin::new_unchecked(&mut future) };
+        loop {
+            if let Poll::Ready(value) = future.as_mut().poll(&mut cx) {
+                return value;
+            }
+            thread::park();
+        }
+    }
+
+    fn fixture_path(name: &str) -> PathBuf {
+        let mut path = PathBuf::from(env::var("CARGO_MANIFEST_DIR").unwrap());
+        path.push("tests/fixtures");
+        path.push(name);
+        path
+    }
+
+    #[test]
+    fn open_and_read() {
+        let executor = XmpExecutor::new(2, 4);
+
+        let m = block_on(async {
+            let f = AsyncXmpFile::open(
+                &executor,
+                fixture_path("Purple Square.psd"),
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_READ,
+            )
+            .await
+            .unwrap();
+
+            let m = f.xmp().await;
+            f.close(CloseOptions::empty()).await.unwrap();
+            m
+        });
+
+        assert!(m.unwrap().does_property_exist(XMP_NS_XMP, "CreatorTool"));
+    }
+
+    #[test]
+    fn file_outlives_executor() {
+        let executor = XmpExecutor::new(1, 4);
+        let f = block_on(AsyncXmpFile::open(
+            &executor,
+            fixture_path("Purple Square.psd"),
+            XmpFileFormat::Unknown,
+            OpenFileOptions::OPEN_FOR_READ,
+        ))
+        .unwrap();
+        drop(executor);
+
+        let m = block_on(f.xmp());
+        assert!(m.unwrap().does_property_exist(XMP_NS_XMP, "CreatorTool"));
+        block_on(f.close(CloseOptions::empty())).unwrap();
+    }
+
+    #[test]
+    fn panicking_job() {
+        let executor = XmpExecutor::new(1, 4);
+        let worker = executor.assign_worker();
+
+        let r = panic::catch_unwind(AssertUnwindSafe(|| {
+            block_on(submit(&worker, || -> usize { panic!("job failed") }))
+        }));
+        let payload = r.unwrap_err();
+        assert_eq!(payload.downcast_ref::<&str>(), Some(&"job failed"));
+
+        // The worker is still running.
+        assert_eq!(block_on(submit(&worker, || 42)), 42);
+    }
+
+    #[test]
+    fn open_missing_file() {
+        let executor = XmpExecutor::default();
+        let r = block_on(AsyncXmpFile::open(
+            &executor,
+            "doesnt_exist.psd",
+            XmpFileFormat::Unknown,
+            OpenFileOptions::OPEN_FOR_READ,
+        ));
+        assert!(r.is_err());
+    }
+
+    #[test]
+    fn backpressure() {
+        // One thread with room for one queued job: the rest wait their
+        // turn, and every one still completes.
+        let executor = XmpExecutor::new(1, 1);
+        let worker = executor.assign_worker();
+        let done = Arc::new(AtomicUsize::new(0));
+
+        let handles: Vec<_> = (0..8)
+            .map(|_| {
+                let worker = worker.clone();
+                let done = done.clone();
+                thread::spawn(move || {
+                    block_on(submit(&worker, move || {
+                        thread::sleep(std::time::Duration::from_millis(5));
+                        done.fetch_add(1, Ordering::SeqCst);
+                    }))
+                })
+            })
+            .collect();
+
+        for h in handles {
+            h.join().unwrap();
+        }
+        assert_eq!(done.load(Ordering::SeqCst), 8);
+    }
+}
@@ -0,0 +1,744 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::collections::HashMap;
+use std::os::raw::{c_char, c_void};
+use std::panic::{self, AssertUnwindSafe};
+use std::path::{Path, PathBuf};
+use std::sync::mpsc::{sync_channel, Receiver, SyncSender};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::{self, JoinHandle};
+
+use crate::ffi;
+use crate::xmp_file::{OpenFileOptions, XmpFile, XmpFileFormat};
+use crate::xmp_meta::{push_c_str, XmpMeta};
+
+/// The type of a column produced by `extract_columns()`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum ColumnType {
+    /// The property's value as a UTF-8 string.
+    ///
+    /// Laid out as an Arrow `Utf8` array.
+    Utf8,
+
+    /// The property's value interpreted as an XMP date, converted to
+    /// microseconds since the Unix epoch, UTC. Dates without a time zone
+    /// are taken to be UTC. Values that are not valid dates are null.
+    ///
+    /// Laid out as an Arrow `Timestamp(Microsecond, "UTC")` array.
+    TimestampMicros,
+}
+
+/// Describes one column requested from `extract_columns()`.
+#[derive(Clone, Debug)]
+pub struct ColumnSpec {
+    /// The namespace URI of the property; see `XmpMeta::property()`.
+    pub schema_ns: String,
+
+    /// The name (or path) of the property; see `XmpMeta::property()`.
+    pub prop_name: String,
+
+    /// The type of column to produce.
+    pub column_type: ColumnType,
+}
+
+impl ColumnSpec {
+    /// Requests a string column for the given property.
+    pub fn utf8(schema_ns: &str, prop_name: &str) -> ColumnSpec {
+        ColumnSpec {
+            schema_ns: schema_ns.to_owned(),
+            prop_name: prop_name.to_owned(),
+            column_type: ColumnType::Utf8,
+        }
+    }
+
+    /// Requests a timestamp column for the given date property.
+    pub fn timestamp(schema_ns: &str, prop_name: &str) -> ColumnSpec {
+        ColumnSpec {
+            schema_ns: schema_ns.to_owned(),
+            prop_name: prop_name.to_owned(),
+            column_type: ColumnType::TimestampMicros,
+        }
+    }
+}
+
+/// The values of one column, in Arrow's memory layout.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum ColumnData {
+    /// A `Utf8` array: the value for row `i` is
+    /// `values[offsets[i] as usize..offsets[i + 1] as usize]`.
+    Utf8 {
+        /// One more offset than there are rows.
+        offsets: Vec<i32>,
+
+        /// The concatenated UTF-8 values.
+        values: Vec<u8>,
+    },
+
+    /// A `Timestamp(Microsecond, "UTC")` array, one value per row.
+    /// The value for a null row is zero.
+    TimestampMicros(Vec<i64>),
+}
+
+/// One column of a `ColumnBatch`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Column {
+    /// Arrow validity bitmap: bit `i` (least significant bit first) is set
+    /// if row `i` is not null.
+    pub validity: Vec<u8>,
+
+    /// The number of null rows.
+    pub null_count: usize,
+
+    /// The values.
+    pub data: ColumnData,
+}
+
+impl Column {
+    fn new(column_type: ColumnType, rows: usize) -> Column {
+        let data = match column_type {
+            ColumnType::Utf8 => {
+                let mut offsets = Vec::with_capacity(rows + 1);
+                offsets.push(0);
+                ColumnData::Utf8 {
+                    offsets,
+                    values: Vec::new(),
+                }
+            }
+            ColumnType::TimestampMicros => ColumnData::TimestampMicros(Vec::with_capacity(rows)),
+        };
+
+        Column {
+            validity: vec![0; (rows + 7) / 8],
+            null_count: 0,
+            data,
+        }
+    }
+
+    /// Returns `true` if row `row` is not null.
+    pub fn is_valid(&self, row: usize) -> bool {
+        self.validity
+            .get(row / 8)
+            .map_or(false, |b| b & (1 << (row % 8)) != 0)
+    }
+
+    /// Returns the string value of row `row`, or `None` if the row is null
+    /// or this is not a `Utf8` column.
+    pub fn str_value(&self, row: usize) -> Option<&str> {
+        match &self.data {
+            ColumnData::Utf8 { offsets, values } if self.is_valid(row) => {
+                let start = offsets[row] as usize;
+                let end = offsets[row + 1] as usize;
+                std::str::from_utf8(&values[start..end]).ok()
+            }
+            _ => None,
+        }
+    }
+
+    /// Returns the timestamp value of row `row`, or `None` if the row is
+    /// null or this is not a `TimestampMicros` column.
+    pub fn timestamp_value(&self, row: usize) -> Option<i64> {
+        match &self.data {
+            ColumnData::TimestampMicros(values) if self.is_valid(row) => Some(values[row]),
+            _ => None,
+        }
+    }
+
+    fn push(&mut self, row: usize, value: Option<ColumnValue>) {
+        match (&mut self.data, value) {
+            (ColumnData::Utf8 { offsets, values }, Some(ColumnValue::Bytes(v))) => {
+                values.extend_from_slice(v);
+                assert!(
+                    values.len() <= i32::MAX as usize,
+                    "column batch exceeds 2 GB of string data; use a smaller batch size"
+                );
+                offsets.push(values.len() as i32);
+            }
+            (ColumnData::TimestampMicros(values), Some(ColumnValue::Micros(v))) => {
+                values.push(v);
+            }
+            (ColumnData::Utf8 { offsets, values }, _) => {
+                offsets.push(values.len() as i32);
+                self.null_count += 1;
+                return;
+            }
+            (ColumnData::TimestampMicros(values), _) => {
+                values.push(0);
+                self.null_count += 1;
+                return;
+            }
+        }
+
+        self.validity[row / 8] |= 1 << (row % 8);
+    }
+}
+
+enum ColumnValue<'a> {
+    Bytes(&'a [u8]),
+    Micros(i64),
+}
+
+/// A batch of rows produced by `extract_columns()`, one row per file.
+#[derive(Clone, Debug)]
+pub struct ColumnBatch {
+    /// The position, in the list passed to `extract_columns()`, of the
+    /// file in the first row of this batch.
+    pub first_row: usize,
+
+    /// The number of rows in this batch.
+    pub num_rows: usize,
+
+    /// One column per `ColumnSpec`, in the order requested.
+    pub columns: Vec<Column>,
+
+    /// For each row, `true` if the file was opened and contains XMP. All
+    /// columns are null in rows for which this is `false`.
+    pub has_xmp: Vec<bool>,
+}
+
+// The requested columns, prepared once and shared by all workers.
+struct ColumnPlan {
+    packed_paths: Vec<u8>,
+    kinds: Vec<u8>,
+    types: Vec<ColumnType>,
+}
+
+impl ColumnPlan {
+    fn new(columns: &[ColumnSpec]) -> ColumnPlan {
+        let mut packed_paths = Vec::new();
+        for c in columns {
+            push_c_str(&mut packed_paths, &c.schema_ns);
+            push_c_str(&mut packed_paths, &c.prop_name);
+        }
+
+        ColumnPlan {
+            packed_paths,
+            kinds: columns
+                .iter()
+                .map(|c| match c.column_type {
+                    ColumnType::Utf8 => 0,
+                    ColumnType::TimestampMicros => 1,
+                })
+                .collect(),
+            types: columns.iter().map(|c| c.column_type).collect(),
+        }
+    }
+}
+
+// Per-worker scratch space, reused for every file.
+struct RowScratch {
+    found: Vec<u8>,
+    values: Vec<i64>,
+    packed_values: Vec<u8>,
+}
+
+fn read_row(m: &XmpMeta, plan: &ColumnPlan, scratch: &mut RowScratch) {
+    unsafe {
+        ffi::CXmpMetaGetColumnValues(
+            m.m,
+            plan.packed_paths.as_ptr() as *const c_char,
+            plan.kinds.len(),
+            plan.kinds.as_ptr(),
+            scratch.found.as_mut_ptr(),
+            scratch.values.as_mut_ptr(),
+            ffi::bytes_sink,
+            &mut scratch.packed_values as *mut Vec<u8> as *mut c_void,
+        );
+    }
+}
+
+/// Reads the requested properties from many files in parallel, directly
+/// into columnar batches.
+///
+/// This is an alternative to `extract_many()` for bulk indexing. Rather
+/// than producing an `XmpMeta` per file (and then a `String` per property),
+/// each worker reads every file's XMP into one reused `XmpMeta` (see
+/// `XmpFile::xmp_into()`) and copies the requested values straight from the
+/// toolkit into column buffers, which use the Arrow in-memory layout (see
+/// `ColumnData`).
+/// The buffers can be handed to an Arrow implementation without conversion.
+///
+/// The files are divided into batches of `batch_size` rows (the last batch
+/// may be shorter). Batches are returned in order, so that row `r` of
+/// the batch starting at `first_row` describes `paths[first_row + r]`. Each
+/// batch is built by a single worker; at most `threads` batches are built
+/// at once. Workers don't run more than `threads` batches ahead of the
+/// consumer, so a slow file can't cause finished batches to pile up in
+/// memory.
+///
+/// ## Arguments
+///
+/// * `paths`: The files to read.
+///
+/// * `columns`: The properties to read from each file, one per column.
+///
+/// * `flags`: Options for opening each file; see `XmpFile::open_file()`.
+/// `OPEN_FOR_READ | OPEN_ONLY_XMP` is typical.
+///
+/// * `threads`: The number of worker threads to start.
+///
+/// * `batch_size`: The number of rows (files) per batch.
+pub fn extract_columns<I, P>(
+    paths: I,
+    columns: &[ColumnSpec],
+    flags: OpenFileOptions,
+    threads: usize,
+    batch_size: usize,
+) -> ExtractColumns
+where
+    I: IntoIterator<Item = P>,
+    P: AsRef<Path>,
+{
+    let paths: Arc<Vec<PathBuf>> = Arc::new(
+        paths
+            .into_iter()
+            .map(|p| p.as_ref().to_path_buf())
+            .collect(),
+    );
+
+    let plan = Arc::new(ColumnPlan::new(columns));
+    let batch_size = batch_size.max(1);
+    let batch_count = (paths.len() + batch_size - 1) / batch_size;
+
+    let threads = threads.max(1).min(batch_count.max(1));
+    let dispatch = Arc::new(Dispatch {
+        state: Mutex::new(DispatchState {
+            next: 0,
+            consumed: 0,
+            stopped: false,
+        }),
+        changed: Condvar::new(),
+        window: threads,
+    });
+    let (sender, receiver) = sync_channel(threads);
+
+    let workers = (0..threads)
+        .map(|_| {
+            let paths = Arc::clone(&paths);
+            let plan = Arc::clone(&plan);
+            let dispatch = Arc::clone(&dispatch);
+            let sender = sender.clone();
+            thread::spawn(move || {
+                columns_worker(&paths, &plan, &dispatch, flags, batch_size, &sender)
+            })
+        })
+        .collect();
+
+    ExtractColumns {
+        receiver: Some(receiver),
+        workers,
+        dispatch,
+        pending: HashMap::new(),
+        next_batch: 0,
+        batch_count,
+    }
+}
+
+// Hands out batch indexes to the workers. A worker may not start a batch
+// more than `window` batches ahead of the one the consumer is waiting
+// for, so a slow batch can't cause the later ones to pile up in memory.
+struct Dispatch {
+    state: Mutex<DispatchState>,
+    changed: Condvar,
+    window: usize,
+}
+
+struct DispatchState {
+    // The next batch index to hand out.
+    next: usize,
+
+    // The number of batches the consumer has taken.
+    consumed: usize,
+
+    // Set when the consumer goes away or a worker fails.
+    stopped: bool,
+}
+
+impl Dispatch {
+    fn claim(&self) -> Option<usize> {
+        let mut state = self.state.lock().unwrap();
+        while !state.stopped && state.next >= state.consumed + self.window {
+            state = self.changed.wait(state).unwrap();
+        }
+
+        if state.stopped {
+            return None;
+        }
+
+        state.next += 1;
+        Some(state.next - 1)
+    }
+
+    fn consumed(&self, count: usize) {
+        self.state.lock().unwrap().consumed = count;
+        self.changed.notify_all();
+    }
+
+    fn stop(&self) {
+        // The lock may have been poisoned by a panicking worker;
+        // stopping must still work.
+        match self.state.lock() {
+            Ok(mut state) => state.stopped = true,
+            Err(e) => e.into_inner().stopped = true,
+        }
+        self.changed.notify_all();
+    }
+}
+
+type BatchResult = (usize, thread::Result<ColumnBatch>);
+
+fn columns_worker(
+    paths: &[PathBuf],
+    plan: &ColumnPlan,
+    dispatch: &Dispatch,
+    flags: OpenFileOptions,
+    batch_size: usize,
+    sender: &SyncSender<BatchResult>,
+) {
+    let mut f = XmpFile::new();
+    let mut meta = XmpMeta::new();
+    let mut scratch = RowScratch {
+        found: vec![0; plan.kinds.len()],
+        values: vec![0; plan.kinds.len()],
+        packed_values: Vec::new(),
+    };
+
+    while let Some(batch_index) = dispatch.claim() {
+        let first_row = batch_index.saturating_mul(batch_size);
+        if first_row >= paths.len() {
+            return;
+        }
+
+        let rows = &paths[first_row..paths.len().min(first_row + batch_size)];
+
+        // A panic is sent to the consumer in place of the batch, so that
+        // it is reported rather than leaving a gap in the output.
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+            build_batch(
+                &mut f,
+                &mut meta,
+                &mut scratch,
+                plan,
+                flags,
+                first_row,
+                rows,
+            )
+        }));
+        let failed = result.is_err();
+
+        if sender.send((batch_index, result)).is_err() || failed {
+            // The consumer has gone away, or this worker's state
+            // can't be trusted after a panic.
+            return;
+        }
+    }
+}
+
+fn build_batch(
+    f: &mut XmpFile,
+    meta: &mut XmpMeta,
+    scratch: &mut RowScratch,
+    plan: &ColumnPlan,
+    flags: OpenFileOptions,
+    first_row: usize,
+    rows: &[PathBuf],
+) -> ColumnBatch {
+    let mut columns: Vec<Column> = plan
+        .types
+        .iter()
+        .map(|t| Column::new(*t, rows.len()))
+        .collect();
+    let mut has_xmp = Vec::with_capacity(rows.len());
+
+    for (row, path) in rows.iter().enumerate() {
+        let found = match f.open_file(path, XmpFileFormat::Unknown, flags) {
+            Ok(()) => {
+                let found = f.xmp_into(meta);
+                f.close();
+                found
+            }
+            Err(_) => false,
+        };
+
+        has_xmp.push(found);
+
+        if found {
+            read_row(meta, plan, scratch);
+
+            let mut offset = 0;
+            for (i, column) in columns.iter_mut().enumerate() {
+                let value = if scratch.found[i] == 0 {
+                    None
+                } else if plan.types[i] == ColumnType::Utf8 {
+                    let end = offset + scratch.values[i] as usize;
+                    let bytes = &scratch.packed_values[offset..end];
+                    offset = end;
+                    Some(ColumnValue::Bytes(bytes))
+                } else {
+                    Some(ColumnValue::Micros(scratch.values[i]))
+                };
+                column.push(row, value);
+            }
+        } else {
+            for column in &mut columns {
+                column.push(row, None);
+            }
+        }
+    }
+
+    ColumnBatch {
+        first_row,
+        num_rows: rows.len(),
+        columns,
+        has_xmp,
+    }
+}
+
+/// An iterator over the batches produced by `extract_columns()`.
+///
+/// If a worker thread panics while building a batch, the panic is resumed
+/// on the thread calling `next()` when that batch's turn comes, rather
+/// than ending the iteration early.
+pub struct ExtractColumns {
+    receiver: Option<Receiver<BatchResult>>,
+    workers: Vec<JoinHandle<()>>,
+    dispatch: Arc<Dispatch>,
+
+    // Batches that arrived ahead of their turn. There are never more
+    // than `threads` of them; see `Dispatch`.
+    pending: HashMap<usize, thread::Result<ColumnBatch>>,
+    next_batch: usize,
+    batch_count: usize,
+}
+
+impl Iterator for ExtractColumns {
+    type Item = ColumnBatch;
+
+    fn next(&mut self) -> Option<ColumnBatch> {
+        if self.next_batch >= self.batch_count {
+            return None;
+        }
+
+        loop {
+            if let Some(result) = self.pending.remove(&self.next_batch) {
+                self.next_batch += 1;
+                self.dispatch.consumed(self.next_batch);
+
+                match result {
+                    Ok(batch) => return Some(batch),
+                    Err(e) => {
+                        self.dispatch.stop();
+                        panic::resume_unwind(e);
+                    }
+                }
+            }
+
+            let received = match self.receiver.as_ref() {
+                Some(receiver) => receiver.recv().ok(),
+                None => None,
+            };
+
+            match received {
+                Some((index, result)) => {
+                    self.pending.insert(index, result);
+                }
+                None => {
+                    // Every worker has exited, yet a batch is missing.
+                    self.dispatch.stop();
+                    self.join_workers();
+                    panic!("extract_columns worker exited without producing a batch");
+                }
+            }
+        }
+    }
+}
+
+impl ExtractColumns {
+    // Waits for the workers, resuming the first panic found
+    // (unless this thread is already panicking).
+    fn join_workers(&mut self) {
+        let mut failure = None;
+        for worker in self.workers.drain(..) {
+            if let Err(e) = worker.join() {
+                failure = failure.or(Some(e));
+            }
+        }
+
+        if let Some(e) = failure {
+            if !thread::panicking() {
+                panic::resume_unwind(e);
+            }
+        }
+    }
+}
+
+impl Drop for ExtractColumns {
+    fn drop(&mut self) {
+        // Stopping dispatch and dropping the receiver unblocks any worker
+        // waiting for a batch index or waiting to send.
+        self.dispatch.stop();
+        self.receiver = None;
+        self.join_workers();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::path::PathBuf;
+
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    fn fixture_path(name: &str) -> PathBuf {
+        let root_dir = &env::var("CARGO_MANIFEST_DIR").expect("$CARGO_MANIFEST_DIR");
+        let mut path = PathBuf::from(root_dir);
+        path.push("tests/fixtures");
+        path.push(name);
+        path
+    }
+
+    #[test]
+    fn extract_columns_bounded_window() {
+        // Many more batches than threads: workers must wait for the
+        // consumer, and every batch still arrives in order.
+        let paths = vec![fixture_path("Purple Square.psd"); 12];
+        let columns = [ColumnSpec::utf8(XMP_NS_XMP, "CreatorTool")];
+
+        let mut batches = extract_columns(&paths, &columns, OpenFileOptions::OPEN_FOR_READ, 2, 1);
+
+        let first = batches.next().unwrap();
+        assert_eq!(first.first_row, 0);
+        assert!(batches.pending.len() <= 2);
+
+        let rest: Vec<usize> = batches.map(|b| b.first_row).collect();
+        assert_eq!(rest, (1..12).collect::<Vec<_>>());
+    }
+
+    #[test]
+    fn extract_columns_in_order() {
+        let mut paths = vec![fixture_path("Purple Square.psd"); 10];
+        paths[3] = PathBuf::from("doesnotexist.jpg");
+
+        let columns = [
+            ColumnSpec::utf8(XMP_NS_XMP, "CreatorTool"),
+            ColumnSpec::timestamp(XMP_NS_XMP, "CreateDate"),
+            ColumnSpec::utf8(XMP_NS_XMP, "Nonexistent"),
+        ];
+
+        let batches: Vec<ColumnBatch> = extract_columns(
+            &paths,
+            &columns,
+            OpenFileOptions::OPEN_FOR_READ | OpenFileOptions::OPEN_ONLY_XMP,
+            3,
+            4,
+        )
+        .collect();
+
+        assert_eq!(batches.len(), 3);
+        assert_eq!(
+            batches.iter().map(|b| b.first_row).collect::<Vec<_>>(),
+            vec![0, 4, 8]
+        );
+        assert_eq!(
+            batches.iter().map(|b| b.num_rows).collect::<Vec<_>>(),
+            vec![4, 4, 2]
+        );
+
+        for batch in &batches {
+            assert_eq!(batch.columns.len(), 3);
+
+            for row in 0..batch.num_rows {
+                let creator_tool = &batch.columns[0];
+                let create_date = &batch.columns[1];
+                let nonexistent = &batch.columns[2];
+
+                assert!(!nonexistent.is_valid(row));
+
+                if batch.first_row + row == 3 {
+                    assert!(!batch.has_xmp[row]);
+                    assert!(!creator_tool.is_valid(row));
+                    assert!(!create_date.is_valid(row));
+                } else {
+                    assert!(batch.has_xmp[row]);
+                    assert_eq!(
+                        creator_tool.str_value(row),
+                        Some("Adobe Photoshop CS2 Windows")
+                    );
+
+                    // 2006-04-25T15:32:01+02:00
+                    assert_eq!(
+                        create_date.timestamp_value(row),
+                        Some(1_145_971_921_000_000)
+                    );
+                }
+            }
+        }
+
+        assert_eq!(batches[0].columns[0].null_count, 1);
+        assert_eq!(batches[0].columns[2].null_count, 4);
+    }
+
+    #[test]
+    fn timestamp_range() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreateDate", "2006-04-25T15:32:01+02:00");
+        m.set_property(XMP_NS_XMP, "ModifyDate", "300000-01-01T00:00:00Z");
+        m.set_property(XMP_NS_XMP, "MetadataDate", "2147483647-12-31T23:59:59Z");
+
+        let plan = ColumnPlan::new(&[
+            ColumnSpec::timestamp(XMP_NS_XMP, "CreateDate"),
+            ColumnSpec::timestamp(XMP_NS_XMP, "ModifyDate"),
+            ColumnSpec::timestamp(XMP_NS_XMP, "MetadataDate"),
+        ]);
+        let mut scratch = RowScratch {
+            found: vec![0; 3],
+            values: vec![0; 3],
+            packed_values: Vec::new(),
+        };
+        read_row(&m, &plan, &mut scratch);
+
+        // Years whose microsecond count would overflow an i64 are nulls.
+        assert_eq!(scratch.found, vec![1, 0, 0]);
+        assert_eq!(scratch.values[0], 1_145_971_921_000_000);
+    }
+
+    #[test]
+    fn utf8_layout() {
+        let mut c = Column::new(ColumnType::Utf8, 3);
+        c.push(0, Some(ColumnValue::Bytes(b"ab")));
+        c.push(1, None);
+        c.push(2, Some(ColumnValue::Bytes(b"cde")));
+
+        assert_eq!(c.validity, vec![0b101]);
+        assert_eq!(c.null_count, 1);
+        assert_eq!(
+            c.data,
+            ColumnData::Utf8 {
+                offsets: vec![0, 2, 2, 5],
+                values: b"abcde".to_vec()
+            }
+        );
+    }
+
+    #[test]
+    fn extract_columns_empty() {
+        let paths: Vec<PathBuf> = vec![];
+        let columns = [ColumnSpec::utf8(XMP_NS_XMP, "CreatorTool")];
+        assert_eq!(
+            extract_columns(&paths, &columns, OpenFileOptions::OPEN_FOR_READ, 4, 16).count(),
+            0
+        );
+    }
+}
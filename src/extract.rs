@@ -0,0 +1,216 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc::{sync_channel, Receiver, SyncSender};
+use std::sync::Arc;
+use std::thread::{self, JoinHandle};
+
+use crate::xmp_file::{OpenFileOptions, XmpFile, XmpFileError, XmpFileFormat};
+use crate::xmp_meta::XmpMeta;
+
+/// The result of reading the XMP from one file in `extract_many()`.
+pub struct ExtractedXmp {
+    /// The position of this file in the list passed to `extract_many()`.
+    pub index: usize,
+
+    /// The path of the file.
+    pub path: PathBuf,
+
+    /// The XMP read from the file, `None` if the file contains no XMP,
+    /// or an error if the file could not be opened.
+    pub result: Result<Option<XmpMeta>, XmpFileError>,
+}
+
+/// Reads the XMP from many files in parallel.
+///
+/// This starts a pool of `threads` worker threads (at least one), each of
+/// which reuses a single `XmpFile` to open, read, and close files from `paths`
+/// in turn. Several files are therefore in flight at once, so that I/O for some
+/// files overlaps with parsing of others.
+///
+/// Results are returned through the `ExtractMany` iterator as soon as they are
+/// available; this is generally *not* the order in which paths were given. Use
+/// `ExtractedXmp::index` to correlate results with the input. Workers only run
+/// a bounded distance ahead of the consumer, so results that are not consumed
+/// do not accumulate without limit.
+///
+/// Dropping the iterator before it is exhausted stops the workers after the
+/// files they are currently reading.
+///
+/// ## Arguments
+///
+/// * `paths`: The files to read.
+///
+/// * `flags`: Options for opening each file; see `XmpFile::open_file()`.
+/// For read-only extraction, `OPEN_FOR_READ | OPEN_ONLY_XMP` is typical.
+///
+/// * `threads`: The number of worker threads to start.
+pub fn extract_many<I, P>(paths: I, flags: OpenFileOptions, threads: usize) -> ExtractMany
+where
+    I: IntoIterator<Item = P>,
+    P: AsRef<Path>,
+{
+    let paths: Arc<Vec<PathBuf>> = Arc::new(
+        paths
+            .into_iter()
+            .map(|p| p.as_ref().to_path_buf())
+            .collect(),
+    );
+
+    let threads = threads.max(1).min(paths.len().max(1));
+    let next = Arc::new(AtomicUsize::new(0));
+    let (sender, receiver) = sync_channel(threads * 4);
+
+    let workers = (0..threads)
+        .map(|_| {
+            let paths = Arc::clone(&paths);
+            let next = Arc::clone(&next);
+            let sender = sender.clone();
+            thread::spawn(move || extract_worker(&paths, &next, flags, &sender))
+        })
+        .collect();
+
+    ExtractMany {
+        receiver: Some(receiver),
+        workers,
+    }
+}
+
+fn extract_worker(
+    paths: &[PathBuf],
+    next: &AtomicUsize,
+    flags: OpenFileOptions,
+    sender: &SyncSender<ExtractedXmp>,
+) {
+    let mut f = XmpFile::new();
+
+    loop {
+        let index = next.fetch_add(1, Ordering::Relaxed);
+        if index >= paths.len() {
+            return;
+        }
+
+        let path = &paths[index];
+        let result = f.open_file(path, XmpFileFormat::Unknown, flags).map(|_| {
+            let m = f.xmp();
+            f.close();
+            m
+        });
+
+        let extracted = ExtractedXmp {
+            index,
+            path: path.clone(),
+            result,
+        };
+
+        if sender.send(extracted).is_err() {
+            // The consumer has gone away.
+            return;
+        }
+    }
+}
+
+/// An iterator over the results of `extract_many()`.
+pub struct ExtractMany {
+    receiver: Option<Receiver<ExtractedXmp>>,
+    workers: Vec<JoinHandle<()>>,
+}
+
+impl Iterator for ExtractMany {
+    type Item = ExtractedXmp;
+
+    fn next(&mut self) -> Option<ExtractedXmp> {
+        // recv() fails once every worker has finished and
+        // dropped its sender.
+        self.receiver.as_ref().and_then(|r| r.recv().ok())
+    }
+}
+
+impl Drop for ExtractMany {
+    fn drop(&mut self) {
+        // Dropping the receiver first unblocks any worker waiting to send.
+        self.receiver = None;
+
+        for worker in self.workers.drain(..) {
+            let _ = worker.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::path::PathBuf;
+
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    fn fixture_path(name: &str) -> PathBuf {
+        let root_dir = &env::var("CARGO_MANIFEST_DIR").expect("$CARGO_MANIFEST_DIR");
+        let mut path = PathBuf::from(root_dir);
+        path.push("tests/fixtures");
+        path.push(name);
+        path
+    }
+
+    #[test]
+    fn extract_many_files() {
+        let purple_square = fixture_path("Purple Square.psd");
+        let mut paths = vec![purple_square; 20];
+        paths[7] = PathBuf::from("doesnotexist.jpg");
+
+        let mut results: Vec<ExtractedXmp> = extract_many(
+            &paths,
+            OpenFileOptions::OPEN_FOR_READ | OpenFileOptions::OPEN_ONLY_XMP,
+            4,
+        )
+        .collect();
+
+        results.sort_by_key(|r| r.index);
+        assert_eq!(results.len(), 20);
+
+        for (i, r) in results.iter().enumerate() {
+            assert_eq!(r.index, i);
+            assert_eq!(r.path, paths[i]);
+
+            if i == 7 {
+                assert!(r.result.is_err());
+            } else {
+                let m = r.result.as_ref().unwrap().as_ref().unwrap();
+                assert_eq!(
+                    m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+                    "Adobe Photoshop CS2 Windows"
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn extract_many_empty() {
+        let paths: Vec<PathBuf> = vec![];
+        assert_eq!(
+            extract_many(&paths, OpenFileOptions::OPEN_FOR_READ, 4).count(),
+            0
+        );
+    }
+
+    #[test]
+    fn extract_many_dropped_early() {
+        let paths = vec![fixture_path("Purple Square.psd"); 50];
+        let mut results = extract_many(&paths, OpenFileOptions::OPEN_FOR_READ, 2);
+        assert!(results.next().is_some());
+    }
+}
@@ -11,9 +11,15 @@
 // specific language governing permissions and limitations under
 // each license.
 
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <fstream>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #define TXMP_STRING_TYPE std::string
 #define XMP_INCLUDE_XMPFILES 1
@@ -21,16 +27,23 @@
 #include "XMP.incl_cpp"
 #ifndef NOOP_FFI
     #include "XMP.hpp"
+    #include "memory_io.hpp"
 #endif
 
-std::once_flag xmp_init_flag;
+// The toolkit is initialized in two steps, each on first use. XMPCore
+// (parsing, serializing, property access) needs only SXMPMeta::Initialize.
+// SXMPFiles::Initialize, which registers every compiled-in file handler,
+// is deferred until a file is actually opened or sniffed, so processes
+// that only work with packets never pay for it.
 
-inline void init_xmp_fn() {
+std::once_flag xmp_meta_init_flag;
+std::once_flag xmp_files_init_flag;
+
+inline void init_xmp_meta_fn() {
     #ifndef NOOP_FFI
         // TO DO: Check return status from Initialize functions.
         try {
             SXMPMeta::Initialize();
-            SXMPFiles::Initialize(kXMPFiles_IgnoreLocalText);
         }
         catch (XMP_Error& e) {
             fprintf(stderr, "Failed to initialize XMP Toolkit: %s\n", e.GetErrMsg());
@@ -42,21 +55,125 @@ inline void init_xmp_fn() {
     // Or do we care that it's a messy exit?
 }
 
+inline void init_xmp_files_fn() {
+    #ifndef NOOP_FFI
+        try {
+            SXMPFiles::Initialize(kXMPFiles_IgnoreLocalText);
+        }
+        catch (XMP_Error& e) {
+            fprintf(stderr, "Failed to initialize XMP Toolkit: %s\n", e.GetErrMsg());
+            exit(1);
+        }
+    #endif
+}
+
 static void init_xmp() {
-    std::call_once(xmp_init_flag, init_xmp_fn);
+    std::call_once(xmp_meta_init_flag, init_xmp_meta_fn);
+}
+
+static void init_xmp_files() {
+    init_xmp();
+    std::call_once(xmp_files_init_flag, init_xmp_files_fn);
 }
 
+// WrapperPool keeps a small free list of released wrapper blocks for
+// one wrapper type (CXmpFile, CXmpMeta). Processing one file after
+// another (new, open, read, drop, repeat) then reuses the same blocks
+// rather than returning to the heap for every file.
+
+template <typename T>
+class WrapperPool {
+public:
+    static void* Allocate(size_t size) {
+        if (size < sizeof(FreeBlock)) size = sizeof(FreeBlock);
+        {
+            std::lock_guard<std::mutex> lock(Mutex());
+            FreeBlock*& head = Head();
+            if (head != NULL && size == BlockSize()) {
+                FreeBlock* block = head;
+                head = block->next;
+                --Count();
+                return block;
+            }
+        }
+        return ::operator new(size);
+    }
+
+    static void Release(void* p) {
+        if (p == NULL) return;
+        {
+            std::lock_guard<std::mutex> lock(Mutex());
+            if (Count() < kMaxFreeBlocks) {
+                FreeBlock* block = static_cast<FreeBlock*>(p);
+                block->next = Head();
+                Head() = block;
+                ++Count();
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static const size_t kMaxFreeBlocks = 64;
+
+    static size_t BlockSize() { return sizeof(T) < sizeof(FreeBlock) ? sizeof(FreeBlock) : sizeof(T); }
+
+    static std::mutex& Mutex() { static std::mutex m; return m; }
+    static FreeBlock*& Head() { static FreeBlock* head = NULL; return head; }
+    static size_t& Count() { static size_t count = 0; return count; }
+};
+
+#define XMP_POOLED_WRAPPER(T) \
+    static void* operator new(size_t size) { return WrapperPool<T>::Allocate(size); } \
+    static void operator delete(void* p) { WrapperPool<T>::Release(p); }
+
 extern "C" {
+    // Progress is reported to Rust through a C-compatible function that
+    // returns nonzero to continue or zero to abort the operation.
+    typedef int (*CXmpProgressFn)(void* context,
+                                  float elapsedTime,
+                                  float fractionDone,
+                                  float secondsToGo);
+
     typedef struct CXmpFile {
+        XMP_POOLED_WRAPPER(CXmpFile)
+
         #ifdef NOOP_FFI
             int x;
         #else
+            // In-memory file image, if opened via CXmpFileOpenFromBytes
+            // or CXmpFileOpenMapped.
+            // Declared before `f` so that it outlives any reference
+            // XMPFiles holds to it.
+            std::unique_ptr<MemoryIO> io;
             SXMPFiles f;
+
+            // Set when new XMP is supplied, for CXmpFileCloseWith's report.
+            // inPlaceLength is the packet size if that XMP came from
+            // CXmpFilePutXmpInPlace, or -1 otherwise.
+            bool xmpPut;
+            XMP_Int64 inPlaceLength;
+
+            // Set by CXmpFileSetProgressCallback.
+            CXmpProgressFn progressFn;
+            void* progressContext;
+
+            // The counts of `io` already returned by CXmpFileTakeIoCounts.
+            MemoryIOCounts ioReported;
+
+            CXmpFile()
+                : xmpPut(false), inPlaceLength(-1), progressFn(NULL), progressContext(NULL),
+                  ioReported() {}
         #endif
     } CXmpFile;
 
     CXmpFile* CXmpFileNew() {
-        init_xmp();
+        init_xmp_files();
         return new CXmpFile;
     }
 
@@ -68,18 +185,61 @@ extern "C" {
         #endif
     }
 
+    #ifndef NOOP_FFI
+        static bool progressAdapter(void* context,
+                                    float elapsedTime,
+                                    float fractionDone,
+                                    float secondsToGo) {
+            CXmpFile* f = (CXmpFile*) context;
+            return f->progressFn(f->progressContext, elapsedTime, fractionDone, secondsToGo) != 0;
+        }
+    #endif
+
+    void CXmpFileSetProgressCallback(CXmpFile* f,
+                                     CXmpProgressFn progressFn,
+                                     void* context,
+                                     float interval,
+                                     int sendStartStop) {
+        // Passing a NULL progressFn removes the callback. An abort is
+        // reported by the toolkit as kXMPErr_ProgressAbort from whichever
+        // operation was running, which the callers below report as failure.
+
+        #ifndef NOOP_FFI
+            try {
+                f->progressFn = progressFn;
+                f->progressContext = context;
+
+                if (progressFn != NULL) {
+                    f->f.SetProgressCallback(progressAdapter, f, interval, sendStartStop != 0);
+                } else {
+                    f->f.SetProgressCallback(NULL);
+                }
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpFileSetProgressCallback: ERROR %s\n", e.GetErrMsg());
+            }
+        #endif
+    }
+
     int CXmpFileOpen(CXmpFile* f,
                      const char* filePath,
+                     AdobeXMPCommon::uint32 format,
                      AdobeXMPCommon::uint32 openFlags) {
         #ifdef NOOP_FFI
             return 1;
         #else
-            // TO DO: Bridge file format parameter.
-            // For my purposes at the moment,
-            // kXMP_UnknownFile always suffices.
             try {
                 //throw XMP_Error( kXMPErr_UserAbort, "User abort" ); // for testing this
-                return f->f.OpenFile(filePath, kXMP_UnknownFile, openFlags) ? 1 : 0;
+                if (f->f.OpenFile(filePath, (XMP_FileFormat) format, openFlags)) {
+                    // A successful open implies any previous file was closed,
+                    // so a previous in-memory image is no longer referenced.
+                    f->io.reset();
+                    f->ioReported = MemoryIOCounts();
+                    f->xmpPut = false;
+                    f->inPlaceLength = -1;
+                    return 1;
+                }
+                return 0;
             }
             catch (XMP_Error& e) {
                 fprintf(stderr, "Failed to open File: %s, %s\n", filePath, e.GetErrMsg());
@@ -88,43 +248,168 @@ extern "C" {
         #endif
     }
 
-    typedef struct CXmpDateTime {
+    int CXmpFileOpenFromBytes(CXmpFile* f,
+                              const char* data,
+                              size_t length,
+                              AdobeXMPCommon::uint32 format,
+                              AdobeXMPCommon::uint32 openFlags) {
         #ifdef NOOP_FFI
-            int x;
+            return 1;
         #else
-            XMP_DateTime dt;
+            try {
+                bool readOnly = (openFlags & kXMPFiles_OpenForUpdate) == 0;
+                std::unique_ptr<MemoryIO> io(new MemoryIO(data, length, readOnly));
+
+                if (f->f.OpenFile(io.get(), (XMP_FileFormat) format, openFlags)) {
+                    f->io = std::move(io);
+                    f->ioReported = MemoryIOCounts();
+                    f->xmpPut = false;
+                    f->inPlaceLength = -1;
+                    return 1;
+                }
+                return 0;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "Failed to open in-memory file: %s\n", e.GetErrMsg());
+                return 0;
+            }
         #endif
-    } CXmpDateTime;
+    }
+
+    int CXmpFileOpenMapped(CXmpFile* f,
+                           const char* filePath,
+                           AdobeXMPCommon::uint32 format,
+                           AdobeXMPCommon::uint32 openFlags) {
+        #ifdef NOOP_FFI
+            return 1;
+        #else
+            // Mapped views are read-only.
+            if (openFlags & kXMPFiles_OpenForUpdate) {
+                fprintf(stderr, "Can't open mapped file for update: %s\n", filePath);
+                return 0;
+            }
 
-    CXmpDateTime* CXmpDateTimeNew() {
-        return new CXmpDateTime;
+            try {
+                std::unique_ptr<MemoryIO> io(new MappedFileIO(filePath));
+
+                if (f->f.OpenFile(io.get(), (XMP_FileFormat) format, openFlags)) {
+                    f->io = std::move(io);
+                    f->ioReported = MemoryIOCounts();
+                    f->xmpPut = false;
+                    f->inPlaceLength = -1;
+                    return 1;
+                }
+                return 0;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "Failed to open mapped file: %s, %s\n", filePath, e.GetErrMsg());
+                return 0;
+            }
+        #endif
     }
 
-    void CXmpDateTimeDrop(CXmpDateTime* dt) {
-        #ifndef NOOP_FFI
+    AdobeXMPCommon::uint32 CXmpFileCheckFileFormat(const char* filePath) {
+        #ifdef NOOP_FFI
+            return 0x20202020; // kXMP_UnknownFile
+        #else
+            init_xmp_files();
+
             try {
-                delete dt;
+                return SXMPFiles::CheckFileFormat(filePath);
             }
             catch (XMP_Error& e) {
-                fprintf(stderr, "CXMPDateTimeDrop: ERROR %s\n", e.GetErrMsg());
+                fprintf(stderr, "Failed to check file format: %s, %s\n", filePath, e.GetErrMsg());
+                return kXMP_UnknownFile;
             }
         #endif
     }
 
-    CXmpDateTime* CXmpDateTimeCurrent() {
-        CXmpDateTime* dt = new CXmpDateTime;
+    const char* CXmpFileGetBytes(const CXmpFile* f, size_t* length) {
+        #ifdef NOOP_FFI
+            *length = 0;
+            return NULL;
+        #else
+            if (!f->io || !f->io->OwnsData()) {
+                *length = 0;
+                return NULL;
+            }
+
+            *length = f->io->Size();
+            return f->io->Data();
+        #endif
+    }
+
+    void CXmpFileTakeIoCounts(CXmpFile* f,
+                              int64_t* bytesRead,
+                              int64_t* readCalls,
+                              int64_t* bytesWritten,
+                              int64_t* writeCalls) {
+        // Returns the reads and writes made through the file's MemoryIO
+        // since the last call (or since it was opened). All are 0 for files
+        // opened by path, whose I/O isn't observed.
+
+        *bytesRead = 0;
+        *readCalls = 0;
+        *bytesWritten = 0;
+        *writeCalls = 0;
+
+        #ifndef NOOP_FFI
+            if (!f->io) return;
+
+            const MemoryIOCounts& now = f->io->Counts();
+            *bytesRead = now.bytesRead - f->ioReported.bytesRead;
+            *readCalls = now.readCalls - f->ioReported.readCalls;
+            *bytesWritten = now.bytesWritten - f->ioReported.bytesWritten;
+            *writeCalls = now.writeCalls - f->ioReported.writeCalls;
+            f->ioReported = now;
+        #endif
+    }
+
+    // Dates cross the FFI by pointer. `XmpDateTime` in xmp_date_time.rs is
+    // `#[repr(C)]` with the same layout as the toolkit's XMP_DateTime, so
+    // the toolkit reads and writes Rust's value in place. The layout is
+    // checked here and by the `layout` test in xmp_date_time.rs; change
+    // both if either side changes.
+    #ifdef NOOP_FFI
+        typedef struct CXmpDateTime {
+            int x;
+        } CXmpDateTime;
+    #else
+        typedef XMP_DateTime CXmpDateTime;
+
+        static_assert(sizeof(XMP_DateTime) == 40, "XMP_DateTime size");
+        static_assert(offsetof(XMP_DateTime, year) == 0, "XMP_DateTime::year");
+        static_assert(offsetof(XMP_DateTime, month) == 4, "XMP_DateTime::month");
+        static_assert(offsetof(XMP_DateTime, day) == 8, "XMP_DateTime::day");
+        static_assert(offsetof(XMP_DateTime, hour) == 12, "XMP_DateTime::hour");
+        static_assert(offsetof(XMP_DateTime, minute) == 16, "XMP_DateTime::minute");
+        static_assert(offsetof(XMP_DateTime, second) == 20, "XMP_DateTime::second");
+        static_assert(offsetof(XMP_DateTime, hasDate) == 24, "XMP_DateTime::hasDate");
+        static_assert(offsetof(XMP_DateTime, hasTime) == 25, "XMP_DateTime::hasTime");
+        static_assert(offsetof(XMP_DateTime, hasTimeZone) == 26, "XMP_DateTime::hasTimeZone");
+        static_assert(offsetof(XMP_DateTime, tzSign) == 27, "XMP_DateTime::tzSign");
+        static_assert(offsetof(XMP_DateTime, tzHour) == 28, "XMP_DateTime::tzHour");
+        static_assert(offsetof(XMP_DateTime, tzMinute) == 32, "XMP_DateTime::tzMinute");
+        static_assert(offsetof(XMP_DateTime, nanoSecond) == 36, "XMP_DateTime::nanoSecond");
+
+        // Rust's bool is one byte that must be 0 or 1.
+        static_assert(sizeof(XMP_Bool) == 1, "XMP_Bool size");
+    #endif
+
+    void CXmpDateTimeCurrent(CXmpDateTime* dt) {
         #ifndef NOOP_FFI
             try {
-                SXMPUtils::CurrentDateTime(&dt->dt);
+                SXMPUtils::CurrentDateTime(dt);
             }
             catch (XMP_Error& e) {
                 fprintf(stderr, "CXMPDateTimeCurrent: ERROR %s\n", e.GetErrMsg());
             }
         #endif
-        return dt;
     }
 
     typedef struct CXmpMeta {
+        XMP_POOLED_WRAPPER(CXmpMeta)
+
         #ifdef NOOP_FFI
             int x;
         #else
@@ -133,6 +418,7 @@ extern "C" {
     } CXmpMeta;
 
     CXmpMeta* CXmpMetaNew() {
+        init_xmp();
         return new CXmpMeta;
     }
 
@@ -151,45 +437,363 @@ extern "C" {
         #endif
     }
 
+    int CXmpFileGetXmpInto(CXmpFile* f, CXmpMeta* m) {
+        // Like CXmpFileGetXmp, but fills a caller-owned CXmpMeta, so one
+        // can be reused across files. It is left unchanged if the file
+        // has no XMP.
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                if (!f->f.GetXMP(NULL)) return 0;
+
+                m->m.Erase();
+                return f->f.GetXMP(&(m->m)) ? 1 : 0;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpFileGetXmpInto: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+        #endif
+    }
+
     void CXmpMetaDrop(CXmpMeta* m) {
         delete m;
     }
 
-    static const char* copyForResult(const std::string& result) {
-        size_t size = result.size();
-        void* cstr = malloc(size + 1);
-        memcpy(cstr, result.c_str(), size + 1);
-        return (const char*) cstr;
+    CXmpMeta* CXmpMetaClone(const CXmpMeta* m) {
+        #ifdef NOOP_FFI
+            return new CXmpMeta;
+        #else
+            CXmpMeta* r = new CXmpMeta;
+
+            // Assigning an SXMPMeta only shares the underlying tree,
+            // so take a deep copy with Clone first.
+            try {
+                r->m = m->m.Clone();
+                return r;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaClone: ERROR %s\n", e.GetErrMsg());
+                delete r;
+                return NULL;
+            }
+        #endif
     }
 
-    const char* CXmpMetaRegisterNamespace(const char* namespaceURI,
-                                          const char* suggestedPrefix) {
+    #ifndef NOOP_FFI
+        // The buffer is handed to the XML parser as is; it is not copied.
+        // ParseFromBuffer takes a 32-bit length, so larger buffers are fed
+        // in pieces. The last piece is parsed with the caller's options, so
+        // the parse is only finished if kXMP_ParseMoreBuffers is absent.
+        static void parseBuffer(SXMPMeta& m,
+                                const char* buffer,
+                                size_t length,
+                                AdobeXMPCommon::uint32 options) {
+            const size_t maxChunk = 0x7FFFFFFF;
+
+            while (length > maxChunk) {
+                m.ParseFromBuffer(buffer, (XMP_StringLen) maxChunk,
+                                  options | kXMP_ParseMoreBuffers);
+                buffer += maxChunk;
+                length -= maxChunk;
+            }
+
+            m.ParseFromBuffer(buffer, (XMP_StringLen) length, options);
+        }
+    #endif
+
+    CXmpMeta* CXmpMetaParseFromBuffer(const char* buffer,
+                                      size_t length,
+                                      AdobeXMPCommon::uint32 options) {
         #ifdef NOOP_FFI
             return NULL;
         #else
             init_xmp();
 
-            std::string registeredPrefix;
+            CXmpMeta* r = new CXmpMeta;
 
-            SXMPMeta::RegisterNamespace(namespaceURI, suggestedPrefix, &registeredPrefix);
+            try {
+                parseBuffer(r->m, buffer, length, options & ~kXMP_ParseMoreBuffers);
+                return r;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "Failed to parse XMP packet: %s\n", e.GetErrMsg());
+                delete r;
+                return NULL;
+            }
+        #endif
+    }
 
-            return copyForResult(registeredPrefix);
+    int CXmpMetaParseChunk(CXmpMeta* m,
+                           const char* buffer,
+                           size_t length,
+                           int isLast) {
+        // Feeds one piece of a packet that arrives incrementally. The
+        // toolkit keeps the partial parse state in `m` between calls.
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                parseBuffer(m->m, buffer, length, isLast ? 0 : kXMP_ParseMoreBuffers);
+                return 1;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "Failed to parse XMP packet: %s\n", e.GetErrMsg());
+                return 0;
+            }
         #endif
     }
 
-    const char* CXmpMetaGetProperty(CXmpMeta* m,
-                                    const char* schemaNS,
-                                    const char* propName) {
+    // Strings are returned to Rust through a callback that copies the
+    // value straight into a Rust-owned buffer (`sink`). Nothing is
+    // allocated for the result on this side of the FFI, so there is
+    // nothing for the caller to free.
+    typedef void (*CXmpStringSink)(void* sink, const char* data, size_t length);
+
+    static void sendResult(CXmpStringSink sinkFn, void* sink, const std::string& result) {
+        sinkFn(sink, result.data(), result.size());
+    }
+
+    int CXmpMetaRegisterNamespace(const char* namespaceURI,
+                                  const char* suggestedPrefix,
+                                  CXmpStringSink sinkFn,
+                                  void* sink) {
         #ifdef NOOP_FFI
-            return NULL;
+            return 0;
+        #else
+            init_xmp();
+
+            try {
+                std::string registeredPrefix;
+
+                SXMPMeta::RegisterNamespace(namespaceURI, suggestedPrefix, &registeredPrefix);
+
+                sendResult(sinkFn, sink, registeredPrefix);
+                return 1;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaRegisterNamespace: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+        #endif
+    }
+
+    int CXmpMetaSerializeToBuffer(const CXmpMeta* m,
+                                  AdobeXMPCommon::uint32 options,
+                                  AdobeXMPCommon::uint32 padding,
+                                  CXmpStringSink sinkFn,
+                                  void* sink) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                std::string packet;
+                m->m.SerializeToBuffer(&packet, options, padding);
+                sendResult(sinkFn, sink, packet);
+                return 1;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "Failed to serialize XMP packet: %s\n", e.GetErrMsg());
+                return 0;
+            }
+        #endif
+    }
+
+    int CXmpMetaGetProperty(CXmpMeta* m,
+                            const char* schemaNS,
+                            const char* propName,
+                            CXmpStringSink sinkFn,
+                            void* sink) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                std::string propValue;
+
+                if (m->m.GetProperty(schemaNS, propName, &propValue, NULL /* options */)) {
+                    sendResult(sinkFn, sink, propValue);
+                    return 1;
+                }
+            }
+            catch (XMP_Error& e) {
+                // An unregistered namespace or a malformed path: report
+                // the property as missing, as CXmpMetaGetProperties does.
+                fprintf(stderr, "CXmpMetaGetProperty: ERROR %s\n", e.GetErrMsg());
+            }
+            return 0;
+        #endif
+    }
+
+    void CXmpMetaGetProperties(CXmpMeta* m,
+                               const char* packedPaths,
+                               size_t count,
+                               int64_t* lengths,
+                               CXmpStringSink sinkFn,
+                               void* sink) {
+        // packedPaths contains `count` pairs of NUL-terminated strings
+        // (schemaNS, propName). The values found are concatenated into
+        // a single buffer that is sent to the sink once; lengths[i]
+        // receives the length of the i'th value, or -1 if the property
+        // doesn't exist (or its path is invalid).
+
+        #ifdef NOOP_FFI
+            for (size_t i = 0; i < count; ++i) lengths[i] = -1;
         #else
+            std::string packedValues;
             std::string propValue;
 
-            if (m->m.GetProperty(schemaNS, propName, &propValue, NULL /* options */)) {
-                return copyForResult(propValue);
-            } else {
-                return NULL;
+            const char* path = packedPaths;
+            for (size_t i = 0; i < count; ++i) {
+                const char* schemaNS = path;
+                const char* propName = schemaNS + strlen(schemaNS) + 1;
+                path = propName + strlen(propName) + 1;
+
+                lengths[i] = -1;
+
+                try {
+                    if (m->m.GetProperty(schemaNS, propName, &propValue, NULL /* options */)) {
+                        packedValues.append(propValue);
+                        lengths[i] = (int64_t) propValue.size();
+                    }
+                }
+                catch (XMP_Error& e) {
+                    fprintf(stderr, "CXmpMetaGetProperties: ERROR %s\n", e.GetErrMsg());
+                }
+            }
+
+            sendResult(sinkFn, sink, packedValues);
+        #endif
+    }
+
+    void CXmpMetaRetainSchemas(CXmpMeta* m,
+                               const char* packedNamespaces,
+                               size_t count) {
+        // packedNamespaces contains `count` NUL-terminated namespace URIs.
+        // Every top-level schema not in that list is removed.
+
+        #ifndef NOOP_FFI
+            try {
+                std::vector<std::string> doomed;
+                std::string schemaNS;
+
+                SXMPIterator iter(m->m, kXMP_IterJustChildren);
+                while (iter.Next(&schemaNS)) {
+                    bool keep = false;
+
+                    const char* ns = packedNamespaces;
+                    for (size_t i = 0; i < count && !keep; ++i) {
+                        keep = (schemaNS == ns);
+                        ns += strlen(ns) + 1;
+                    }
+
+                    if (!keep) doomed.push_back(schemaNS);
+                }
+
+                for (size_t i = 0; i < doomed.size(); ++i) {
+                    SXMPUtils::RemoveProperties(&(m->m), doomed[i].c_str(), NULL,
+                                                kXMPUtil_DoAllProperties);
+                }
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaRetainSchemas: ERROR %s\n", e.GetErrMsg());
+            }
+        #endif
+    }
+
+    #ifndef NOOP_FFI
+        // Days since 1970-01-01 in the proleptic Gregorian calendar.
+        // (H. Hinnant's days_from_civil.)
+        static int64_t daysFromCivil(int64_t y, int64_t m, int64_t d) {
+            y -= (m <= 2) ? 1 : 0;
+            const int64_t era = (y >= 0 ? y : y - 399) / 400;
+            const int64_t yoe = y - era * 400;
+            const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+            const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+            return era * 146097 + doe - 719468;
+        }
+
+        // Microseconds since 1970 fit in an int64_t for about 292,000
+        // years either way; dates outside this range are rejected.
+        static const int32_t kMaxMicrosYear = 290000;
+
+        // Converts a date to microseconds since the Unix epoch, UTC.
+        // Returns false if it is out of range.
+        static bool toUnixMicros(XMP_DateTime dt, int64_t* micros) {
+            // Checked before converting to UTC too, which may move the
+            // year by one.
+            if (dt.year > kMaxMicrosYear || dt.year < -kMaxMicrosYear) return false;
+
+            // Values without a time zone are taken to be UTC.
+            SXMPUtils::ConvertToUTCTime(&dt);
+
+            if (dt.year > kMaxMicrosYear || dt.year < -kMaxMicrosYear) return false;
+            if (dt.month < 0 || dt.month > 12 || dt.day < 0 || dt.day > 31) return false;
+            if (dt.hour < 0 || dt.hour > 23 || dt.minute < 0 || dt.minute > 59) return false;
+            if (dt.second < 0 || dt.second > 60) return false;
+            if (dt.nanoSecond < 0 || dt.nanoSecond > 999999999) return false;
+
+            int64_t month = (dt.month > 0) ? dt.month : 1;
+            int64_t day = (dt.day > 0) ? dt.day : 1;
+            int64_t seconds = daysFromCivil(dt.year, month, day) * 86400 +
+                              dt.hour * 3600 + dt.minute * 60 + dt.second;
+
+            *micros = seconds * 1000000 + dt.nanoSecond / 1000;
+            return true;
+        }
+    #endif
+
+    void CXmpMetaGetColumnValues(CXmpMeta* m,
+                                 const char* packedPaths,
+                                 size_t count,
+                                 const uint8_t* kinds,
+                                 uint8_t* found,
+                                 int64_t* values,
+                                 CXmpStringSink sinkFn,
+                                 void* sink) {
+        // Like CXmpMetaGetProperties, but typed for columnar output.
+        // For each of the `count` paths, found[i] is set to 1 if the
+        // property exists (and, for dates, can be converted). If kinds[i]
+        // is 0 (string), values[i] receives the length of the value,
+        // which is appended to the buffer sent to the sink; if kinds[i]
+        // is 1 (timestamp), values[i] receives the date as microseconds
+        // since the Unix epoch, UTC. Dates too far from 1970 for that
+        // are reported as not found, like unparseable ones.
+
+        #ifdef NOOP_FFI
+            for (size_t i = 0; i < count; ++i) found[i] = 0;
+        #else
+            std::string packedValues;
+            std::string propValue;
+            XMP_DateTime dateValue;
+
+            const char* path = packedPaths;
+            for (size_t i = 0; i < count; ++i) {
+                const char* schemaNS = path;
+                const char* propName = schemaNS + strlen(schemaNS) + 1;
+                path = propName + strlen(propName) + 1;
+
+                found[i] = 0;
+                values[i] = 0;
+
+                try {
+                    if (kinds[i] == 1) {
+                        if (m->m.GetProperty_Date(schemaNS, propName, &dateValue, NULL) &&
+                            toUnixMicros(dateValue, &values[i])) {
+                            found[i] = 1;
+                        }
+                    } else if (m->m.GetProperty(schemaNS, propName, &propValue, NULL)) {
+                        packedValues.append(propValue);
+                        values[i] = (int64_t) propValue.size();
+                        found[i] = 1;
+                    }
+                }
+                catch (XMP_Error& e) {
+                    // Missing or malformed values are reported as nulls.
+                }
             }
+
+            sendResult(sinkFn, sink, packedValues);
         #endif
     }
 
@@ -201,7 +805,12 @@ extern "C" {
             // TO DO: Bridge options parameter.
             // For my purposes at the moment,
             // default value (0) always suffices.
-            m->m.SetProperty(schemaNS, propName, propValue);
+            try {
+                m->m.SetProperty(schemaNS, propName, propValue);
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaSetProperty: ERROR %s\n", e.GetErrMsg());
+            }
         #endif
     }
 
@@ -213,42 +822,807 @@ extern "C" {
             // TO DO: Bridge options parameter.
             // For my purposes at the moment,
             // default value (0) always suffices.
-            m->m.SetProperty_Date(schemaNS, propName, propValue->dt);
+            try {
+                m->m.SetProperty_Date(schemaNS, propName, *propValue);
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaSetPropertyDate: ERROR %s\n", e.GetErrMsg());
+            }
         #endif
     }
 
-    int CXmpMetaDoesPropertyExist(CXmpMeta* m,
-                                  const char* schemaNS,
-                                  const char* propName) {
-        #ifdef NOOP_FFI
-            return 0;
-        #else
-            return (m->m.DoesPropertyExist(schemaNS, propName)) ? 1 : 0;
-        #endif
-    }
+    // Edit kinds for CXmpMetaApplyEdits; must match xmp_edit.rs.
+    enum {
+        kEditSet = 0,
+        kEditSetDate = 1,
+        kEditDelete = 2,
+        kEditAppend = 3,
+        kEditSkip = 4
+    };
+
+    int CXmpMetaApplyEdits(CXmpMeta* m,
+                           size_t count,
+                           const uint8_t* kinds,
+                           const uint32_t* options,
+                           const char* packed,
+                           const CXmpDateTime* dates,
+                           int32_t* results,
+                           CXmpStringSink sinkFn,
+                           void* sink) {
+        // packed contains `count` triples of NUL-terminated strings
+        // (schemaNS, propName, value); the value is empty for deletes and
+        // dates. dates holds one entry per kEditSetDate edit, in order.
+        //
+        // Every path is validated before any edit is made. An edit whose
+        // path is invalid, or which fails when applied, does not stop the
+        // others: results[i] receives 0 on success or the XMP error code,
+        // and the messages for all failed edits (NUL-terminated, in order)
+        // are sent to the sink once. Edits that were marked kEditSkip by
+        // the caller are left alone. Returns the number of failed edits.
 
-    int CXmpFileCanPutXmp(const CXmpFile* f,
-                          const CXmpMeta* m) {
         #ifdef NOOP_FFI
+            for (size_t i = 0; i < count; ++i) results[i] = 0;
             return 0;
         #else
-            return const_cast<SXMPFiles&>(f->f).CanPutXMP(m->m) ? 1 : 0;
-        #endif
-    }
+            std::vector<const char*> schemaNS(count);
+            std::vector<const char*> propName(count);
+            std::vector<const char*> propValue(count);
+            std::vector<std::string> errors(count);
+            int failures = 0;
+
+            const char* field = packed;
+            for (size_t i = 0; i < count; ++i) {
+                schemaNS[i] = field;
+                propName[i] = schemaNS[i] + strlen(schemaNS[i]) + 1;
+                propValue[i] = propName[i] + strlen(propName[i]) + 1;
+                field = propValue[i] + strlen(propValue[i]) + 1;
+
+                results[i] = 0;
+                if (kinds[i] == kEditSkip) continue;
+
+                try {
+                    m->m.DoesPropertyExist(schemaNS[i], propName[i]);
+                }
+                catch (XMP_Error& e) {
+                    results[i] = e.GetID();
+                    errors[i] = e.GetErrMsg();
+                    ++failures;
+                }
+            }
+
+            const CXmpDateTime* date = dates;
+            for (size_t i = 0; i < count; ++i) {
+                const CXmpDateTime* dt = NULL;
+                if (kinds[i] == kEditSetDate) dt = date++;
+
+                if (kinds[i] == kEditSkip || results[i] != 0) continue;
+
+                try {
+                    switch (kinds[i]) {
+                        case kEditSet:
+                            m->m.SetProperty(schemaNS[i], propName[i], propValue[i], options[i]);
+                            break;
+                        case kEditSetDate:
+                            m->m.SetProperty_Date(schemaNS[i], propName[i], *dt, options[i]);
+                            break;
+                        case kEditDelete:
+                            m->m.DeleteProperty(schemaNS[i], propName[i]);
+                            break;
+                        case kEditAppend:
+                            m->m.AppendArrayItem(schemaNS[i], propName[i], options[i], propValue[i]);
+                            break;
+                    }
+                }
+                catch (XMP_Error& e) {
+                    results[i] = e.GetID();
+                    errors[i] = e.GetErrMsg();
+                    ++failures;
+                }
+            }
+
+            std::string messages;
+            for (size_t i = 0; i < count; ++i) {
+                if (results[i] != 0) {
+                    messages.append(errors[i]);
+                    messages.push_back('\0');
+                }
+            }
+
+            sendResult(sinkFn, sink, messages);
+            return failures;
+        #endif
+    }
+
+    // The typed getters return 1 and store the value if the property
+    // exists and can be converted to the requested type, or 0 otherwise.
+    // No string is created for the result.
+
+    int CXmpMetaGetPropertyInt64(CXmpMeta* m,
+                                 const char* schemaNS,
+                                 const char* propName,
+                                 int64_t* propValue) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                XMP_Int64 value;
+                if (m->m.GetProperty_Int64(schemaNS, propName, &value, NULL /* options */)) {
+                    *propValue = value;
+                    return 1;
+                }
+            }
+            catch (XMP_Error& e) {
+                // Not a number.
+            }
+            return 0;
+        #endif
+    }
+
+    int CXmpMetaGetPropertyFloat(CXmpMeta* m,
+                                 const char* schemaNS,
+                                 const char* propName,
+                                 double* propValue) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                if (m->m.GetProperty_Float(schemaNS, propName, propValue, NULL /* options */)) {
+                    return 1;
+                }
+            }
+            catch (XMP_Error& e) {
+                // Not a number.
+            }
+            return 0;
+        #endif
+    }
+
+    int CXmpMetaGetPropertyBool(CXmpMeta* m,
+                                const char* schemaNS,
+                                const char* propName,
+                                int* propValue) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                bool value;
+                if (m->m.GetProperty_Bool(schemaNS, propName, &value, NULL /* options */)) {
+                    *propValue = value ? 1 : 0;
+                    return 1;
+                }
+            }
+            catch (XMP_Error& e) {
+                // Not a Boolean.
+            }
+            return 0;
+        #endif
+    }
+
+    int CXmpMetaGetPropertyDate(CXmpMeta* m,
+                                const char* schemaNS,
+                                const char* propName,
+                                CXmpDateTime* propValue) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                if (m->m.GetProperty_Date(schemaNS, propName, propValue, NULL /* options */)) {
+                    return 1;
+                }
+            }
+            catch (XMP_Error& e) {
+                // Not a date.
+            }
+            return 0;
+        #endif
+    }
+
+    int CXmpMetaDoesPropertyExist(CXmpMeta* m,
+                                  const char* schemaNS,
+                                  const char* propName) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                return (m->m.DoesPropertyExist(schemaNS, propName)) ? 1 : 0;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaDoesPropertyExist: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+        #endif
+    }
+
+    typedef struct CXmpPath {
+        #ifdef NOOP_FFI
+            int x;
+        #else
+            std::string schemaNS;
+            std::string propName;
+        #endif
+    } CXmpPath;
+
+    CXmpPath* CXmpPathNew(const char* schemaNS,
+                          const char* propName) {
+        #ifdef NOOP_FFI
+            return new CXmpPath;
+        #else
+            init_xmp();
+
+            // Validate the namespace and path expression once, up front,
+            // so that lookups through this handle can't fail on them later.
+            try {
+                SXMPMeta empty;
+                empty.DoesPropertyExist(schemaNS, propName);
+            }
+            catch (XMP_Error& e) {
+                return NULL;
+            }
+
+            CXmpPath* p = new CXmpPath;
+            p->schemaNS = schemaNS;
+            p->propName = propName;
+            return p;
+        #endif
+    }
+
+    void CXmpPathDrop(CXmpPath* p) {
+        delete p;
+    }
+
+    int CXmpMetaGetPropertyAt(CXmpMeta* m,
+                              const CXmpPath* p,
+                              CXmpStringSink sinkFn,
+                              void* sink) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            std::string propValue;
+
+            if (m->m.GetProperty(p->schemaNS.c_str(), p->propName.c_str(), &propValue, NULL /* options */)) {
+                sendResult(sinkFn, sink, propValue);
+                return 1;
+            } else {
+                return 0;
+            }
+        #endif
+    }
+
+    void CXmpMetaSetPropertyAt(CXmpMeta* m,
+                               const CXmpPath* p,
+                               const char* propValue) {
+        #ifndef NOOP_FFI
+            try {
+                m->m.SetProperty(p->schemaNS.c_str(), p->propName.c_str(), propValue);
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaSetPropertyAt: ERROR %s\n", e.GetErrMsg());
+            }
+        #endif
+    }
+
+    int CXmpMetaDoesPropertyExistAt(CXmpMeta* m,
+                                    const CXmpPath* p) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            return (m->m.DoesPropertyExist(p->schemaNS.c_str(), p->propName.c_str())) ? 1 : 0;
+        #endif
+    }
+
+    typedef struct CXmpIterator {
+        #ifdef NOOP_FFI
+            int x;
+        #else
+            SXMPIterator i;
+
+            CXmpIterator(const SXMPMeta& m,
+                         const char* schemaNS,
+                         const char* propName,
+                         XMP_OptionBits options)
+                : i(m, schemaNS, propName, options) {
+            }
+        #endif
+    } CXmpIterator;
+
+    CXmpIterator* CXmpIteratorNew(const CXmpMeta* m,
+                                  const char* schemaNS,
+                                  const char* propName,
+                                  AdobeXMPCommon::uint32 options) {
+        #ifdef NOOP_FFI
+            return NULL;
+        #else
+            try {
+                return new CXmpIterator(m->m, schemaNS, propName, options);
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpIteratorNew: ERROR %s\n", e.GetErrMsg());
+                return NULL;
+            }
+        #endif
+    }
+
+    void CXmpIteratorDrop(CXmpIterator* i) {
+        delete i;
+    }
+
+    size_t CXmpIteratorNextPage(CXmpIterator* i,
+                                size_t maxItems,
+                                AdobeXMPCommon::uint32* options,
+                                CXmpStringSink sinkFn,
+                                void* sink) {
+        // Advances the iterator by up to `maxItems` nodes. The nodes are
+        // sent to the sink as one buffer of NUL-terminated strings,
+        // (schemaNS, propPath, propValue) per node; options[n] receives
+        // the n'th node's option bits. Returns the number of nodes, which
+        // is less than `maxItems` only once the iteration is complete.
+
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            std::string packed;
+            std::string schemaNS;
+            std::string propPath;
+            std::string propValue;
+            XMP_OptionBits propOptions;
+
+            size_t n = 0;
+
+            try {
+                while (n < maxItems && i->i.Next(&schemaNS, &propPath, &propValue, &propOptions)) {
+                    packed.append(schemaNS).push_back('\0');
+                    packed.append(propPath).push_back('\0');
+                    packed.append(propValue).push_back('\0');
+                    options[n++] = propOptions;
+                }
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpIteratorNextPage: ERROR %s\n", e.GetErrMsg());
+            }
+
+            sendResult(sinkFn, sink, packed);
+            return n;
+        #endif
+    }
+
+    #ifndef NOOP_FFI
+        static void appendU32(std::string& out, uint32_t v) {
+            // Snapshots are always little-endian, whatever the host.
+            out.push_back((char) (v & 0xFF));
+            out.push_back((char) ((v >> 8) & 0xFF));
+            out.push_back((char) ((v >> 16) & 0xFF));
+            out.push_back((char) ((v >> 24) & 0xFF));
+        }
+
+        static bool isChildPath(const std::string& parent, const std::string& path) {
+            return path.size() > parent.size() &&
+                   path.compare(0, parent.size(), parent) == 0 &&
+                   (path[parent.size()] == '/' || path[parent.size()] == '[');
+        }
+    #endif
+
+    void CXmpMetaSnapshot(const CXmpMeta* m,
+                          CXmpStringSink sinkFn,
+                          void* sink) {
+        // Flattens the tree in one pass of a full (pre-order) iteration.
+        // The layout is described in xmp_snapshot.rs: a 16-byte header,
+        // then 10 little-endian uint32 fields per node, then the string
+        // arena. Each node's parent is found by keeping the chain of its
+        // ancestors on a stack; a node is a child of the deepest ancestor
+        // whose path is a prefix of its own at a component boundary.
+
+        #ifndef NOOP_FFI
+            const uint32_t none = 0xFFFFFFFF;
+            enum { kParent, kFirstChild, kNextSibling, kFlags,
+                   kNsOffset, kNsLength, kPathOffset, kPathLength,
+                   kValueOffset, kValueLength, kFieldCount };
+
+            std::vector<uint32_t> nodes;
+            std::vector<uint32_t> lastChild;
+            std::vector<uint32_t> stack;
+            std::vector<std::string> stackPaths;
+            std::string arena;
+
+            std::string schemaNS;
+            std::string propPath;
+            std::string propValue;
+            XMP_OptionBits propOptions;
+
+            uint32_t lastRoot = none;
+            uint32_t nsOffset = 0;
+            uint32_t nsLength = 0;
+
+            try {
+                SXMPIterator iter(m->m);
+                while (iter.Next(&schemaNS, &propPath, &propValue, &propOptions)) {
+                    uint32_t index = (uint32_t) lastChild.size();
+                    uint32_t parent = none;
+
+                    if (propOptions & kXMP_SchemaNode) {
+                        stack.clear();
+                        stackPaths.clear();
+
+                        nsOffset = (uint32_t) arena.size();
+                        nsLength = (uint32_t) schemaNS.size();
+                        arena.append(schemaNS);
+
+                        if (lastRoot != none) nodes[lastRoot * kFieldCount + kNextSibling] = index;
+                        lastRoot = index;
+                    } else {
+                        // The schema node always stays at the bottom of the stack.
+                        while (stack.size() > 1 && !isChildPath(stackPaths.back(), propPath)) {
+                            stack.pop_back();
+                            stackPaths.pop_back();
+                        }
+
+                        if (!stack.empty()) {
+                            parent = stack.back();
+                            uint32_t sibling = lastChild[parent];
+                            if (sibling == none) {
+                                nodes[parent * kFieldCount + kFirstChild] = index;
+                            } else {
+                                nodes[sibling * kFieldCount + kNextSibling] = index;
+                            }
+                            lastChild[parent] = index;
+                        }
+                    }
+
+                    nodes.push_back(parent);
+                    nodes.push_back(none);
+                    nodes.push_back(none);
+                    nodes.push_back(propOptions);
+                    nodes.push_back(nsOffset);
+                    nodes.push_back(nsLength);
+                    nodes.push_back((uint32_t) arena.size());
+                    nodes.push_back((uint32_t) propPath.size());
+                    arena.append(propPath);
+                    nodes.push_back((uint32_t) arena.size());
+                    nodes.push_back((uint32_t) propValue.size());
+                    arena.append(propValue);
+
+                    lastChild.push_back(none);
+                    stack.push_back(index);
+                    stackPaths.push_back(propPath);
+                }
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaSnapshot: ERROR %s\n", e.GetErrMsg());
+                nodes.clear();
+                arena.clear();
+            }
+
+            std::string snapshot;
+            snapshot.reserve(16 + nodes.size() * 4 + arena.size());
+            snapshot.append("XMPS", 4);
+            appendU32(snapshot, 1);
+            appendU32(snapshot, (uint32_t) (nodes.size() / kFieldCount));
+            appendU32(snapshot, (uint32_t) arena.size());
+            for (size_t i = 0; i < nodes.size(); ++i) appendU32(snapshot, nodes[i]);
+            snapshot.append(arena);
+
+            sendResult(sinkFn, sink, snapshot);
+        #endif
+    }
+
+    #ifndef NOOP_FFI
+        // Option bits that describe a node's form; a change in any of
+        // these counts as a change of the node even if its value is the same.
+        static const XMP_OptionBits kDiffFormMask =
+            kXMP_PropValueIsURI | kXMP_PropValueIsStruct | kXMP_PropValueIsArray |
+            kXMP_PropArrayIsOrdered | kXMP_PropArrayIsAlternate | kXMP_PropArrayIsAltText;
+
+        struct DiffNode {
+            std::string schemaNS;
+            std::string propPath;
+            std::string propValue;
+            XMP_OptionBits propOptions;
+            bool matched;
+        };
+
+        static void appendDiffNode(std::string& out, const DiffNode* node) {
+            if (node) {
+                out.append(node->propValue).push_back('\0');
+                out.append(std::to_string(node->propOptions)).push_back('\0');
+            } else {
+                out.append(2, '\0');
+            }
+        }
+
+        static void appendChange(std::string& out,
+                                 char kind,
+                                 const DiffNode& key,
+                                 const DiffNode* oldNode,
+                                 const DiffNode* newNode) {
+            out.push_back(kind);
+            out.push_back('\0');
+            out.append(key.schemaNS).push_back('\0');
+            out.append(key.propPath).push_back('\0');
+            appendDiffNode(out, oldNode);
+            appendDiffNode(out, newNode);
+        }
+    #endif
+
+    int CXmpMetaDiff(const CXmpMeta* a,
+                     const CXmpMeta* b,
+                     CXmpStringSink sinkFn,
+                     void* sink,
+                     size_t* changeCount) {
+        // Compares two trees in one full iteration of each: the nodes of `a`
+        // are indexed by (schemaNS, propPath), then those of `b` are looked
+        // up as they are visited. Each change is sent to the sink as seven
+        // NUL-terminated strings: kind ('a'dded, 'r'emoved, or 'c'hanged),
+        // schemaNS, propPath, then the old value and options and the new
+        // value and options (empty where there is no such node). When a
+        // struct or array is added or removed, only its root is reported.
+        // *changeCount receives the number of changes.
+        //
+        // Returns 1 on success. If the toolkit reports an error part way
+        // through, returns 0 and sends nothing, rather than a partial list.
+
+        *changeCount = 0;
+
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            std::vector<DiffNode> oldNodes;
+            std::unordered_map<std::string, size_t> oldIndex;
+            std::string packed;
+            size_t count = 0;
+
+            DiffNode node;
+            node.matched = false;
+
+            try {
+                SXMPIterator oldIter(a->m);
+                while (oldIter.Next(&node.schemaNS, &node.propPath, &node.propValue, &node.propOptions)) {
+                    if (node.propOptions & kXMP_SchemaNode) continue;
+                    oldIndex[node.schemaNS + '\0' + node.propPath] = oldNodes.size();
+                    oldNodes.push_back(node);
+                }
+
+                std::string addedRoot;
+                SXMPIterator newIter(b->m);
+                while (newIter.Next(&node.schemaNS, &node.propPath, &node.propValue, &node.propOptions)) {
+                    if (node.propOptions & kXMP_SchemaNode) continue;
+
+                    std::unordered_map<std::string, size_t>::iterator found =
+                        oldIndex.find(node.schemaNS + '\0' + node.propPath);
+
+                    if (found == oldIndex.end()) {
+                        if (!addedRoot.empty() && isChildPath(addedRoot, node.propPath)) continue;
+                        addedRoot = node.propPath;
+                        appendChange(packed, 'a', node, NULL, &node);
+                        ++count;
+                        continue;
+                    }
+
+                    DiffNode& oldNode = oldNodes[found->second];
+                    oldNode.matched = true;
+
+                    if (oldNode.propValue != node.propValue ||
+                        (oldNode.propOptions & kDiffFormMask) != (node.propOptions & kDiffFormMask)) {
+                        appendChange(packed, 'c', node, &oldNode, &node);
+                        ++count;
+                    }
+                }
+
+                std::string removedRoot;
+                for (size_t i = 0; i < oldNodes.size(); ++i) {
+                    const DiffNode& oldNode = oldNodes[i];
+                    if (oldNode.matched) continue;
+                    if (!removedRoot.empty() && isChildPath(removedRoot, oldNode.propPath)) continue;
+                    removedRoot = oldNode.propPath;
+                    appendChange(packed, 'r', oldNode, &oldNode, NULL);
+                    ++count;
+                }
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaDiff: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+
+            sendResult(sinkFn, sink, packed);
+            *changeCount = count;
+            return 1;
+        #endif
+    }
+
+    int CXmpMetaMerge(CXmpMeta* m,
+                      const CXmpMeta* other,
+                      AdobeXMPCommon::uint32 options) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            try {
+                SXMPUtils::ApplyTemplate(&(m->m), other->m, options);
+                return 1;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpMetaMerge: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+        #endif
+    }
+
+    int CXmpFileCanPutXmp(const CXmpFile* f,
+                          const CXmpMeta* m) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            return const_cast<SXMPFiles&>(f->f).CanPutXMP(m->m) ? 1 : 0;
+        #endif
+    }
 
     void CXmpFilePutXmp(CXmpFile* f,
                         const CXmpMeta* m) {
         #ifndef NOOP_FFI
             f->f.PutXMP(m->m);
+            f->xmpPut = true;
+            f->inPlaceLength = -1;
+        #endif
+    }
+
+    #ifndef NOOP_FFI
+        // Reports whether `m` can replace the packet already in the file
+        // without moving any other data: the file must be open for update,
+        // the location of its packet known, `m` must serialize to exactly
+        // that packet's size, and the handler must be one that overwrites
+        // the old packet when the new one fits. Handlers that can expand
+        // the XMP but don't prefer in-place updates may rewrite the file
+        // even then, so they are refused.
+        static bool canUpdateInPlace(const CXmpFile* f, const CXmpMeta* m) {
+            try {
+                SXMPFiles& files = const_cast<SXMPFiles&>(f->f);
+
+                // The handler flags don't say whether a handler rewrites
+                // the file when the new packet fits: kXMPFiles_CanExpand
+                // and kXMPFiles_PrefersInPlace only describe what it can
+                // do when the packet doesn't. Each handler decides in its
+                // UpdateFile, so only the fit itself is checked here.
+                XMP_OptionBits openFlags = 0;
+                if (!files.GetFileInfo(NULL, &openFlags, NULL, NULL)) return false;
+                if ((openFlags & kXMPFiles_OpenForUpdate) == 0) return false;
+
+                XMP_PacketInfo info;
+                if (!files.GetXMP(NULL, NULL, &info)) return false;
+                if (info.offset == kXMPFiles_UnknownOffset || info.length <= 0) return false;
+
+                // The XMP_PacketInfo character forms use the same values
+                // as the kXMP_EncodeUTF* serialization options.
+                XMP_OptionBits options = kXMP_ExactPacketLength | kXMP_UseCompactFormat |
+                                         (XMP_OptionBits) info.charForm;
+                if (!info.writeable) options |= kXMP_ReadOnlyPacket;
+
+                std::string packet;
+                m->m.SerializeToBuffer(&packet, options, (XMP_StringLen) info.length);
+                return true;
+            }
+            catch (XMP_Error& e) {
+                // Doesn't fit.
+                return false;
+            }
+        }
+    #endif
+
+    int CXmpFileCanUpdateInPlace(const CXmpFile* f,
+                                 const CXmpMeta* m) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            return canUpdateInPlace(f, m) ? 1 : 0;
+        #endif
+    }
+
+    int CXmpFilePutXmpInPlace(CXmpFile* f,
+                              const CXmpMeta* m) {
+        #ifdef NOOP_FFI
+            return 0;
+        #else
+            if (!canUpdateInPlace(f, m)) return 0;
+
+            try {
+                XMP_PacketInfo info;
+                f->f.GetXMP(NULL, NULL, &info);
+
+                f->f.PutXMP(m->m);
+                f->xmpPut = true;
+                f->inPlaceLength = (XMP_Int64) info.length;
+                return 1;
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpFilePutXmpInPlace: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+        #endif
+    }
+
+    // Write strategies reported by CXmpFileCloseWith; must match
+    // CloseStrategy in xmp_file.rs.
+    enum {
+        kCloseNoUpdate = 0,
+        kCloseDirect = 1,
+        kCloseSafe = 2
+    };
+
+    int CXmpFileCloseWith(CXmpFile* f,
+                          AdobeXMPCommon::uint32 closeFlags,
+                          AdobeXMPCommon::uint32* strategy,
+                          int64_t* bytesWritten,
+                          int64_t* estimatedBytesWritten) {
+        // Closes the file with the given kXMPFiles_Close* flags. *strategy
+        // receives the kind of update that was requested; the handler
+        // decides how it is actually done. *bytesWritten receives the
+        // number of bytes written as counted by MemoryIO, or -1 for disk
+        // files, whose I/O isn't observed. *estimatedBytesWritten receives,
+        // for disk files, the size of the new file for a safe update, the
+        // packet size for an in-place update, and -1 otherwise; it is -1
+        // for in-memory files.
+        //
+        // Returns 1 on success and 0 if the update fails. Returns -1, and
+        // leaves the file open and unwritten, if the pending XMP came from
+        // CXmpFilePutXmpInPlace but the flags ask for a safe update, which
+        // would copy the whole file.
+
+        *strategy = kCloseNoUpdate;
+        *bytesWritten = -1;
+        *estimatedBytesWritten = -1;
+
+        #ifdef NOOP_FFI
+            return 1;
+        #else
+            std::string filePath;
+            XMP_OptionBits openFlags = 0;
+            bool isOpen = f->f.GetFileInfo(&filePath, &openFlags, NULL, NULL);
+            bool updating = isOpen && f->xmpPut && (openFlags & kXMPFiles_OpenForUpdate) != 0;
+
+            bool safe = (closeFlags & kXMPFiles_UpdateSafely) != 0;
+            if (updating && safe && f->inPlaceLength >= 0) return -1;
+
+            XMP_Int64 ioWrittenBefore = f->io ? f->io->BytesWritten() : 0;
+            XMP_Int64 inPlaceLength = f->inPlaceLength;
+
+            f->xmpPut = false;
+            f->inPlaceLength = -1;
+
+            try {
+                f->f.CloseFile(closeFlags);
+            }
+            catch (XMP_Error& e) {
+                fprintf(stderr, "CXmpFileCloseWith: ERROR %s\n", e.GetErrMsg());
+                return 0;
+            }
+
+            if (f->io) {
+                *bytesWritten = f->io->BytesWritten() - ioWrittenBefore;
+            }
+
+            if (!updating) {
+                if (!f->io) *estimatedBytesWritten = 0;
+                return 1;
+            }
+
+            *strategy = safe ? kCloseSafe : kCloseDirect;
+
+            if (!f->io) {
+                if (safe) {
+                    std::ifstream file(filePath.c_str(), std::ios::binary | std::ios::ate);
+                    if (file) *estimatedBytesWritten = (int64_t) file.tellg();
+                } else {
+                    *estimatedBytesWritten = inPlaceLength;
+                }
+            }
+
+            return 1;
         #endif
     }
 
     void CXmpFileClose(CXmpFile* f) {
         #ifndef NOOP_FFI
-            // TO DO: Bridge closeFlags parameter.
-            // For my purposes at the moment,
-            // default value (0) always suffices.
-            f->f.CloseFile();
+            AdobeXMPCommon::uint32 strategy;
+            int64_t bytesWritten;
+            int64_t estimatedBytesWritten;
+            CXmpFileCloseWith(f, 0, &strategy, &bytesWritten, &estimatedBytesWritten);
         #endif
     }
+
 }
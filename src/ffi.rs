@@ -11,38 +11,175 @@
 // specific language governing permissions and limitations under
 // each license.
 
-use std::os::raw::{c_char, c_int};
+use std::os::raw::{c_char, c_int, c_void};
+use std::slice;
+
+use crate::xmp_date_time::XmpDateTime;
 
-pub enum CXmpDateTime {}
 pub enum CXmpFile {}
+pub enum CXmpIterator {}
 pub enum CXmpMeta {}
+pub enum CXmpPath {}
+
+// Strings are returned from C++ by calling a sink function, which copies
+// the value directly into a Rust-owned buffer. The C++ side allocates
+// nothing for the result, so there's nothing to free afterwards.
+pub type CXmpStringSink = extern "C" fn(sink: *mut c_void, data: *const c_char, length: usize);
+
+// Progress is reported from C++ through a function of this type;
+// it returns nonzero to continue or zero to abort.
+pub type CXmpProgressFn = extern "C" fn(
+    context: *mut c_void,
+    elapsed_time: f32,
+    fraction_done: f32,
+    seconds_to_go: f32,
+) -> c_int;
+
+// Sink that replaces the contents of the `String` that `sink` points to.
+// Reuses that `String`'s allocation when it is large enough.
+pub extern "C" fn string_sink(sink: *mut c_void, data: *const c_char, length: usize) {
+    unsafe {
+        let s = &mut *(sink as *mut String);
+        let bytes = slice::from_raw_parts(data as *const u8, length);
+
+        s.clear();
+        s.push_str(&String::from_utf8_lossy(bytes));
+    }
+}
+
+// Sink that replaces the contents of the `Vec<u8>` that `sink` points to.
+pub extern "C" fn bytes_sink(sink: *mut c_void, data: *const c_char, length: usize) {
+    unsafe {
+        let v = &mut *(sink as *mut Vec<u8>);
+        let bytes = slice::from_raw_parts(data as *const u8, length);
+
+        v.clear();
+        v.extend_from_slice(bytes);
+    }
+}
 
 extern "C" {
     // --- CXmpFile
 
     pub fn CXmpFileNew() -> *mut CXmpFile;
     pub fn CXmpFileDrop(file: *mut CXmpFile);
-    pub fn CXmpFileOpen(file: *mut CXmpFile, path: *const c_char, flags: u32) -> c_int;
+    pub fn CXmpFileOpen(file: *mut CXmpFile, path: *const c_char, format: u32, flags: u32)
+        -> c_int;
+
+    pub fn CXmpFileOpenFromBytes(
+        file: *mut CXmpFile,
+        data: *const c_char,
+        length: usize,
+        format: u32,
+        flags: u32,
+    ) -> c_int;
+
+    pub fn CXmpFileOpenMapped(
+        file: *mut CXmpFile,
+        path: *const c_char,
+        format: u32,
+        flags: u32,
+    ) -> c_int;
+
+    pub fn CXmpFileCheckFileFormat(path: *const c_char) -> u32;
+
+    pub fn CXmpFileGetBytes(file: *const CXmpFile, length: *mut usize) -> *const c_char;
+    pub fn CXmpFileTakeIoCounts(
+        file: *mut CXmpFile,
+        bytes_read: *mut i64,
+        read_calls: *mut i64,
+        bytes_written: *mut i64,
+        write_calls: *mut i64,
+    );
     pub fn CXmpFileGetXmp(file: *mut CXmpFile) -> *mut CXmpMeta;
+    pub fn CXmpFileGetXmpInto(file: *mut CXmpFile, meta: *mut CXmpMeta) -> c_int;
     pub fn CXmpFileCanPutXmp(file: *const CXmpFile, meta: *const CXmpMeta) -> c_int;
     pub fn CXmpFilePutXmp(file: *mut CXmpFile, meta: *const CXmpMeta);
+    pub fn CXmpFileCanUpdateInPlace(file: *const CXmpFile, meta: *const CXmpMeta) -> c_int;
+    pub fn CXmpFilePutXmpInPlace(file: *mut CXmpFile, meta: *const CXmpMeta) -> c_int;
     pub fn CXmpFileClose(file: *mut CXmpFile);
+    pub fn CXmpFileSetProgressCallback(
+        file: *mut CXmpFile,
+        progress_fn: Option<CXmpProgressFn>,
+        context: *mut c_void,
+        interval: f32,
+        send_start_stop: c_int,
+    );
+    pub fn CXmpFileCloseWith(
+        file: *mut CXmpFile,
+        close_flags: u32,
+        strategy: *mut u32,
+        bytes_written: *mut i64,
+        estimated_bytes_written: *mut i64,
+    ) -> c_int;
 
     // --- CXmpMeta
 
     pub fn CXmpMetaNew() -> *mut CXmpMeta;
     pub fn CXmpMetaDrop(meta: *mut CXmpMeta);
+    pub fn CXmpMetaClone(meta: *const CXmpMeta) -> *mut CXmpMeta;
+
+    pub fn CXmpMetaParseFromBuffer(
+        buffer: *const c_char,
+        length: usize,
+        options: u32,
+    ) -> *mut CXmpMeta;
+
+    pub fn CXmpMetaParseChunk(
+        meta: *mut CXmpMeta,
+        buffer: *const c_char,
+        length: usize,
+        is_last: c_int,
+    ) -> c_int;
+
+    pub fn CXmpMetaSerializeToBuffer(
+        meta: *const CXmpMeta,
+        options: u32,
+        padding: u32,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    ) -> c_int;
 
     pub fn CXmpMetaRegisterNamespace(
         namespace_uri: *const c_char,
         suggested_prefix: *const c_char,
-    ) -> *mut c_char;
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    ) -> c_int;
 
     pub fn CXmpMetaGetProperty(
         meta: *mut CXmpMeta,
         schema_ns: *const c_char,
         prop_name: *const c_char,
-    ) -> *mut c_char;
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    ) -> c_int;
+
+    pub fn CXmpMetaGetProperties(
+        meta: *mut CXmpMeta,
+        packed_paths: *const c_char,
+        count: usize,
+        lengths: *mut i64,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    );
+
+    pub fn CXmpMetaGetColumnValues(
+        meta: *mut CXmpMeta,
+        packed_paths: *const c_char,
+        count: usize,
+        kinds: *const u8,
+        found: *mut u8,
+        values: *mut i64,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    );
+
+    pub fn CXmpMetaRetainSchemas(
+        meta: *mut CXmpMeta,
+        packed_namespaces: *const c_char,
+        count: usize,
+    );
 
     pub fn CXmpMetaSetProperty(
         meta: *mut CXmpMeta,
@@ -55,18 +192,107 @@ extern "C" {
         meta: *mut CXmpMeta,
         schema_ns: *const c_char,
         prop_name: *const c_char,
-        prop_value: *const CXmpDateTime,
+        prop_value: *const XmpDateTime,
     );
 
+    pub fn CXmpMetaApplyEdits(
+        meta: *mut CXmpMeta,
+        count: usize,
+        kinds: *const u8,
+        options: *const u32,
+        packed: *const c_char,
+        dates: *const XmpDateTime,
+        results: *mut i32,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    ) -> c_int;
+
+    pub fn CXmpMetaGetPropertyInt64(
+        meta: *mut CXmpMeta,
+        schema_ns: *const c_char,
+        prop_name: *const c_char,
+        prop_value: *mut i64,
+    ) -> c_int;
+
+    pub fn CXmpMetaGetPropertyFloat(
+        meta: *mut CXmpMeta,
+        schema_ns: *const c_char,
+        prop_name: *const c_char,
+        prop_value: *mut f64,
+    ) -> c_int;
+
+    pub fn CXmpMetaGetPropertyBool(
+        meta: *mut CXmpMeta,
+        schema_ns: *const c_char,
+        prop_name: *const c_char,
+        prop_value: *mut c_int,
+    ) -> c_int;
+
+    pub fn CXmpMetaGetPropertyDate(
+        meta: *mut CXmpMeta,
+        schema_ns: *const c_char,
+        prop_name: *const c_char,
+        prop_value: *mut XmpDateTime,
+    ) -> c_int;
+
     pub fn CXmpMetaDoesPropertyExist(
         meta: *const CXmpMeta,
         schema_ns: *const c_char,
         prop_name: *const c_char,
     ) -> c_int;
 
+    pub fn CXmpMetaSnapshot(meta: *const CXmpMeta, sink_fn: CXmpStringSink, sink: *mut c_void);
+
+    pub fn CXmpMetaDiff(
+        a: *const CXmpMeta,
+        b: *const CXmpMeta,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+        change_count: *mut usize,
+    ) -> c_int;
+
+    pub fn CXmpMetaMerge(meta: *mut CXmpMeta, other: *const CXmpMeta, options: u32) -> c_int;
+
+    // --- CXmpIterator
+
+    pub fn CXmpIteratorNew(
+        meta: *const CXmpMeta,
+        schema_ns: *const c_char,
+        prop_name: *const c_char,
+        options: u32,
+    ) -> *mut CXmpIterator;
+
+    pub fn CXmpIteratorDrop(iter: *mut CXmpIterator);
+
+    pub fn CXmpIteratorNextPage(
+        iter: *mut CXmpIterator,
+        max_items: usize,
+        options: *mut u32,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    ) -> usize;
+
+    // --- CXmpPath
+
+    pub fn CXmpPathNew(schema_ns: *const c_char, prop_name: *const c_char) -> *mut CXmpPath;
+    pub fn CXmpPathDrop(path: *mut CXmpPath);
+
+    pub fn CXmpMetaGetPropertyAt(
+        meta: *mut CXmpMeta,
+        path: *const CXmpPath,
+        sink_fn: CXmpStringSink,
+        sink: *mut c_void,
+    ) -> c_int;
+
+    pub fn CXmpMetaSetPropertyAt(
+        meta: *mut CXmpMeta,
+        path: *const CXmpPath,
+        prop_value: *const c_char,
+    );
+
+    pub fn CXmpMetaDoesPropertyExistAt(meta: *const CXmpMeta, path: *const CXmpPath) -> c_int;
+
     // --- CXmpDateTime
 
-    pub fn CXmpDateTimeNew() -> *mut CXmpDateTime;
-    pub fn CXmpDateTimeDrop(dt: *mut CXmpDateTime);
-    pub fn CXmpDateTimeCurrent() -> *mut CXmpDateTime;
+    pub fn CXmpDateTimeCurrent(dt: *mut XmpDateTime);
 }
@@ -13,7 +13,26 @@
 
 #![deny(warnings)]
 
+#[cfg(feature = "async")]
+mod async_file;
+#[cfg(feature = "async")]
+pub use async_file::{AsyncXmpFile, XmpExecutor};
+
+mod columnar;
+pub use columnar::{
+    extract_columns, Column, ColumnBatch, ColumnData, ColumnSpec, ColumnType, ExtractColumns,
+};
+
+mod extract;
+pub use extract::{extract_many, ExtractMany, ExtractedXmp};
+
 mod ffi;
+mod sniff;
+
+pub mod metrics;
+
+mod packet_scan;
+pub use packet_scan::{find_packets, scan_file, FindPackets, ScannedPacket};
 
 mod xmp_const;
 pub use xmp_const::*;
@@ -21,10 +40,35 @@ pub use xmp_const::*;
 mod xmp_date_time;
 pub use xmp_date_time::XmpDateTime;
 
+mod xmp_diff;
+pub use xmp_diff::{MergeOptions, XmpChange};
+
+mod xmp_edit;
+pub use xmp_edit::{XmpEdit, XmpEditError};
+
 mod xmp_file;
+pub use xmp_file::CloseOptions;
+pub use xmp_file::CloseReport;
+pub use xmp_file::CloseStrategy;
 pub use xmp_file::OpenFileOptions;
+pub use xmp_file::Progress;
 pub use xmp_file::XmpFile;
 pub use xmp_file::XmpFileError;
+pub use xmp_file::XmpFileFormat;
+
+mod xmp_iterator;
+pub use xmp_iterator::{IterOptions, PropertyFlags, XmpIterator, XmpProperty};
 
 mod xmp_meta;
+pub use xmp_meta::SerializeOptions;
 pub use xmp_meta::XmpMeta;
+pub use xmp_meta::XmpMetaError;
+
+mod xmp_parser;
+pub use xmp_parser::XmpParser;
+
+mod xmp_path;
+pub use xmp_path::XmpPath;
+
+mod xmp_snapshot;
+pub use xmp_snapshot::{Siblings, SnapshotNode, SnapshotView, XmpSnapshot};
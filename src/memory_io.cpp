@@ -0,0 +1,244 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+#include <cstring>
+
+#if XMP_WinBuild
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "memory_io.hpp"
+
+// Error handling mirrors XMPFiles_IO: misuse is reported by throwing
+// XMP_Error, which XMPFiles catches and reports back to the caller.
+
+MemoryIO::MemoryIO(const void* data, size_t length, bool readOnly)
+    : buffer((const char*) data, length),
+      ownsData(true),
+      external(NULL),
+      externalLength(0),
+      position(0),
+      readOnly(readOnly),
+      counts(),
+      derivedTemp(NULL) {
+}
+
+MemoryIO::MemoryIO()
+    : ownsData(false),
+      external(NULL),
+      externalLength(0),
+      position(0),
+      readOnly(true),
+      counts(),
+      derivedTemp(NULL) {
+}
+
+void MemoryIO::SetExternalData(const char* data, size_t length) {
+    // An empty region is represented by the (empty) owned buffer.
+    external = (length > 0) ? data : NULL;
+    externalLength = (length > 0) ? length : 0;
+    position = 0;
+}
+
+MemoryIO::~MemoryIO() {
+    delete derivedTemp;
+}
+
+XMP_Uns32 MemoryIO::Read(void* outBuffer, XMP_Uns32 count, bool readAll) {
+    XMP_Int64 available = (XMP_Int64) Size() - position;
+    if (available < 0) available = 0;
+
+    if ((XMP_Int64) count > available) {
+        if (readAll) {
+            throw XMP_Error(kXMPErr_EnforceFailure, "MemoryIO::Read, not enough data");
+        }
+        count = (XMP_Uns32) available;
+    }
+
+    if (count > 0) {
+        memcpy(outBuffer, Data() + position, count);
+        position += count;
+    }
+
+    counts.bytesRead += count;
+    counts.readCalls += 1;
+    return count;
+}
+
+void MemoryIO::Write(const void* inBuffer, XMP_Uns32 count) {
+    if (readOnly) {
+        throw XMP_Error(kXMPErr_FilePermission, "MemoryIO::Write, file is read-only");
+    }
+
+    size_t end = (size_t) position + count;
+    if (end > buffer.size()) buffer.resize(end);
+
+    memcpy(&buffer[(size_t) position], inBuffer, count);
+    position = (XMP_Int64) end;
+    counts.bytesWritten += count;
+    counts.writeCalls += 1;
+}
+
+XMP_Int64 MemoryIO::Seek(XMP_Int64 offset, SeekMode mode) {
+    XMP_Int64 newPosition = offset;
+    if (mode == kXMP_SeekFromCurrent) {
+        newPosition += position;
+    } else if (mode == kXMP_SeekFromEnd) {
+        newPosition += (XMP_Int64) Size();
+    }
+
+    if (newPosition < 0) {
+        throw XMP_Error(kXMPErr_BadParam, "MemoryIO::Seek, negative offset");
+    }
+
+    if (newPosition > (XMP_Int64) Size()) {
+        if (readOnly) {
+            throw XMP_Error(kXMPErr_EnforceFailure, "MemoryIO::Seek, read-only seek beyond EOF");
+        }
+        buffer.resize((size_t) newPosition);
+    }
+
+    position = newPosition;
+    return position;
+}
+
+XMP_Int64 MemoryIO::Length() {
+    return (XMP_Int64) Size();
+}
+
+void MemoryIO::Truncate(XMP_Int64 length) {
+    if (readOnly) {
+        throw XMP_Error(kXMPErr_FilePermission, "MemoryIO::Truncate, file is read-only");
+    }
+    if (length < 0 || length > (XMP_Int64) buffer.size()) {
+        throw XMP_Error(kXMPErr_BadParam, "MemoryIO::Truncate, invalid length");
+    }
+
+    buffer.resize((size_t) length);
+    if (position > length) position = length;
+}
+
+XMP_IO* MemoryIO::DeriveTemp() {
+    if (derivedTemp != NULL) return derivedTemp;
+
+    if (readOnly) {
+        throw XMP_Error(kXMPErr_InternalFailure, "MemoryIO::DeriveTemp, can't derive from read-only");
+    }
+
+    derivedTemp = new MemoryIO(NULL, 0, false);
+    return derivedTemp;
+}
+
+void MemoryIO::AbsorbTemp() {
+    if (derivedTemp == NULL) {
+        throw XMP_Error(kXMPErr_InternalFailure, "MemoryIO::AbsorbTemp, no temp to absorb");
+    }
+
+    buffer.swap(derivedTemp->buffer);
+    position = 0;
+
+    DeleteTemp();
+}
+
+void MemoryIO::DeleteTemp() {
+    if (derivedTemp != NULL) {
+        counts.bytesRead += derivedTemp->counts.bytesRead;
+        counts.readCalls += derivedTemp->counts.readCalls;
+        counts.bytesWritten += derivedTemp->counts.bytesWritten;
+        counts.writeCalls += derivedTemp->counts.writeCalls;
+    }
+    delete derivedTemp;
+    derivedTemp = NULL;
+}
+
+MappedFileIO::MappedFileIO(const char* filePath)
+    : mapping(NULL),
+      mappingLength(0)
+      #if XMP_WinBuild
+          , mappingHandle(NULL)
+      #endif
+{
+    #if XMP_WinBuild
+        int wideLength = MultiByteToWideChar(CP_UTF8, 0, filePath, -1, NULL, 0);
+        std::wstring widePath(wideLength > 0 ? wideLength : 1, L'\0');
+        if (wideLength > 0) {
+            MultiByteToWideChar(CP_UTF8, 0, filePath, -1, &widePath[0], wideLength);
+        }
+
+        HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw XMP_Error(kXMPErr_NoFile, "MappedFileIO, can't open file");
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            throw XMP_Error(kXMPErr_ExternalFailure, "MappedFileIO, can't get file size");
+        }
+
+        if (size.QuadPart > 0) {
+            mappingHandle = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mappingHandle != NULL) {
+                mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            }
+        }
+        CloseHandle(file);
+
+        if (size.QuadPart > 0 && mapping == NULL) {
+            if (mappingHandle != NULL) CloseHandle(mappingHandle);
+            throw XMP_Error(kXMPErr_ExternalFailure, "MappedFileIO, can't map file");
+        }
+
+        mappingLength = (size_t) size.QuadPart;
+    #else
+        int fd = open(filePath, O_RDONLY);
+        if (fd < 0) {
+            throw XMP_Error(kXMPErr_NoFile, "MappedFileIO, can't open file");
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw XMP_Error(kXMPErr_ExternalFailure, "MappedFileIO, can't get file size");
+        }
+
+        if (info.st_size > 0) {
+            mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            mapping = NULL;
+            throw XMP_Error(kXMPErr_ExternalFailure, "MappedFileIO, can't map file");
+        }
+
+        mappingLength = (size_t) info.st_size;
+    #endif
+
+    SetExternalData((const char*) mapping, mappingLength);
+}
+
+MappedFileIO::~MappedFileIO() {
+    #if XMP_WinBuild
+        if (mapping != NULL) UnmapViewOfFile(mapping);
+        if (mappingHandle != NULL) CloseHandle(mappingHandle);
+    #else
+        if (mapping != NULL) munmap(mapping, mappingLength);
+    #endif
+}
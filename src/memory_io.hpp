@@ -0,0 +1,108 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+#ifndef XMP_TOOLKIT_RS_MEMORY_IO_HPP
+#define XMP_TOOLKIT_RS_MEMORY_IO_HPP
+
+#include <string>
+
+#include "XMP_IO.hpp"
+
+// MemoryIO is an XMP_IO implementation over an in-memory file image.
+// It lets XMPFiles read (and update) a file that the client already
+// holds in memory, without a round trip through the file system.
+//
+// The image is copied into a buffer owned by this object, so the
+// caller's memory need not outlive the open file. When opened for
+// update, the modified image can be read back via Data() and Size()
+// once the file has been closed.
+//
+// Subclasses may instead serve reads directly from a region they own
+// (see MappedFileIO); such objects are always read-only.
+
+// Counts of the reads and writes made through a MemoryIO (and any temp
+// derived from it), including calls that transfer no data.
+struct MemoryIOCounts {
+    XMP_Int64 bytesRead;
+    XMP_Int64 readCalls;
+    XMP_Int64 bytesWritten;
+    XMP_Int64 writeCalls;
+};
+
+class MemoryIO : public XMP_IO {
+public:
+    MemoryIO(const void* data, size_t length, bool readOnly);
+    virtual ~MemoryIO();
+
+    virtual XMP_Uns32 Read(void* buffer, XMP_Uns32 count, bool readAll = false);
+    virtual void Write(const void* buffer, XMP_Uns32 count);
+    virtual XMP_Int64 Seek(XMP_Int64 offset, SeekMode mode);
+    virtual XMP_Int64 Length();
+    virtual void Truncate(XMP_Int64 length);
+
+    virtual XMP_IO* DeriveTemp();
+    virtual void AbsorbTemp();
+    virtual void DeleteTemp();
+
+    const char* Data() const { return external ? external : buffer.data(); }
+    size_t Size() const { return external ? externalLength : buffer.size(); }
+
+    // True if the image is held in a buffer owned by this object
+    // (as opposed to a region owned by a subclass).
+    bool OwnsData() const { return ownsData; }
+
+    // Total bytes written to this image (and to any temp derived from it)
+    // since it was created, counting rewrites of the same region.
+    XMP_Int64 BytesWritten() const { return counts.bytesWritten; }
+
+    // All reads and writes since this image was created. Reads and writes
+    // of a derived temp are included once it is absorbed or deleted.
+    const MemoryIOCounts& Counts() const { return counts; }
+
+protected:
+    MemoryIO();
+    void SetExternalData(const char* data, size_t length);
+
+private:
+    std::string buffer;
+    bool ownsData;
+    const char* external;
+    size_t externalLength;
+    XMP_Int64 position;
+    bool readOnly;
+    MemoryIOCounts counts;
+    MemoryIO* derivedTemp;
+};
+
+// MappedFileIO is a read-only MemoryIO that serves reads from a
+// memory-mapped view of a file. Handlers that walk many small boxes
+// or chunks (MPEG-4, RIFF, and so on) then cost page faults rather
+// than a read() call per seek.
+//
+// As with any memory mapping, the file must not be truncated by
+// another process while it is mapped.
+
+class MappedFileIO : public MemoryIO {
+public:
+    explicit MappedFileIO(const char* filePath);
+    virtual ~MappedFileIO();
+
+private:
+    void* mapping;
+    size_t mappingLength;
+    #if XMP_WinBuild
+        void* mappingHandle;
+    #endif
+};
+
+#endif
@@ -0,0 +1,429 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+//! Opt-in timing and I/O counters for calls into the XMP Toolkit.
+//!
+//! Collection is off by default; call `enable()` to start it. While it is
+//! off, each instrumented call costs one relaxed atomic load. While it is
+//! on, each call also reads the clock twice and updates a few atomic
+//! counters; no locks are taken.
+//!
+//! Calls are grouped into phases (see `Phase`). Each phase has a latency
+//! histogram. `snapshot()` returns the current values, and
+//! `MetricsSnapshot::to_prometheus()` formats them in the Prometheus text
+//! exposition format.
+
+use std::fmt::Write;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+/// A group of calls into the XMP Toolkit that are timed together.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Phase {
+    /// Opening a file: `XmpFile::open_file()` and related functions.
+    /// Includes handler selection and the initial read of the file.
+    Open,
+
+    /// Reading the XMP from an open file: `XmpFile::xmp()`. Includes
+    /// reconciliation of legacy metadata (TIFF, Exif, IPTC) into XMP.
+    GetXmp,
+
+    /// Supplying new XMP to an open file: `XmpFile::put_xmp()` and
+    /// related functions.
+    PutXmp,
+
+    /// Closing a file: `XmpFile::close()` and `close_with()`. Includes
+    /// reconciliation of XMP back into legacy metadata and writing the file.
+    Close,
+
+    /// Parsing a packet: `XmpMeta::from_packet()` and `XmpParser`.
+    Parse,
+
+    /// Serializing a packet: `XmpMeta::to_packet()` and related functions.
+    Serialize,
+}
+
+impl Phase {
+    /// All phases, in the order they are reported.
+    pub const ALL: &'static [Phase] = &[
+        Phase::Open,
+        Phase::GetXmp,
+        Phase::PutXmp,
+        Phase::Close,
+        Phase::Parse,
+        Phase::Serialize,
+    ];
+
+    /// The name used for this phase in metric labels.
+    pub fn name(self) -> &'static str {
+        match self {
+            Phase::Open => "open",
+            Phase::GetXmp => "get_xmp",
+            Phase::PutXmp => "put_xmp",
+            Phase::Close => "close",
+            Phase::Parse => "parse",
+            Phase::Serialize => "serialize",
+        }
+    }
+
+    fn index(self) -> usize {
+        self as usize
+    }
+}
+
+// Upper bounds of the latency buckets, in microseconds. A final,
+// unbounded bucket follows.
+const BUCKET_BOUNDS_MICROS: [u64; 18] = [
+    10, 50, 100, 250, 500, 1_000, 2_500, 5_000, 10_000, 25_000, 50_000, 100_000, 250_000, 500_000,
+    1_000_000, 2_500_000, 5_000_000, 10_000_000,
+];
+
+const BUCKETS: usize = 19;
+
+// Array repeat expressions can't use a non-Copy initializer in the
+// minimum supported Rust version, so the buckets are spelled out.
+macro_rules! zero_buckets {
+    () => {
+        [
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+            AtomicU64::new(0),
+        ]
+    };
+}
+
+struct Histogram {
+    count: AtomicU64,
+    sum_nanos: AtomicU64,
+    buckets: [AtomicU64; BUCKETS],
+}
+
+impl Histogram {
+    const fn new() -> Histogram {
+        Histogram {
+            count: AtomicU64::new(0),
+            sum_nanos: AtomicU64::new(0),
+            buckets: zero_buckets!(),
+        }
+    }
+
+    fn record(&self, elapsed: Duration) {
+        let micros = elapsed.as_micros();
+        let bucket = BUCKET_BOUNDS_MICROS
+            .iter()
+            .position(|bound| micros <= *bound as u128)
+            .unwrap_or(BUCKETS - 1);
+
+        self.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+        self.sum_nanos
+            .fetch_add(elapsed.as_nanos() as u64, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn reset(&self) {
+        self.count.store(0, Ordering::Relaxed);
+        self.sum_nanos.store(0, Ordering::Relaxed);
+        for b in self.buckets.iter() {
+            b.store(0, Ordering::Relaxed);
+        }
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+static HISTOGRAMS: [Histogram; 6] = [
+    Histogram::new(),
+    Histogram::new(),
+    Histogram::new(),
+    Histogram::new(),
+    Histogram::new(),
+    Histogram::new(),
+];
+
+static BYTES_READ: AtomicU64 = AtomicU64::new(0);
+static READ_CALLS: AtomicU64 = AtomicU64::new(0);
+static BYTES_WRITTEN: AtomicU64 = AtomicU64::new(0);
+static WRITE_CALLS: AtomicU64 = AtomicU64::new(0);
+
+/// Starts collecting metrics.
+pub fn enable() {
+    ENABLED.store(true, Ordering::Relaxed);
+}
+
+/// Stops collecting metrics. Values collected so far are kept.
+pub fn disable() {
+    ENABLED.store(false, Ordering::Relaxed);
+}
+
+/// Reports whether metrics are being collected.
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Sets all counters and histograms back to zero.
+pub fn reset() {
+    for h in HISTOGRAMS.iter() {
+        h.reset();
+    }
+    BYTES_READ.store(0, Ordering::Relaxed);
+    READ_CALLS.store(0, Ordering::Relaxed);
+    BYTES_WRITTEN.store(0, Ordering::Relaxed);
+    WRITE_CALLS.store(0, Ordering::Relaxed);
+}
+
+/// Returns the current values of all metrics.
+///
+/// The values are read one at a time while other threads may be updating
+/// them, so a snapshot taken during heavy activity may be slightly
+/// inconsistent (for example, a bucket count that includes a call the
+/// total count doesn't yet).
+pub fn snapshot() -> MetricsSnapshot {
+    let phases = Phase::ALL
+        .iter()
+        .map(|phase| {
+            let h = &HISTOGRAMS[phase.index()];
+
+            let mut cumulative = 0;
+            let buckets = h
+                .buckets
+                .iter()
+                .enumerate()
+                .map(|(i, b)| {
+                    cumulative += b.load(Ordering::Relaxed);
+                    let bound = BUCKET_BOUNDS_MICROS
+                        .get(i)
+                        .map(|micros| Duration::from_micros(*micros));
+                    (bound, cumulative)
+                })
+                .collect();
+
+            PhaseMetrics {
+                phase: *phase,
+                count: h.count.load(Ordering::Relaxed),
+                total: Duration::from_nanos(h.sum_nanos.load(Ordering::Relaxed)),
+                buckets,
+            }
+        })
+        .collect();
+
+    MetricsSnapshot {
+        phases,
+        bytes_read: BYTES_READ.load(Ordering::Relaxed),
+        read_calls: READ_CALLS.load(Ordering::Relaxed),
+        bytes_written: BYTES_WRITTEN.load(Ordering::Relaxed),
+        write_calls: WRITE_CALLS.load(Ordering::Relaxed),
+    }
+}
+
+/// The values of all metrics at one point in time; see `snapshot()`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct MetricsSnapshot {
+    /// One entry per phase, in the order of `Phase::ALL`.
+    pub phases: Vec<PhaseMetrics>,
+
+    /// Bytes of file data read by the XMP Toolkit's file handlers.
+    ///
+    /// This and the other I/O counters cover files opened with
+    /// `XmpFile::open_from_bytes()` or `XmpFile::open_file_mapped()`, whose
+    /// reads and writes pass through this crate. I/O on files opened with
+    /// `XmpFile::open_file()` is done entirely by the toolkit and isn't
+    /// counted.
+    pub bytes_read: u64,
+
+    /// The number of read calls made by file handlers.
+    pub read_calls: u64,
+
+    /// Bytes of file data written by file handlers.
+    pub bytes_written: u64,
+
+    /// The number of write calls made by file handlers.
+    pub write_calls: u64,
+}
+
+/// The latency histogram for one phase.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct PhaseMetrics {
+    /// The phase that was timed.
+    pub phase: Phase,
+
+    /// The number of calls.
+    pub count: u64,
+
+    /// The total time spent in those calls.
+    pub total: Duration,
+
+    /// Cumulative bucket counts: each entry is an upper bound and the
+    /// number of calls that took no longer than that. The last entry has
+    /// no bound and counts all calls.
+    pub buckets: Vec<(Option<Duration>, u64)>,
+}
+
+impl MetricsSnapshot {
+    /// Returns the metrics in the Prometheus text exposition format.
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+
+        out.push_str(
+            "# HELP xmp_toolkit_phase_duration_seconds Time spent in XMP Toolkit calls.\n",
+        );
+        out.push_str("# TYPE xmp_toolkit_phase_duration_seconds histogram\n");
+
+        for p in self.phases.iter() {
+            let name = p.phase.name();
+            for (bound, count) in p.buckets.iter() {
+                let le = match bound {
+                    Some(d) => format!("{}", d.as_secs_f64()),
+                    None => "+Inf".to_owned(),
+                };
+                let _ = writeln!(
+                    out,
+                    "xmp_toolkit_phase_duration_seconds_bucket{{phase=\"{}\",le=\"{}\"}} {}",
+                    name, le, count
+                );
+            }
+            let _ = writeln!(
+                out,
+                "xmp_toolkit_phase_duration_seconds_sum{{phase=\"{}\"}} {}",
+                name,
+                p.total.as_secs_f64()
+            );
+            let _ = writeln!(
+                out,
+                "xmp_toolkit_phase_duration_seconds_count{{phase=\"{}\"}} {}",
+                name, p.count
+            );
+        }
+
+        let counters = [
+            (
+                "xmp_toolkit_read_bytes_total",
+                "File data read by file handlers.",
+                self.bytes_read,
+            ),
+            (
+                "xmp_toolkit_read_calls_total",
+                "Read calls made by file handlers.",
+                self.read_calls,
+            ),
+            (
+                "xmp_toolkit_written_bytes_total",
+                "File data written by file handlers.",
+                self.bytes_written,
+            ),
+            (
+                "xmp_toolkit_write_calls_total",
+                "Write calls made by file handlers.",
+                self.write_calls,
+            ),
+        ];
+
+        for (name, help, value) in counters.iter() {
+            let _ = writeln!(out, "# HELP {} {}", name, help);
+            let _ = writeln!(out, "# TYPE {} counter", name);
+            let _ = writeln!(out, "{} {}", name, value);
+        }
+
+        out
+    }
+}
+
+// Times one call; the elapsed time is recorded when the timer is dropped.
+pub(crate) struct Timer {
+    phase: Phase,
+    start: Option<Instant>,
+}
+
+impl Drop for Timer {
+    fn drop(&mut self) {
+        if let Some(start) = self.start {
+            HISTOGRAMS[self.phase.index()].record(start.elapsed());
+        }
+    }
+}
+
+pub(crate) fn time(phase: Phase) -> Timer {
+    Timer {
+        phase,
+        start: if is_enabled() {
+            Some(Instant::now())
+        } else {
+            None
+        },
+    }
+}
+
+pub(crate) fn add_io(bytes_read: u64, read_calls: u64, bytes_written: u64, write_calls: u64) {
+    if is_enabled() {
+        BYTES_READ.fetch_add(bytes_read, Ordering::Relaxed);
+        READ_CALLS.fetch_add(read_calls, Ordering::Relaxed);
+        BYTES_WRITTEN.fetch_add(bytes_written, Ordering::Relaxed);
+        WRITE_CALLS.fetch_add(write_calls, Ordering::Relaxed);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // The metrics are global, so everything is tested in a single test
+    // (which only checks lower bounds, since other tests may be running).
+    #[test]
+    fn collect_and_export() {
+        enable();
+
+        {
+            let _t = time(Phase::Serialize);
+            std::thread::sleep(Duration::from_millis(2));
+        }
+        add_io(10, 1, 100, 2);
+
+        let s = snapshot();
+        assert_eq!(s.phases.len(), Phase::ALL.len());
+
+        let serialize = &s.phases[Phase::Serialize.index()];
+        assert_eq!(serialize.phase, Phase::Serialize);
+        assert!(serialize.count >= 1);
+        assert!(serialize.total >= Duration::from_millis(2));
+        assert_eq!(serialize.buckets.len(), BUCKETS);
+        assert_eq!(serialize.buckets.last().unwrap().0, None);
+        assert!(serialize.buckets.last().unwrap().1 >= 1);
+        assert!(s.bytes_read >= 10 && s.read_calls >= 1);
+        assert!(s.bytes_written >= 100 && s.write_calls >= 2);
+
+        let text = s.to_prometheus();
+        assert!(text.contains("# TYPE xmp_toolkit_phase_duration_seconds histogram\n"));
+        assert!(text.contains(
+            "xmp_toolkit_phase_duration_seconds_bucket{phase=\"serialize\",le=\"0.00001\"} "
+        ));
+        assert!(text.contains("phase=\"serialize\",le=\"+Inf\"}"));
+        assert!(text.contains("# TYPE xmp_toolkit_read_calls_total counter\n"));
+        assert!(text.contains("xmp_toolkit_written_bytes_total "));
+        assert!(text.contains("xmp_toolkit_write_calls_total "));
+    }
+}
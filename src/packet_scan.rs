@@ -0,0 +1,393 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::fs::File;
+use std::io::{self, Read};
+use std::path::Path;
+
+use crate::xmp_meta::XmpMeta;
+
+const PACKET_HEADER: &[u8] = b"<?xpacket begin=";
+const PACKET_TRAILER: &[u8] = b"<?xpacket end=";
+
+// Files are read in blocks of this size by `scan_file()`.
+const BLOCK_SIZE: usize = 1024 * 1024;
+
+// A candidate packet that grows beyond this size without a trailer
+// is abandoned, so that a stray header can't make `scan_file()` hold
+// the rest of a large file in memory.
+const MAX_PACKET_SIZE: usize = 64 * 1024 * 1024;
+
+/// An XMP packet found by `find_packets()`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ScannedPacket<'a> {
+    /// The offset of the packet header within the scanned data.
+    pub offset: usize,
+
+    /// The entire packet, from the start of the `<?xpacket begin=` header
+    /// to the end of the `<?xpacket end=...?>` trailer.
+    pub bytes: &'a [u8],
+
+    /// True if the trailer says the packet may be updated in place
+    /// (`end="w"`).
+    pub writable: bool,
+}
+
+/// Finds the XMP packets embedded in arbitrary data.
+///
+/// This is the Rust counterpart of the XMP Toolkit's packet scanner, which
+/// is used for file formats that have no smart handler. Candidate packet
+/// headers are located 16 bytes at a time using SSE2 where available
+/// (and a scalar loop elsewhere), so data that contains no XMP is skipped
+/// at close to memory speed.
+///
+/// Only UTF-8 packets are found.
+pub fn find_packets(data: &[u8]) -> FindPackets<'_> {
+    FindPackets { data, pos: 0 }
+}
+
+/// An iterator over the XMP packets in a byte slice.
+///
+/// Created by `find_packets()`.
+pub struct FindPackets<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Iterator for FindPackets<'a> {
+    type Item = ScannedPacket<'a>;
+
+    fn next(&mut self) -> Option<ScannedPacket<'a>> {
+        loop {
+            let (offset, end, writable) = match next_packet(self.data, self.pos, 0) {
+                Candidate::Packet(offset, end, writable) => (offset, end, writable),
+                Candidate::Unterminated(offset, _) => {
+                    // A header without a trailer; keep looking after it.
+                    self.pos = offset + PACKET_HEADER.len();
+                    continue;
+                }
+                Candidate::None => {
+                    self.pos = self.data.len();
+                    return None;
+                }
+            };
+
+            self.pos = end;
+            return Some(ScannedPacket {
+                offset,
+                bytes: &self.data[offset..end],
+                writable,
+            });
+        }
+    }
+}
+
+/// Reads the XMP from a file by scanning it for packets.
+///
+/// This is a faster alternative to opening the file with
+/// `OpenFileOptions::OPEN_USE_PACKET_SCANNING` and reading its XMP: the
+/// file is read in 1 MiB blocks and scanned with `find_packets()` rather
+/// than by the byte-at-a-time state machine in the XMP Toolkit. Unlike the
+/// toolkit's scanner, which also recognizes UTF-16 and UTF-32 packets,
+/// only UTF-8 packets are found.
+///
+/// If the file contains more than one packet, the last one that parses
+/// is returned, since it is most likely to be the one that was updated.
+/// Returns `Ok(None)` if there is no such packet.
+pub fn scan_file<P: AsRef<Path>>(path: P) -> io::Result<Option<XmpMeta>> {
+    let mut file = File::open(path)?;
+    let mut window: Vec<u8> = Vec::with_capacity(BLOCK_SIZE);
+    let mut result: Option<XmpMeta> = None;
+
+    // Where to resume looking for the trailer of the unterminated packet
+    // kept at the start of the window, so that data already searched isn't
+    // searched again as the window grows.
+    let mut trailer_from = 0;
+
+    loop {
+        let start = window.len();
+        window.resize(start + BLOCK_SIZE, 0);
+        let n = read_fully(&mut file, &mut window[start..])?;
+        window.truncate(start + n);
+        let at_eof = n < BLOCK_SIZE;
+
+        // Parse every complete packet in the window, then keep whatever
+        // might still be the start of one for the next block.
+        let mut pos = 0;
+        let keep_from = loop {
+            let candidate = next_packet(&window, pos, trailer_from);
+            trailer_from = 0;
+
+            match candidate {
+                Candidate::Packet(offset, end, _) => {
+                    if let Ok(m) = XmpMeta::from_packet(&window[offset..end]) {
+                        result = Some(m);
+                    }
+                    pos = end;
+                }
+                Candidate::Unterminated(offset, resume) => {
+                    if at_eof || window.len() - offset > MAX_PACKET_SIZE {
+                        pos = offset + PACKET_HEADER.len();
+                    } else {
+                        trailer_from = resume - offset;
+                        break offset;
+                    }
+                }
+                Candidate::None => {
+                    // A header may straddle the end of the window.
+                    break window
+                        .len()
+                        .saturating_sub(PACKET_HEADER.len() - 1)
+                        .max(pos);
+                }
+            }
+        };
+
+        if at_eof {
+            return Ok(result);
+        }
+
+        window.drain(..keep_from);
+    }
+}
+
+fn read_fully<R: Read>(r: &mut R, buf: &mut [u8]) -> io::Result<usize> {
+    let mut total = 0;
+    while total < buf.len() {
+        match r.read(&mut buf[total..]) {
+            Ok(0) => break,
+            Ok(n) => total += n,
+            Err(ref e) if e.kind() == io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(total)
+}
+
+enum Candidate {
+    // (offset, end, writable)
+    Packet(usize, usize, bool),
+
+    // (offset, resume): a header at `offset` with no trailer after it.
+    // Any trailer for it that shows up once more data is appended will
+    // start at or after `resume`.
+    Unterminated(usize, usize),
+
+    None,
+}
+
+// Finds the first packet header at or after `from`, and the trailer
+// that closes it. The trailer search starts no earlier than
+// `trailer_from`, which is the `resume` point of an earlier
+// `Unterminated` result for the same header (or 0).
+fn next_packet(data: &[u8], from: usize, trailer_from: usize) -> Candidate {
+    let offset = match find(data, from, PACKET_HEADER) {
+        Some(offset) => offset,
+        None => return Candidate::None,
+    };
+
+    let search_from = (offset + PACKET_HEADER.len()).max(trailer_from);
+    let trailer = match find(data, search_from, PACKET_TRAILER) {
+        Some(trailer) => trailer,
+        None => {
+            // A trailer may straddle the end of the data.
+            let resume = data
+                .len()
+                .saturating_sub(PACKET_TRAILER.len() - 1)
+                .max(search_from);
+            return Candidate::Unterminated(offset, resume);
+        }
+    };
+
+    // The trailer is `<?xpacket end="w"?>` or `<?xpacket end='r'?>`.
+    let attrs = trailer + PACKET_TRAILER.len();
+    let close = match data[attrs..].windows(2).position(|w| w == b"?>") {
+        Some(close) => attrs + close + 2,
+        None => return Candidate::Unterminated(offset, trailer),
+    };
+
+    let writable = data.get(attrs + 1) == Some(&b'w');
+    Candidate::Packet(offset, close, writable)
+}
+
+// Finds `needle` (which must start with "<?") in `data` at or after
+// `from`.
+fn find(data: &[u8], mut from: usize, needle: &[u8]) -> Option<usize> {
+    debug_assert!(needle.starts_with(b"<?"));
+
+    while let Some(i) = find_pi_start(data, from) {
+        if data[i..].starts_with(needle) {
+            return Some(i);
+        }
+        from = i + 1;
+    }
+    None
+}
+
+// Finds the next "<?" in `data` at or after `from`.
+#[cfg(target_arch = "x86_64")]
+fn find_pi_start(data: &[u8], from: usize) -> Option<usize> {
+    use std::arch::x86_64::*;
+
+    let mut i = from;
+
+    // SSE2 is part of the x86_64 baseline, so no runtime check is needed.
+    // Each step compares 16 bytes against '<' and the 16 bytes one later
+    // against '?'; a set bit in both masks is a match.
+    unsafe {
+        let lt = _mm_set1_epi8(b'<' as i8);
+        let qm = _mm_set1_epi8(b'?' as i8);
+
+        while i + 17 <= data.len() {
+            let p = data.as_ptr().add(i);
+            let a = _mm_loadu_si128(p as *const __m128i);
+            let b = _mm_loadu_si128(p.add(1) as *const __m128i);
+            let hits = _mm_and_si128(_mm_cmpeq_epi8(a, lt), _mm_cmpeq_epi8(b, qm));
+            let mask = _mm_movemask_epi8(hits) as u32;
+
+            if mask != 0 {
+                return Some(i + mask.trailing_zeros() as usize);
+            }
+            i += 16;
+        }
+    }
+
+    find_pi_start_scalar(data, i)
+}
+
+#[cfg(not(target_arch = "x86_64"))]
+fn find_pi_start(data: &[u8], from: usize) -> Option<usize> {
+    find_pi_start_scalar(data, from)
+}
+
+fn find_pi_start_scalar(data: &[u8], from: usize) -> Option<usize> {
+    if from >= data.len() {
+        return None;
+    }
+
+    data[from..]
+        .windows(2)
+        .position(|w| w == b"<?")
+        .map(|i| from + i)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Write;
+
+    use tempfile::NamedTempFile;
+
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    fn packet(creator_tool: &str, end: char) -> String {
+        format!(
+            r#"<?xpacket begin="" id="W5M0MpCehiHzreSzNTczkc9d"?>
+<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+   xmp:CreatorTool="{}"/>
+ </rdf:RDF>
+</x:xmpmeta>
+<?xpacket end="{}"?>"#,
+            creator_tool, end
+        )
+    }
+
+    #[test]
+    fn pi_start() {
+        let mut data = vec![b'<'; 100];
+        data.extend_from_slice(b"<?");
+        data.extend_from_slice(&[b'?'; 50]);
+
+        for from in 0..=100 {
+            assert_eq!(find_pi_start(&data, from), Some(100));
+            assert_eq!(find_pi_start_scalar(&data, from), Some(100));
+        }
+        assert_eq!(find_pi_start(&data, 101), None);
+        assert_eq!(find_pi_start(&data, 1000), None);
+    }
+
+    #[test]
+    fn find_in_bytes() {
+        let mut data = vec![0u8; 1000];
+        data.extend_from_slice(b"<?xml version=\"1.0\"?><?xpacket");
+        data.extend_from_slice(packet("first", 'w').as_bytes());
+        data.extend_from_slice(&[0xFF; 33]);
+        let second_offset = data.len();
+        data.extend_from_slice(packet("second", 'r').as_bytes());
+        data.extend_from_slice(&[0; 7]);
+
+        let packets: Vec<ScannedPacket> = find_packets(&data).collect();
+        assert_eq!(packets.len(), 2);
+
+        assert!(packets[0].writable);
+        assert_eq!(packets[0].bytes, packet("first", 'w').as_bytes());
+
+        assert!(!packets[1].writable);
+        assert_eq!(packets[1].offset, second_offset);
+        assert_eq!(packets[1].bytes, packet("second", 'r').as_bytes());
+
+        assert_eq!(find_packets(&[]).count(), 0);
+        assert_eq!(find_packets(&data[..1100]).count(), 0);
+    }
+
+    #[test]
+    fn scan_across_blocks() {
+        let mut f = NamedTempFile::new().unwrap();
+
+        // Place the last packet so that it straddles a block boundary.
+        let first = packet("first", 'w');
+        let second = packet("second", 'w');
+        f.write_all(first.as_bytes()).unwrap();
+        f.write_all(&vec![0u8; BLOCK_SIZE - first.len() - 20])
+            .unwrap();
+        f.write_all(second.as_bytes()).unwrap();
+        f.write_all(&vec![0u8; 100]).unwrap();
+        f.flush().unwrap();
+
+        let m = scan_file(f.path()).unwrap().unwrap();
+        assert_eq!(m.property(XMP_NS_XMP, "CreatorTool").unwrap(), "second");
+    }
+
+    #[test]
+    fn scan_large_padded_packet() {
+        // A packet whose padding spans several blocks, with the trailer
+        // straddling a block boundary.
+        let whole = packet("padded", 'w');
+        let split = whole.find("<?xpacket end=").unwrap();
+        let (body, trailer) = whole.split_at(split);
+
+        let mut f = NamedTempFile::new().unwrap();
+        f.write_all(body.as_bytes()).unwrap();
+        f.write_all(&vec![b' '; 3 * BLOCK_SIZE - body.len() - 5])
+            .unwrap();
+        f.write_all(trailer.as_bytes()).unwrap();
+        f.flush().unwrap();
+
+        let m = scan_file(f.path()).unwrap().unwrap();
+        assert_eq!(m.property(XMP_NS_XMP, "CreatorTool").unwrap(), "padded");
+    }
+
+    #[test]
+    fn scan_without_packet() {
+        let mut f = NamedTempFile::new().unwrap();
+        f.write_all(b"no xmp here <?xpacket begin=").unwrap();
+        f.flush().unwrap();
+
+        assert!(scan_file(f.path()).unwrap().is_none());
+        assert!(scan_file("doesnt_exist.bin").is_err());
+    }
+}
@@ -0,0 +1,245 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::fs::File;
+use std::io::Read;
+use std::path::Path;
+
+use crate::xmp_file::XmpFileFormat;
+
+// Signatures recognized by `XmpFileFormat::sniff()`, as
+// (offset, magic bytes, format). Entries are checked in order,
+// so a more specific signature must precede any that it shares
+// a prefix with.
+//
+// ISO base media files (MPEG-4, QuickTime, HEIF) are identified
+// by their `ftyp` brand and are handled separately.
+const SIGNATURES: &[(usize, &[u8], XmpFileFormat)] = &[
+    (0, b"\xFF\xD8\xFF", XmpFileFormat::Jpeg),
+    (0, b"\x89PNG\r\n\x1A\n", XmpFileFormat::Png),
+    (0, b"II*\0", XmpFileFormat::Tiff),
+    (0, b"MM\0*", XmpFileFormat::Tiff),
+    (0, b"8BPS", XmpFileFormat::Photoshop),
+    (0, b"GIF87a", XmpFileFormat::Gif),
+    (0, b"GIF89a", XmpFileFormat::Gif),
+    (0, b"\0\0\0\x0CjP  \r\n\x87\n", XmpFileFormat::Jpeg2K),
+    (0, b"%PDF-", XmpFileFormat::Pdf),
+    (0, b"%!PS-Adobe-", XmpFileFormat::PostScript),
+    (0, b"\xC5\xD0\xD3\xC6", XmpFileFormat::Eps),
+    (0, b"FWS", XmpFileFormat::Swf),
+    (0, b"CWS", XmpFileFormat::Swf),
+    (0, b"FLV\x01", XmpFileFormat::Flv),
+    (8, b"WAVE", XmpFileFormat::Wav),
+    (8, b"AVI ", XmpFileFormat::Avi),
+    (8, b"AIFF", XmpFileFormat::Aiff),
+    (8, b"AIFC", XmpFileFormat::Aiff),
+    (0, b"ID3", XmpFileFormat::Mp3),
+    (
+        0,
+        b"\x30\x26\xB2\x75\x8E\x66\xCF\x11\xA6\xD9\x00\xAA\x00\x62\xCE\x6C",
+        XmpFileFormat::WindowsMedia,
+    ),
+    (
+        0,
+        b"\x06\x06\xED\xF5\xD8\x1D\x46\xE5\xBD\x31\xEF\xE7\xFE\x74\xB7\x1D",
+        XmpFileFormat::InDesign,
+    ),
+];
+
+// `ftyp` major brands that identify HEIF images.
+const HEIF_BRANDS: &[&[u8]] = &[
+    b"heic", b"heix", b"heim", b"heis", b"hevc", b"hevx", b"mif1", b"msf1",
+];
+
+// Top-level atoms that commonly begin a classic QuickTime file
+// without an `ftyp` box.
+const QUICKTIME_ATOMS: &[&[u8]] = &[b"moov", b"mdat", b"wide", b"free", b"skip"];
+
+impl XmpFileFormat {
+    /// The number of leading bytes examined by `sniff()`.
+    pub const SNIFF_LENGTH: usize = 64;
+
+    /// Identifies a file format from the leading bytes of a file.
+    ///
+    /// This recognizes the signatures of the common image, audio, and video
+    /// formats supported by the XMP Toolkit (JPEG, PNG, TIFF, PSD, GIF,
+    /// MPEG-4 and QuickTime, WAV, AVI, AIFF, and so on) using only the first
+    /// `SNIFF_LENGTH` bytes of the file. No file handler is consulted.
+    ///
+    /// The result is intended as a hint for `XmpFile::open_file()` and related
+    /// functions: the matching handler is then tried first, avoiding the probe
+    /// reads of every other handler. Note that some formats share a container
+    /// (for example, many camera raw formats are TIFF files), so the sniffed
+    /// format is not necessarily the one that `XmpFile::check_file_format()`
+    /// would report.
+    ///
+    /// Returns `XmpFileFormat::Unknown` if no signature matches.
+    pub fn sniff(header: &[u8]) -> XmpFileFormat {
+        let header = &header[..header.len().min(Self::SNIFF_LENGTH)];
+
+        if header.len() >= 12 && &header[4..8] == b"ftyp" {
+            let brand = &header[8..12];
+            return if brand == b"qt  " {
+                XmpFileFormat::Mov
+            } else if HEIF_BRANDS.contains(&brand) {
+                XmpFileFormat::Heif
+            } else {
+                XmpFileFormat::Mpeg4
+            };
+        }
+
+        for (offset, magic, format) in SIGNATURES {
+            if header.len() >= offset + magic.len()
+                && &header[*offset..offset + magic.len()] == *magic
+            {
+                // RIFF and IFF subtypes are only meaningful inside
+                // their container.
+                if *offset == 8 && !(header.starts_with(b"RIFF") || header.starts_with(b"FORM")) {
+                    continue;
+                }
+                return *format;
+            }
+        }
+
+        if header.len() >= 8 && QUICKTIME_ATOMS.contains(&&header[4..8]) {
+            return XmpFileFormat::Mov;
+        }
+
+        XmpFileFormat::Unknown
+    }
+
+    /// Identifies the format of a file by reading its first `SNIFF_LENGTH`
+    /// bytes. See `sniff()`.
+    ///
+    /// Returns `XmpFileFormat::Unknown` if no signature matches or the
+    /// file can not be read.
+    pub fn sniff_file<P: AsRef<Path>>(path: P) -> XmpFileFormat {
+        match read_header(path.as_ref()) {
+            Some(header) => XmpFileFormat::sniff(&header),
+            None => XmpFileFormat::Unknown,
+        }
+    }
+}
+
+fn read_header(path: &Path) -> Option<Vec<u8>> {
+    let file = File::open(path).ok()?;
+    let mut header = Vec::with_capacity(XmpFileFormat::SNIFF_LENGTH);
+    file.take(XmpFileFormat::SNIFF_LENGTH as u64)
+        .read_to_end(&mut header)
+        .ok()?;
+    Some(header)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::fs;
+    use std::path::PathBuf;
+
+    use super::*;
+
+    fn fixture_path(name: &str) -> PathBuf {
+        let root_dir = &env::var("CARGO_MANIFEST_DIR").expect("$CARGO_MANIFEST_DIR");
+        let mut path = PathBuf::from(root_dir);
+        path.push("tests/fixtures");
+        path.push(name);
+        path
+    }
+
+    #[test]
+    fn sniff_signatures() {
+        assert_eq!(
+            XmpFileFormat::sniff(b"\xFF\xD8\xFF\xE1\0\0Exif"),
+            XmpFileFormat::Jpeg
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"\x89PNG\r\n\x1A\n\0\0\0\rIHDR"),
+            XmpFileFormat::Png
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"II*\0\x08\0\0\0"),
+            XmpFileFormat::Tiff
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"MM\0*\0\0\0\x08"),
+            XmpFileFormat::Tiff
+        );
+        assert_eq!(XmpFileFormat::sniff(b"GIF89a"), XmpFileFormat::Gif);
+        assert_eq!(XmpFileFormat::sniff(b"%PDF-1.7"), XmpFileFormat::Pdf);
+        assert_eq!(
+            XmpFileFormat::sniff(b"RIFF\x24\0\0\0WAVEfmt "),
+            XmpFileFormat::Wav
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"RIFF\x24\0\0\0AVI LIST"),
+            XmpFileFormat::Avi
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"FORM\0\0\0\x24AIFFCOMM"),
+            XmpFileFormat::Aiff
+        );
+    }
+
+    #[test]
+    fn sniff_ftyp_brands() {
+        assert_eq!(
+            XmpFileFormat::sniff(b"\0\0\0\x20ftypisom\0\0\x02\0"),
+            XmpFileFormat::Mpeg4
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"\0\0\0\x14ftypqt  \0\0\0\0"),
+            XmpFileFormat::Mov
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"\0\0\0\x18ftypheic\0\0\0\0"),
+            XmpFileFormat::Heif
+        );
+        assert_eq!(
+            XmpFileFormat::sniff(b"\0\0\x10\0moov\0\0\0\x6Cmvhd"),
+            XmpFileFormat::Mov
+        );
+    }
+
+    #[test]
+    fn sniff_unknown() {
+        assert_eq!(XmpFileFormat::sniff(b""), XmpFileFormat::Unknown);
+        assert_eq!(XmpFileFormat::sniff(b"\xFF\xD8"), XmpFileFormat::Unknown);
+        assert_eq!(
+            XmpFileFormat::sniff(b"hello, world"),
+            XmpFileFormat::Unknown
+        );
+
+        // A subtype at offset 8 without its container is not a match.
+        assert_eq!(
+            XmpFileFormat::sniff(b"XXXX\0\0\0\0WAVE"),
+            XmpFileFormat::Unknown
+        );
+    }
+
+    #[test]
+    fn sniff_file() {
+        let purple_square = fixture_path("Purple Square.psd");
+        assert_eq!(
+            XmpFileFormat::sniff_file(&purple_square),
+            XmpFileFormat::Photoshop
+        );
+
+        let bytes = fs::read(&purple_square).unwrap();
+        assert_eq!(XmpFileFormat::sniff(&bytes), XmpFileFormat::Photoshop);
+
+        assert_eq!(
+            XmpFileFormat::sniff_file("doesnotexist.jpg"),
+            XmpFileFormat::Unknown
+        );
+    }
+}
@@ -13,3 +13,9 @@
 
 /// The XML namespace for the XMP "basic" schema.
 pub const XMP_NS_XMP: &str = "http://ns.adobe.com/xap/1.0/";
+
+/// The XML namespace for the Dublin Core schema.
+pub const XMP_NS_DC: &str = "http://purl.org/dc/elements/1.1/";
+
+/// The XML namespace for the Adobe Photoshop custom schema.
+pub const XMP_NS_PHOTOSHOP: &str = "http://ns.adobe.com/photoshop/1.0/";
@@ -11,57 +11,433 @@
 // specific language governing permissions and limitations under
 // each license.
 
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
 use crate::ffi;
 
 /// The expanded type for a date and time.
 ///
 /// Dates and time in the serialized XMP are ISO 8601 strings.
-/// The `XmpDateTime` struct allows easy conversion with other formats.
+/// The `XmpDateTime` struct allows easy conversion with other formats,
+/// including `std::time::SystemTime` and (with the `chrono` feature)
+/// `chrono::DateTime`. The `chrono` feature needs a newer Rust than the
+/// rest of this crate; see the README.
+///
+/// This is a plain value whose layout matches the XMP Toolkit's own
+/// `XMP_DateTime` struct, so it is passed to and from the toolkit by
+/// pointer with no allocation or conversion.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
 pub struct XmpDateTime {
-    pub(crate) dt: *mut ffi::CXmpDateTime,
+    /// The year, can be negative.
+    pub year: i32,
+
+    /// The month in the range 1..12.
+    pub month: i32,
+
+    /// The day of the month in the range 1..31.
+    pub day: i32,
+
+    /// The hour in the range 0..23.
+    pub hour: i32,
+
+    /// The minute in the range 0..59.
+    pub minute: i32,
+
+    /// The second in the range 0..59.
+    pub second: i32,
+
+    /// True if the date portion (year, month, day) is meaningful.
+    pub has_date: bool,
+
+    /// True if the time portion (hour, minute, second, nanosecond)
+    /// is meaningful.
+    pub has_time: bool,
+
+    /// True if the time zone portion is meaningful.
+    pub has_time_zone: bool,
+
+    /// The "sign" of the time zone: 0 means UTC, -1 is west, +1 is east.
+    pub tz_sign: i8,
+
+    /// The time zone hour in the range 0..23.
+    pub tz_hour: i32,
+
+    /// The time zone minute in the range 0..59.
+    pub tz_minute: i32,
+
+    /// Nanoseconds within a second, often left as zero.
+    pub nanosecond: i32,
 }
 
-impl Drop for XmpDateTime {
-    fn drop(&mut self) {
+const SECONDS_PER_DAY: i64 = 86_400;
+
+impl XmpDateTime {
+    /// Creates a new date-time struct with zeros in all fields.
+    pub fn new() -> XmpDateTime {
+        XmpDateTime::default()
+    }
+
+    /// Creates a new date-time struct reflecting the current time,
+    /// in the local time zone.
+    pub fn current() -> XmpDateTime {
+        let mut dt = XmpDateTime::default();
         unsafe {
-            ffi::CXmpDateTimeDrop(self.dt);
+            ffi::CXmpDateTimeCurrent(&mut dt);
+        }
+        dt
+    }
+
+    /// Converts this date and time to a `SystemTime`.
+    ///
+    /// A value with no time portion is taken to be midnight, and a value
+    /// with no time zone is taken to be UTC.
+    ///
+    /// Returns `None` if there is no date portion, if any field is out of
+    /// range, or if the result can't be represented as a `SystemTime`.
+    pub fn to_system_time(&self) -> Option<SystemTime> {
+        let seconds = self.unix_seconds()?;
+
+        if seconds >= 0 {
+            UNIX_EPOCH.checked_add(Duration::new(seconds as u64, self.nanosecond as u32))
+        } else {
+            UNIX_EPOCH
+                .checked_sub(Duration::new((-seconds) as u64, 0))?
+                .checked_add(Duration::new(0, self.nanosecond as u32))
+        }
+    }
+
+    // Returns the whole seconds since the Unix epoch (UTC), ignoring the
+    // nanosecond field.
+    fn unix_seconds(&self) -> Option<i64> {
+        let in_range = |v: i32, max: i32| v >= 0 && v <= max;
+
+        if !self.has_date
+            || self.month < 1
+            || self.month > 12
+            || self.day < 1
+            || self.day > days_in_month(self.year as i64, self.month as i64)
+            || !in_range(self.nanosecond, 999_999_999)
+        {
+            return None;
+        }
+
+        if self.has_time
+            && !(in_range(self.hour, 23) && in_range(self.minute, 59) && in_range(self.second, 59))
+        {
+            return None;
+        }
+
+        if self.has_time_zone
+            && !(in_range(self.tz_hour, 23)
+                && in_range(self.tz_minute, 59)
+                && self.tz_sign >= -1
+                && self.tz_sign <= 1)
+        {
+            return None;
+        }
+
+        let mut seconds =
+            days_from_civil(self.year as i64, self.month as i64, self.day as i64) * SECONDS_PER_DAY;
+
+        if self.has_time {
+            seconds += self.hour as i64 * 3600 + self.minute as i64 * 60 + self.second as i64;
+        }
+
+        Some(seconds - self.utc_offset_seconds() as i64)
+    }
+
+    // Returns the offset of this value's time zone from UTC, in seconds.
+    fn utc_offset_seconds(&self) -> i32 {
+        if self.has_time_zone {
+            self.tz_sign.signum() as i32 * (self.tz_hour * 3600 + self.tz_minute * 60)
+        } else {
+            0
+        }
+    }
+
+    fn with_local_fields(seconds: i64, nanosecond: u32, offset_seconds: i32) -> XmpDateTime {
+        let local = seconds + offset_seconds as i64;
+        let (year, month, day) = civil_from_days(local.div_euclid(SECONDS_PER_DAY));
+        let time_of_day = local.rem_euclid(SECONDS_PER_DAY) as i32;
+        let offset = offset_seconds.abs();
+
+        XmpDateTime {
+            year: year as i32,
+            month: month as i32,
+            day: day as i32,
+            hour: time_of_day / 3600,
+            minute: time_of_day / 60 % 60,
+            second: time_of_day % 60,
+            nanosecond: nanosecond as i32,
+            has_date: true,
+            has_time: true,
+            has_time_zone: true,
+            tz_sign: offset_seconds.signum() as i8,
+            tz_hour: offset / 3600,
+            tz_minute: offset / 60 % 60,
         }
     }
 }
 
-impl Default for XmpDateTime {
-    fn default() -> Self {
-        XmpDateTime::new()
+impl From<SystemTime> for XmpDateTime {
+    /// Converts a `SystemTime` to a date and time in UTC.
+    fn from(t: SystemTime) -> XmpDateTime {
+        let (seconds, nanosecond) = match t.duration_since(UNIX_EPOCH) {
+            Ok(d) => (d.as_secs() as i64, d.subsec_nanos()),
+            Err(e) => {
+                let d = e.duration();
+                if d.subsec_nanos() == 0 {
+                    (-(d.as_secs() as i64), 0)
+                } else {
+                    (-(d.as_secs() as i64) - 1, 1_000_000_000 - d.subsec_nanos())
+                }
+            }
+        };
+
+        XmpDateTime::with_local_fields(seconds, nanosecond, 0)
     }
 }
 
-impl XmpDateTime {
-    /// Creates a new date-time struct with zeros in all fields.
-    pub fn new() -> XmpDateTime {
-        XmpDateTime {
-            dt: unsafe { ffi::CXmpDateTimeNew() },
+#[cfg(feature = "chrono")]
+mod chrono_support {
+    use chrono::{DateTime, FixedOffset, NaiveDate, Offset, TimeZone};
+
+    use super::XmpDateTime;
+
+    impl<Tz: TimeZone> From<DateTime<Tz>> for XmpDateTime {
+        /// Converts a `chrono::DateTime`, keeping its offset from UTC.
+        fn from(dt: DateTime<Tz>) -> XmpDateTime {
+            let offset = dt.offset().fix().local_minus_utc();
+
+            // chrono represents a leap second as nanoseconds past one
+            // billion; XMP has no way to express that.
+            let nanosecond = dt.timestamp_subsec_nanos().min(999_999_999);
+
+            XmpDateTime::with_local_fields(dt.timestamp(), nanosecond, offset)
         }
     }
 
-    /// Creates a new date-time struct reflecting the current time.
-    pub fn current() -> XmpDateTime {
-        XmpDateTime {
-            dt: unsafe { ffi::CXmpDateTimeCurrent() },
+    impl XmpDateTime {
+        /// Converts this date and time to a `chrono::DateTime`.
+        ///
+        /// Only available with the `chrono` feature. Missing time and
+        /// time zone portions are handled as in `to_system_time()`.
+        pub fn to_chrono(&self) -> Option<DateTime<FixedOffset>> {
+            if !self.has_date {
+                return None;
+            }
+
+            let date = NaiveDate::from_ymd_opt(self.year, self.month as u32, self.day as u32)?;
+            let local = if self.has_time {
+                date.and_hms_nano_opt(
+                    self.hour as u32,
+                    self.minute as u32,
+                    self.second as u32,
+                    self.nanosecond as u32,
+                )?
+            } else {
+                date.and_hms_opt(0, 0, 0)?
+            };
+
+            FixedOffset::east_opt(self.utc_offset_seconds())?
+                .from_local_datetime(&local)
+                .single()
         }
     }
 }
 
+// Civil calendar conversions for the proleptic Gregorian calendar.
+// See http://howardhinnant.github.io/date_algorithms.html.
+
+// Number of days in month `m` (1-12) of year `y` in the proleptic
+// Gregorian calendar.
+fn days_in_month(y: i64, m: i64) -> i32 {
+    match m {
+        2 if y % 4 == 0 && (y % 100 != 0 || y % 400 == 0) => 29,
+        2 => 28,
+        4 | 6 | 9 | 11 => 30,
+        _ => 31,
+    }
+}
+
+fn days_from_civil(y: i64, m: i64, d: i64) -> i64 {
+    let y = if m <= 2 { y - 1 } else { y };
+    let era = y.div_euclid(400);
+    let yoe = y - era * 400;
+    let doy = (153 * (if m > 2 { m - 3 } else { m + 9 }) + 2) / 5 + d - 1;
+    let doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    era * 146_097 + doe - 719_468
+}
+
+fn civil_from_days(z: i64) -> (i64, i64, i64) {
+    let z = z + 719_468;
+    let era = z.div_euclid(146_097);
+    let doe = z - era * 146_097;
+    let yoe = (doe - doe / 1460 + doe / 36_524 - doe / 146_096) / 365;
+    let doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    let mp = (5 * doy + 2) / 153;
+    let d = doy - (153 * mp + 2) / 5 + 1;
+    let m = if mp < 10 { mp + 3 } else { mp - 9 };
+    (
+        if m <= 2 {
+            yoe + era * 400 + 1
+        } else {
+            yoe + era * 400
+        },
+        m,
+        d,
+    )
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
 
+    #[test]
+    fn layout() {
+        // Must match XMP_DateTime; see the static_asserts in ffi.cpp.
+        let dt = XmpDateTime::new();
+        let base = &dt as *const XmpDateTime as usize;
+        let offset = |field: *const u8| field as usize - base;
+
+        assert_eq!(std::mem::size_of::<XmpDateTime>(), 40);
+        assert_eq!(offset(&dt.year as *const i32 as *const u8), 0);
+        assert_eq!(offset(&dt.month as *const i32 as *const u8), 4);
+        assert_eq!(offset(&dt.day as *const i32 as *const u8), 8);
+        assert_eq!(offset(&dt.hour as *const i32 as *const u8), 12);
+        assert_eq!(offset(&dt.minute as *const i32 as *const u8), 16);
+        assert_eq!(offset(&dt.second as *const i32 as *const u8), 20);
+        assert_eq!(offset(&dt.has_date as *const bool as *const u8), 24);
+        assert_eq!(offset(&dt.has_time as *const bool as *const u8), 25);
+        assert_eq!(offset(&dt.has_time_zone as *const bool as *const u8), 26);
+        assert_eq!(offset(&dt.tz_sign as *const i8 as *const u8), 27);
+        assert_eq!(offset(&dt.tz_hour as *const i32 as *const u8), 28);
+        assert_eq!(offset(&dt.tz_minute as *const i32 as *const u8), 32);
+        assert_eq!(offset(&dt.nanosecond as *const i32 as *const u8), 36);
+    }
+
     #[test]
     fn new_empty() {
-        let mut _dt = XmpDateTime::new();
+        let dt = XmpDateTime::new();
+        assert_eq!(dt.year, 0);
+        assert!(!dt.has_date);
+        assert!(!dt.has_time);
     }
 
     #[test]
     fn current() {
-        let mut _dt = XmpDateTime::current();
+        let dt = XmpDateTime::current();
+        assert!(dt.has_date);
+        assert!(dt.has_time);
+        assert!(dt.year >= 2020);
+        assert!(dt.month >= 1 && dt.month <= 12);
+    }
+
+    fn sample() -> XmpDateTime {
+        XmpDateTime {
+            year: 2006,
+            month: 4,
+            day: 25,
+            hour: 15,
+            minute: 32,
+            second: 1,
+            nanosecond: 500,
+            has_date: true,
+            has_time: true,
+            has_time_zone: true,
+            tz_sign: 1,
+            tz_hour: 2,
+            tz_minute: 0,
+        }
+    }
+
+    #[test]
+    fn to_system_time() {
+        // 2006-04-25T13:32:01Z
+        let t = sample().to_system_time().unwrap();
+        assert_eq!(
+            t.duration_since(UNIX_EPOCH).unwrap(),
+            Duration::new(1_145_971_921, 500)
+        );
+
+        let mut date_only = sample();
+        date_only.has_time = false;
+        date_only.has_time_zone = false;
+        let t = date_only.to_system_time().unwrap();
+        assert_eq!(
+            t.duration_since(UNIX_EPOCH).unwrap(),
+            Duration::new(1_145_923_200, 500)
+        );
+
+        assert_eq!(XmpDateTime::new().to_system_time(), None);
+
+        let mut bad = sample();
+        bad.day = 31; // April has 30 days
+        assert_eq!(bad.to_system_time(), None);
+
+        let mut bad = sample();
+        bad.hour = 24;
+        assert_eq!(bad.to_system_time(), None);
+
+        let mut bad = sample();
+        bad.tz_minute = 60;
+        assert_eq!(bad.to_system_time(), None);
+
+        let mut leap_day = sample();
+        leap_day.year = 2000;
+        leap_day.month = 2;
+        leap_day.day = 29;
+        assert!(leap_day.to_system_time().is_some());
+        leap_day.year = 1900;
+        assert_eq!(leap_day.to_system_time(), None);
+    }
+
+    #[test]
+    fn from_system_time() {
+        let dt = XmpDateTime::from(UNIX_EPOCH + Duration::new(1_145_971_921, 500));
+        assert_eq!((dt.year, dt.month, dt.day), (2006, 4, 25));
+        assert_eq!((dt.hour, dt.minute, dt.second), (13, 32, 1));
+        assert_eq!(dt.nanosecond, 500);
+        assert!(dt.has_time_zone);
+        assert_eq!(dt.tz_sign, 0);
+
+        let leap_day = XmpDateTime::from(UNIX_EPOCH + Duration::from_secs(951_782_400));
+        assert_eq!((leap_day.year, leap_day.month, leap_day.day), (2000, 2, 29));
+
+        let before_epoch = XmpDateTime::from(UNIX_EPOCH - Duration::new(0, 1));
+        assert_eq!(
+            (before_epoch.year, before_epoch.month, before_epoch.day),
+            (1969, 12, 31)
+        );
+        assert_eq!(
+            (before_epoch.hour, before_epoch.minute, before_epoch.second),
+            (23, 59, 59)
+        );
+        assert_eq!(before_epoch.nanosecond, 999_999_999);
+        assert_eq!(
+            before_epoch.to_system_time(),
+            Some(UNIX_EPOCH - Duration::new(0, 1))
+        );
+    }
+
+    #[test]
+    fn system_time_round_trip() {
+        let now = SystemTime::now();
+        assert_eq!(XmpDateTime::from(now).to_system_time(), Some(now));
+
+        let current = XmpDateTime::current();
+        let t = current.to_system_time().unwrap();
+        assert_eq!(XmpDateTime::from(t).to_system_time(), Some(t));
+    }
+
+    #[cfg(feature = "chrono")]
+    #[test]
+    fn chrono_round_trip() {
+        let dt = sample().to_chrono().unwrap();
+        assert_eq!(dt.timestamp(), 1_145_971_921);
+        assert_eq!(dt.timestamp_subsec_nanos(), 500);
+        assert_eq!(dt.offset().local_minus_utc(), 7200);
+        assert_eq!(XmpDateTime::from(dt), sample());
     }
 }
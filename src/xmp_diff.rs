@@ -0,0 +1,292 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use bitflags::bitflags;
+use std::os::raw::c_void;
+
+use crate::ffi;
+use crate::xmp_iterator::{PropertyFlags, XmpProperty};
+use crate::xmp_meta::{XmpMeta, XmpMetaError};
+
+bitflags! {
+    /// Option flags for `XmpMeta::merge()`.
+    ///
+    /// These are the XMP Toolkit's `kXMPTemplate_*` options for
+    /// `ApplyTemplate`. The metadata passed to `merge()` acts as the template.
+    pub struct MergeOptions: u32 {
+        /// Include internal properties (such as `xmp:MetadataDate`), which
+        /// are otherwise left alone.
+        const INCLUDE_INTERNAL_PROPERTIES = 0x0001;
+
+        /// Replace values of properties that appear in both.
+        const REPLACE_EXISTING_PROPERTIES = 0x0002;
+
+        /// When replacing, delete properties whose new value is empty.
+        const REPLACE_WITH_DELETE_EMPTY = 0x0004;
+
+        /// Add properties that appear only in the other metadata.
+        const ADD_NEW_PROPERTIES = 0x0008;
+
+        /// Delete properties that don't appear in the other metadata.
+        const CLEAR_UNNAMED_PROPERTIES = 0x0010;
+    }
+}
+
+/// A difference between two metadata trees, as found by `XmpMeta::diff()`.
+///
+/// Each property carries its schema namespace and full path, so it can be
+/// passed back to, for example, `XmpMeta::set_property()`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum XmpChange {
+    /// The node exists only in the other tree. If it is a struct or array,
+    /// its fields or items are not reported separately.
+    Added(XmpProperty),
+
+    /// The node exists only in this tree. If it is a struct or array,
+    /// its fields or items are not reported separately.
+    Removed(XmpProperty),
+
+    /// The node exists in both trees, but its value or form (simple value,
+    /// struct, or kind of array) differs.
+    Changed {
+        /// The node as found in this tree.
+        old: XmpProperty,
+
+        /// The node as found in the other tree.
+        new: XmpProperty,
+    },
+}
+
+pub(crate) fn diff(a: &XmpMeta, b: &XmpMeta) -> Result<Vec<XmpChange>, XmpMetaError> {
+    let mut packed: Vec<u8> = Vec::new();
+    let mut count: usize = 0;
+
+    let ok = unsafe {
+        ffi::CXmpMetaDiff(
+            a.m,
+            b.m,
+            ffi::bytes_sink,
+            &mut packed as *mut Vec<u8> as *mut c_void,
+            &mut count,
+        )
+    };
+
+    if ok == 0 {
+        return Err(XmpMetaError::CantDiff);
+    }
+
+    let mut fields = packed
+        .split(|b| *b == 0)
+        .map(|f| String::from_utf8_lossy(f).into_owned());
+
+    let mut changes = Vec::with_capacity(count);
+    for _ in 0..count {
+        let kind = fields.next().unwrap_or_default();
+        let schema_ns = fields.next().unwrap_or_default();
+        let name = fields.next().unwrap_or_default();
+
+        let mut property = || XmpProperty {
+            schema_ns: schema_ns.clone(),
+            name: name.clone(),
+            value: fields.next().unwrap_or_default(),
+            options: PropertyFlags::from_bits_truncate(
+                fields.next().and_then(|o| o.parse().ok()).unwrap_or(0),
+            ),
+        };
+
+        let old = property();
+        let new = property();
+
+        changes.push(match kind.as_str() {
+            "a" => XmpChange::Added(new),
+            "r" => XmpChange::Removed(old),
+            _ => XmpChange::Changed { old, new },
+        });
+    }
+
+    Ok(changes)
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::xmp_const::*;
+    use crate::xmp_edit::XmpEdit;
+
+    use super::*;
+
+    const PACKET: &str = r#"<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+    xmlns:dc="http://purl.org/dc/elements/1.1/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows"
+   xmp:Label="purple">
+   <dc:subject>
+    <rdf:Bag>
+     <rdf:li>purple</rdf:li>
+     <rdf:li>square</rdf:li>
+    </rdf:Bag>
+   </dc:subject>
+  </rdf:Description>
+ </rdf:RDF>
+</x:xmpmeta>"#;
+
+    fn names(changes: &[XmpChange]) -> Vec<(char, String)> {
+        changes
+            .iter()
+            .map(|c| match c {
+                XmpChange::Added(p) => ('a', p.name.clone()),
+                XmpChange::Removed(p) => ('r', p.name.clone()),
+                XmpChange::Changed { new, .. } => ('c', new.name.clone()),
+            })
+            .collect()
+    }
+
+    #[test]
+    fn no_changes() {
+        let a = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let b = a.clone();
+        assert!(a.diff(&b).unwrap().is_empty());
+    }
+
+    #[test]
+    fn changes() {
+        let a = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let mut b = a.clone();
+        b.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+        b.set_property(XMP_NS_XMP, "Rating", "3");
+        b.apply(XmpEdit::new().delete(XMP_NS_DC, "subject"))
+            .unwrap();
+
+        let changes = a.diff(&b).unwrap();
+        assert_eq!(
+            names(&changes),
+            vec![
+                ('c', "xmp:CreatorTool".to_owned()),
+                ('a', "xmp:Rating".to_owned()),
+                ('r', "dc:subject".to_owned()),
+            ]
+        );
+
+        match &changes[0] {
+            XmpChange::Changed { old, new } => {
+                assert_eq!(old.value, "Adobe Photoshop CS2 Windows");
+                assert_eq!(new.value, "xmp_toolkit");
+                assert_eq!(new.schema_ns, XMP_NS_XMP);
+            }
+            c => panic!("unexpected change {:?}", c),
+        }
+    }
+
+    #[test]
+    fn merge() {
+        let mut a = XmpMeta::new();
+        a.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+        a.set_property(XMP_NS_XMP, "Label", "keep");
+
+        let b = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+
+        a.merge(&b, MergeOptions::ADD_NEW_PROPERTIES).unwrap();
+        assert_eq!(
+            a.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "xmp_toolkit"
+        );
+        assert_eq!(a.property(XMP_NS_XMP, "Label").unwrap(), "keep");
+        assert_eq!(a.property(XMP_NS_DC, "subject[2]").unwrap(), "square");
+
+        // xmp:CreatorTool is an internal property, which is only replaced
+        // with INCLUDE_INTERNAL_PROPERTIES.
+        a.merge(
+            &b,
+            MergeOptions::ADD_NEW_PROPERTIES
+                | MergeOptions::REPLACE_EXISTING_PROPERTIES
+                | MergeOptions::INCLUDE_INTERNAL_PROPERTIES,
+        )
+        .unwrap();
+        assert!(a.diff(&b).unwrap().is_empty());
+    }
+
+    #[test]
+    fn merge_option_bits() {
+        // The values of the XMP Toolkit's kXMPTemplate_* constants.
+        assert_eq!(MergeOptions::INCLUDE_INTERNAL_PROPERTIES.bits(), 0x01);
+        assert_eq!(MergeOptions::REPLACE_EXISTING_PROPERTIES.bits(), 0x02);
+        assert_eq!(MergeOptions::REPLACE_WITH_DELETE_EMPTY.bits(), 0x04);
+        assert_eq!(MergeOptions::ADD_NEW_PROPERTIES.bits(), 0x08);
+        assert_eq!(MergeOptions::CLEAR_UNNAMED_PROPERTIES.bits(), 0x10);
+    }
+
+    // Merges `template` into a fresh copy of `base`, using `options`.
+    fn merged(base: &XmpMeta, template: &XmpMeta, options: MergeOptions) -> XmpMeta {
+        let mut m = base.clone();
+        m.merge(template, options).unwrap();
+        m
+    }
+
+    #[test]
+    fn merge_each_option() {
+        const NS: &str = "http://ns.example.com/merge/1.0/";
+        XmpMeta::register_namespace(NS, "merge").unwrap();
+
+        let mut base = XmpMeta::new();
+        base.set_property(NS, "Shared", "base");
+        base.set_property(NS, "BaseOnly", "base");
+        base.set_property(NS, "Emptied", "base");
+        base.set_property(XMP_NS_XMP, "CreatorTool", "base");
+
+        let mut template = XmpMeta::new();
+        template.set_property(NS, "Shared", "template");
+        template.set_property(NS, "TemplateOnly", "template");
+        template.set_property(NS, "Emptied", "");
+        template.set_property(XMP_NS_XMP, "CreatorTool", "template");
+
+        let value = |m: &XmpMeta, name: &str| m.property(NS, name);
+
+        // Adds what only the template has, and changes nothing else.
+        let m = merged(&base, &template, MergeOptions::ADD_NEW_PROPERTIES);
+        assert_eq!(value(&m, "TemplateOnly").unwrap(), "template");
+        assert_eq!(value(&m, "Shared").unwrap(), "base");
+        assert_eq!(value(&m, "BaseOnly").unwrap(), "base");
+        assert_eq!(value(&m, "Emptied").unwrap(), "base");
+
+        // Replaces values found in both; empty template values are skipped.
+        let m = merged(&base, &template, MergeOptions::REPLACE_EXISTING_PROPERTIES);
+        assert_eq!(value(&m, "Shared").unwrap(), "template");
+        assert_eq!(value(&m, "BaseOnly").unwrap(), "base");
+        assert_eq!(value(&m, "Emptied").unwrap(), "base");
+
+        // Also replaces, but deletes where the template value is empty.
+        let m = merged(&base, &template, MergeOptions::REPLACE_WITH_DELETE_EMPTY);
+        assert_eq!(value(&m, "Shared").unwrap(), "template");
+        assert_eq!(value(&m, "Emptied"), None);
+        assert_eq!(value(&m, "BaseOnly").unwrap(), "base");
+
+        // Deletes what the template lacks, and changes nothing else.
+        let m = merged(&base, &template, MergeOptions::CLEAR_UNNAMED_PROPERTIES);
+        assert_eq!(value(&m, "BaseOnly"), None);
+        assert_eq!(value(&m, "Shared").unwrap(), "base");
+        assert_eq!(value(&m, "TemplateOnly"), None);
+
+        // Internal properties, such as xmp:CreatorTool, are left alone
+        // unless INCLUDE_INTERNAL_PROPERTIES is given.
+        let replace = MergeOptions::REPLACE_EXISTING_PROPERTIES;
+        let m = merged(&base, &template, replace);
+        assert_eq!(m.property(XMP_NS_XMP, "CreatorTool").unwrap(), "base");
+        let m = merged(
+            &base,
+            &template,
+            replace | MergeOptions::INCLUDE_INTERNAL_PROPERTIES,
+        );
+        assert_eq!(m.property(XMP_NS_XMP, "CreatorTool").unwrap(), "template");
+    }
+}
@@ -0,0 +1,305 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::os::raw::{c_char, c_void};
+
+use crate::ffi;
+use crate::xmp_date_time::XmpDateTime;
+use crate::xmp_iterator::PropertyFlags;
+use crate::xmp_meta::{push_c_str, XmpMeta};
+
+// Edit kinds; must match the enum in ffi.cpp.
+const EDIT_SET: u8 = 0;
+const EDIT_SET_DATE: u8 = 1;
+const EDIT_DELETE: u8 = 2;
+const EDIT_APPEND: u8 = 3;
+const EDIT_SKIP: u8 = 4;
+
+// The XMP Toolkit's `kXMPErr_BadParam`.
+const BAD_PARAM: i32 = 4;
+
+/// A batch of changes to be made to an `XmpMeta` struct.
+///
+/// Writing many properties through separate `XmpMeta::set_property()`
+/// calls costs one call into the XMP Toolkit (and one round of string
+/// conversion) per property. An `XmpEdit` collects the changes in Rust
+/// instead; `XmpMeta::apply()` then makes all of them in a single call.
+///
+/// Each change is checked independently. A change with an invalid path
+/// or value is reported and skipped; it doesn't prevent the others from
+/// being made. All paths are validated before any change is made.
+///
+/// An `XmpEdit` is not tied to any particular `XmpMeta` and may be applied
+/// to any number of them.
+#[derive(Clone, Debug, Default)]
+pub struct XmpEdit {
+    kinds: Vec<u8>,
+    options: Vec<u32>,
+    packed: Vec<u8>,
+    dates: Vec<XmpDateTime>,
+}
+
+/// Describes a change in an `XmpEdit` that could not be made.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct XmpEditError {
+    /// The position of the change within the `XmpEdit`, counting from zero
+    /// in the order the changes were added.
+    pub index: usize,
+
+    /// The XMP Toolkit error code (for example, 102 for a bad XPath).
+    pub code: i32,
+
+    /// The XMP Toolkit error message.
+    pub message: String,
+}
+
+impl XmpEdit {
+    /// Creates an empty batch.
+    pub fn new() -> XmpEdit {
+        XmpEdit::default()
+    }
+
+    /// Returns the number of changes in this batch.
+    pub fn len(&self) -> usize {
+        self.kinds.len()
+    }
+
+    /// Returns `true` if this batch contains no changes.
+    pub fn is_empty(&self) -> bool {
+        self.kinds.is_empty()
+    }
+
+    /// Creates or sets a property value; see `XmpMeta::set_property()`.
+    pub fn set(&mut self, schema_ns: &str, prop_name: &str, prop_value: &str) -> &mut XmpEdit {
+        self.push(EDIT_SET, 0, schema_ns, prop_name, prop_value)
+    }
+
+    /// Creates or sets a property to an integer value.
+    pub fn set_i64(&mut self, schema_ns: &str, prop_name: &str, prop_value: i64) -> &mut XmpEdit {
+        self.set(schema_ns, prop_name, &prop_value.to_string())
+    }
+
+    /// Creates or sets a property to a floating-point value.
+    pub fn set_f64(&mut self, schema_ns: &str, prop_name: &str, prop_value: f64) -> &mut XmpEdit {
+        self.set(schema_ns, prop_name, &prop_value.to_string())
+    }
+
+    /// Creates or sets a property to a Boolean value.
+    ///
+    /// The value is written as `True` or `False`, as the XMP Toolkit does.
+    pub fn set_bool(&mut self, schema_ns: &str, prop_name: &str, prop_value: bool) -> &mut XmpEdit {
+        self.set(
+            schema_ns,
+            prop_name,
+            if prop_value { "True" } else { "False" },
+        )
+    }
+
+    /// Creates or sets a property to a date and time value;
+    /// see `XmpMeta::set_property_date()`.
+    pub fn set_date(
+        &mut self,
+        schema_ns: &str,
+        prop_name: &str,
+        prop_value: &XmpDateTime,
+    ) -> &mut XmpEdit {
+        self.push(EDIT_SET_DATE, 0, schema_ns, prop_name, "");
+        if self.kinds.last() == Some(&EDIT_SET_DATE) {
+            self.dates.push(*prop_value);
+        }
+        self
+    }
+
+    /// Deletes a property, if it exists.
+    pub fn delete(&mut self, schema_ns: &str, prop_name: &str) -> &mut XmpEdit {
+        self.push(EDIT_DELETE, 0, schema_ns, prop_name, "")
+    }
+
+    /// Appends an item to the end of an array.
+    ///
+    /// If the array doesn't exist, it is created as described by
+    /// `array_options`, which is combined with `PropertyFlags::VALUE_IS_ARRAY`.
+    /// Pass `PropertyFlags::empty()` for an unordered array (`rdf:Bag`), or
+    /// add `PropertyFlags::ARRAY_IS_ORDERED` for an ordered one (`rdf:Seq`).
+    pub fn append(
+        &mut self,
+        schema_ns: &str,
+        array_name: &str,
+        array_options: PropertyFlags,
+        item_value: &str,
+    ) -> &mut XmpEdit {
+        let options = array_options | PropertyFlags::VALUE_IS_ARRAY;
+        self.push(
+            EDIT_APPEND,
+            options.bits(),
+            schema_ns,
+            array_name,
+            item_value,
+        )
+    }
+
+    fn push(
+        &mut self,
+        kind: u8,
+        options: u32,
+        schema_ns: &str,
+        prop_name: &str,
+        prop_value: &str,
+    ) -> &mut XmpEdit {
+        // Strings with interior NULs can't be sent to C++. Rather than
+        // panic, record a placeholder that `apply_to()` reports as an error.
+        let has_nul = |s: &str| s.as_bytes().contains(&0);
+
+        if has_nul(schema_ns) || has_nul(prop_name) || has_nul(prop_value) {
+            self.kinds.push(EDIT_SKIP);
+            self.packed.extend_from_slice(&[0, 0, 0]);
+        } else {
+            self.kinds.push(kind);
+            push_c_str(&mut self.packed, schema_ns);
+            push_c_str(&mut self.packed, prop_name);
+            push_c_str(&mut self.packed, prop_value);
+        }
+
+        self.options.push(options);
+        self
+    }
+
+    pub(crate) fn apply_to(&self, m: &mut XmpMeta) -> Result<(), Vec<XmpEditError>> {
+        let mut results: Vec<i32> = vec![0; self.len()];
+        let mut messages: Vec<u8> = Vec::new();
+
+        let failures = unsafe {
+            ffi::CXmpMetaApplyEdits(
+                m.m,
+                self.len(),
+                self.kinds.as_ptr(),
+                self.options.as_ptr(),
+                self.packed.as_ptr() as *const c_char,
+                self.dates.as_ptr(),
+                results.as_mut_ptr(),
+                ffi::bytes_sink,
+                &mut messages as *mut Vec<u8> as *mut c_void,
+            )
+        };
+
+        if failures == 0 && !self.kinds.contains(&EDIT_SKIP) {
+            return Ok(());
+        }
+
+        let mut messages = messages
+            .split(|b| *b == 0)
+            .map(|m| String::from_utf8_lossy(m).into_owned());
+
+        let errors: Vec<XmpEditError> = results
+            .iter()
+            .zip(self.kinds.iter())
+            .enumerate()
+            .filter_map(|(index, (code, kind))| {
+                if *kind == EDIT_SKIP {
+                    Some(XmpEditError {
+                        index,
+                        code: BAD_PARAM,
+                        message: "string contains an interior NUL byte".to_owned(),
+                    })
+                } else if *code != 0 {
+                    Some(XmpEditError {
+                        index,
+                        code: *code,
+                        message: messages.next().unwrap_or_default(),
+                    })
+                } else {
+                    None
+                }
+            })
+            .collect();
+
+        if errors.is_empty() {
+            Ok(())
+        } else {
+            Err(errors)
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    #[test]
+    fn apply_all() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "Label", "obsolete");
+
+        let created = XmpDateTime::current();
+
+        let mut edit = XmpEdit::new();
+        edit.set(XMP_NS_XMP, "CreatorTool", "xmp_toolkit")
+            .set_i64(XMP_NS_XMP, "Rating", 4)
+            .set_bool(XMP_NS_XMP, "Flag", true)
+            .set_f64(XMP_NS_XMP, "Ratio", -0.5)
+            .set_date(XMP_NS_XMP, "CreateDate", &created)
+            .delete(XMP_NS_XMP, "Label")
+            .append(XMP_NS_DC, "subject", PropertyFlags::empty(), "purple")
+            .append(XMP_NS_DC, "subject", PropertyFlags::empty(), "square");
+        assert_eq!(edit.len(), 8);
+
+        m.apply(&edit).unwrap();
+
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "xmp_toolkit"
+        );
+        assert_eq!(m.property_i64(XMP_NS_XMP, "Rating"), Some(4));
+        assert_eq!(m.property_bool(XMP_NS_XMP, "Flag"), Some(true));
+        assert_eq!(m.property_f64(XMP_NS_XMP, "Ratio"), Some(-0.5));
+        assert_eq!(
+            m.property_date(XMP_NS_XMP, "CreateDate").unwrap().year,
+            created.year
+        );
+        assert!(!m.does_property_exist(XMP_NS_XMP, "Label"));
+        assert_eq!(m.property(XMP_NS_DC, "subject[2]").unwrap(), "square");
+    }
+
+    #[test]
+    fn per_item_errors() {
+        let mut m = XmpMeta::new();
+
+        let mut edit = XmpEdit::new();
+        edit.set(XMP_NS_XMP, "CreatorTool", "xmp_toolkit")
+            .set("http://ns.example.com/unregistered/", "foo", "bar")
+            .set(XMP_NS_XMP, "Bad[", "bar")
+            .set(XMP_NS_XMP, "Nul", "a\0b")
+            .set(XMP_NS_XMP, "Label", "ok");
+
+        let errors = m.apply(&edit).unwrap_err();
+        let indexes: Vec<usize> = errors.iter().map(|e| e.index).collect();
+        assert_eq!(indexes, vec![1, 2, 3]);
+        assert!(errors.iter().all(|e| e.code != 0 && !e.message.is_empty()));
+
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "xmp_toolkit"
+        );
+        assert_eq!(m.property(XMP_NS_XMP, "Label").unwrap(), "ok");
+    }
+
+    #[test]
+    fn empty_edit() {
+        let mut m = XmpMeta::new();
+        let edit = XmpEdit::new();
+        assert!(edit.is_empty());
+        m.apply(&edit).unwrap();
+    }
+}
@@ -13,9 +13,14 @@
 
 use bitflags::bitflags;
 use std::ffi::CString;
+use std::os::raw::{c_char, c_int, c_void};
+use std::panic::{self, AssertUnwindSafe};
 use std::path::Path;
+use std::slice;
+use std::time::Duration;
 
 use crate::ffi;
+use crate::metrics::{self, Phase};
 use crate::xmp_meta::XmpMeta;
 
 bitflags! {
@@ -55,6 +60,248 @@ bitflags! {
     }
 }
 
+bitflags! {
+    /// Option flags for `XmpFile::close_with()`.
+    pub struct CloseOptions: u32 {
+        /// Write into a temporary file and swap it for the original when
+        /// done, so that the original survives a failure part way through.
+        /// This costs a full copy of the file. Without this flag, the file
+        /// is updated directly, which for many formats writes only the
+        /// changed parts.
+        const UPDATE_SAFELY = 0x0001;
+    }
+}
+
+/// Describes the kind of update `XmpFile::close_with()` was asked to make.
+///
+/// This reflects the `CloseOptions` and whether there was new XMP to write.
+/// How the update is carried out is up to the file handler; a direct update
+/// may overwrite just the packet or rewrite much of the file.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum CloseStrategy {
+    /// Nothing was written: the file was opened for read-only access,
+    /// or no new XMP was supplied.
+    NoUpdate,
+
+    /// The file was to be updated directly.
+    Direct,
+
+    /// The file was to be written to a temporary copy that then replaces
+    /// the original (`CloseOptions::UPDATE_SAFELY`).
+    Safe,
+}
+
+/// The result of `XmpFile::close_with()`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct CloseReport {
+    /// The kind of update that was requested.
+    pub requested: CloseStrategy,
+
+    /// The number of bytes written, as counted while they were written.
+    ///
+    /// Only files opened with `open_from_bytes()` are counted. This is
+    /// `None` for files on disk, whose I/O is done entirely within the
+    /// file handler.
+    pub bytes_written: Option<u64>,
+
+    /// For files on disk, the number of bytes that the update is expected
+    /// to have written, based on how it was requested rather than measured:
+    /// the size of the new file for a safe update, the size of the packet
+    /// after `put_xmp_in_place()`, 0 if nothing was to be written, and
+    /// `None` for other direct updates. Always `None` for files opened with
+    /// `open_from_bytes()`; see `bytes_written`.
+    pub estimated_bytes_written: Option<u64>,
+}
+
+/// Identifies a file format.
+///
+/// Passing the format to `XmpFile::open_file()` (and related functions) when it
+/// is already known lets the XMP Toolkit try that format's handler first, rather
+/// than probing the file with each handler in turn. Combine it with
+/// `OpenFileOptions::OPEN_STRICTLY` to use only that handler, or with
+/// `OpenFileOptions::FORCE_GIVEN_HANDLER` to skip verifying the format entirely.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+#[repr(u32)]
+pub enum XmpFileFormat {
+    /// Public file format: PDF.
+    Pdf = u32::from_be_bytes(*b"PDF "),
+    /// Public file format: PostScript.
+    PostScript = u32::from_be_bytes(*b"PS  "),
+    /// Public file format: Encapsulated PostScript.
+    Eps = u32::from_be_bytes(*b"EPS "),
+
+    /// Public file format: JPEG.
+    Jpeg = u32::from_be_bytes(*b"JPEG"),
+    /// Public file format: JPEG 2000.
+    Jpeg2K = u32::from_be_bytes(*b"JPX "),
+    /// Public file format: TIFF.
+    Tiff = u32::from_be_bytes(*b"TIFF"),
+    /// Public file format: GIF.
+    Gif = u32::from_be_bytes(*b"GIF "),
+    /// Public file format: PNG.
+    Png = u32::from_be_bytes(*b"PNG "),
+
+    /// Public file format: Flash SWF.
+    Swf = u32::from_be_bytes(*b"SWF "),
+    /// Public file format: Flash FLA.
+    Fla = u32::from_be_bytes(*b"FLA "),
+    /// Public file format: Flash FLV.
+    Flv = u32::from_be_bytes(*b"FLV "),
+
+    /// Public file format: QuickTime.
+    Mov = u32::from_be_bytes(*b"MOV "),
+    /// Public file format: AVI.
+    Avi = u32::from_be_bytes(*b"AVI "),
+    /// Public file format: Cineon.
+    Cin = u32::from_be_bytes(*b"CIN "),
+    /// Public file format: WAV.
+    Wav = u32::from_be_bytes(*b"WAV "),
+    /// Public file format: MP3.
+    Mp3 = u32::from_be_bytes(*b"MP3 "),
+    /// Public file format: Audition session.
+    Ses = u32::from_be_bytes(*b"SES "),
+    /// Public file format: Audition loop.
+    Cel = u32::from_be_bytes(*b"CEL "),
+    /// Public file format: MPEG.
+    Mpeg = u32::from_be_bytes(*b"MPEG"),
+    /// Public file format: MPEG-2.
+    Mpeg2 = u32::from_be_bytes(*b"MP2 "),
+    /// Public file format: MPEG-4, allows only ISO base media compliant files.
+    Mpeg4 = u32::from_be_bytes(*b"MP4 "),
+    /// Public file format: MXF.
+    Mxf = u32::from_be_bytes(*b"MXF "),
+    /// Public file format: WMAV (Windows Media Audio and Video).
+    WindowsMedia = u32::from_be_bytes(*b"WMAV"),
+    /// Public file format: AIFF.
+    Aiff = u32::from_be_bytes(*b"AIFF"),
+    /// Public file format: RED.
+    Red = u32::from_be_bytes(*b"R3D "),
+    /// Public file format: ARRI.
+    Arri = u32::from_be_bytes(*b"ARRI"),
+    /// Public file format: HEIF.
+    Heif = u32::from_be_bytes(*b"HEIF"),
+    /// Public file format: P2 (a collection, not really a single file).
+    P2 = u32::from_be_bytes(*b"P2  "),
+    /// Public file format: XDCAM FAM (a collection, not really a single file).
+    XdcamFam = u32::from_be_bytes(*b"XDCF"),
+    /// Public file format: XDCAM SAM (a collection, not really a single file).
+    XdcamSam = u32::from_be_bytes(*b"XDCS"),
+    /// Public file format: XDCAM EX (a collection, not really a single file).
+    XdcamEx = u32::from_be_bytes(*b"XDCX"),
+    /// Public file format: AVCHD (a collection, not really a single file).
+    Avchd = u32::from_be_bytes(*b"AVHD"),
+    /// Public file format: Sony HDV (a collection, not really a single file).
+    SonyHdv = u32::from_be_bytes(*b"SHDV"),
+    /// Public file format: Canon XF (a collection, not really a single file).
+    CanonXf = u32::from_be_bytes(*b"CNXF"),
+    /// Public file format: AVC-Ultra (a collection, not really a single file).
+    AvcUltra = u32::from_be_bytes(*b"AVCU"),
+
+    /// Public file format: HTML.
+    Html = u32::from_be_bytes(*b"HTML"),
+    /// Public file format: XML.
+    Xml = u32::from_be_bytes(*b"XML "),
+    /// Public file format: plain text.
+    Text = u32::from_be_bytes(*b"text"),
+    /// Public file format: SVG.
+    Svg = u32::from_be_bytes(*b"SVG "),
+
+    /// Adobe application file format: Photoshop.
+    Photoshop = u32::from_be_bytes(*b"PSD "),
+    /// Adobe application file format: Illustrator.
+    Illustrator = u32::from_be_bytes(*b"AI  "),
+    /// Adobe application file format: InDesign.
+    InDesign = u32::from_be_bytes(*b"INDD"),
+    /// Adobe application file format: After Effects project.
+    AeProject = u32::from_be_bytes(*b"AEP "),
+    /// Adobe application file format: After Effects project template.
+    AeProjectTemplate = u32::from_be_bytes(*b"AET "),
+    /// Adobe application file format: After Effects filter preset.
+    AeFilterPreset = u32::from_be_bytes(*b"FFX "),
+    /// Adobe application file format: Encore project.
+    EncoreProject = u32::from_be_bytes(*b"NCOR"),
+    /// Adobe application file format: Premiere project.
+    PremiereProject = u32::from_be_bytes(*b"PRPJ"),
+    /// Adobe application file format: Premiere title.
+    PremiereTitle = u32::from_be_bytes(*b"PRTL"),
+    /// Adobe application file format: Universal Container Format.
+    Ucf = u32::from_be_bytes(*b"UCF "),
+
+    /// Unknown file format. The XMP Toolkit will determine the format
+    /// by examining the file.
+    Unknown = u32::from_be_bytes(*b"    "),
+}
+
+impl Default for XmpFileFormat {
+    fn default() -> Self {
+        XmpFileFormat::Unknown
+    }
+}
+
+impl XmpFileFormat {
+    const ALL: &'static [XmpFileFormat] = &[
+        XmpFileFormat::Pdf,
+        XmpFileFormat::PostScript,
+        XmpFileFormat::Eps,
+        XmpFileFormat::Jpeg,
+        XmpFileFormat::Jpeg2K,
+        XmpFileFormat::Tiff,
+        XmpFileFormat::Gif,
+        XmpFileFormat::Png,
+        XmpFileFormat::Swf,
+        XmpFileFormat::Fla,
+        XmpFileFormat::Flv,
+        XmpFileFormat::Mov,
+        XmpFileFormat::Avi,
+        XmpFileFormat::Cin,
+        XmpFileFormat::Wav,
+        XmpFileFormat::Mp3,
+        XmpFileFormat::Ses,
+        XmpFileFormat::Cel,
+        XmpFileFormat::Mpeg,
+        XmpFileFormat::Mpeg2,
+        XmpFileFormat::Mpeg4,
+        XmpFileFormat::Mxf,
+        XmpFileFormat::WindowsMedia,
+        XmpFileFormat::Aiff,
+        XmpFileFormat::Red,
+        XmpFileFormat::Arri,
+        XmpFileFormat::Heif,
+        XmpFileFormat::P2,
+        XmpFileFormat::XdcamFam,
+        XmpFileFormat::XdcamSam,
+        XmpFileFormat::XdcamEx,
+        XmpFileFormat::Avchd,
+        XmpFileFormat::SonyHdv,
+        XmpFileFormat::CanonXf,
+        XmpFileFormat::AvcUltra,
+        XmpFileFormat::Html,
+        XmpFileFormat::Xml,
+        XmpFileFormat::Text,
+        XmpFileFormat::Svg,
+        XmpFileFormat::Photoshop,
+        XmpFileFormat::Illustrator,
+        XmpFileFormat::InDesign,
+        XmpFileFormat::AeProject,
+        XmpFileFormat::AeProjectTemplate,
+        XmpFileFormat::AeFilterPreset,
+        XmpFileFormat::EncoreProject,
+        XmpFileFormat::PremiereProject,
+        XmpFileFormat::PremiereTitle,
+        XmpFileFormat::Ucf,
+    ];
+
+    // Converts a format code returned by the XMP Toolkit. Codes that
+    // aren't listed in this enum map to `Unknown`.
+    pub(crate) fn from_u32(code: u32) -> XmpFileFormat {
+        XmpFileFormat::ALL
+            .iter()
+            .copied()
+            .find(|f| *f as u32 == code)
+            .unwrap_or(XmpFileFormat::Unknown)
+    }
+}
+
 /// The `XmpFile` struct allows access to the main (document-level) metadata in a file.
 ///
 /// This provides convenient access to the main, or document level, XMP for a file. Use
@@ -68,14 +315,103 @@ bitflags! {
 ///
 /// A file can be opened for read-only or read-write access, with typical exclusion for both
 /// modes.
+///
+/// ## Thread safety
+///
+/// `XmpFile` is `Send`, so it may be created on one thread and used on another
+/// (for example, handed to a pool of blocking worker threads). It is not `Sync`:
+/// all of its operations change the state of the open file and require
+/// `&mut XmpFile`, except for `can_put_xmp()` and `bytes()`, which must still not
+/// run concurrently with other operations on the same file.
 pub struct XmpFile {
     f: *mut ffi::CXmpFile,
+
+    // Declared after `f`, so that the C++ object (which holds a pointer to
+    // this) is dropped first.
+    progress: Option<Box<ProgressState>>,
+}
+
+/// A progress report passed to the callback set by
+/// `XmpFile::set_progress_callback()`.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Progress {
+    /// The time since the operation started.
+    pub elapsed: Duration,
+
+    /// The fraction of the work done so far, from 0.0 to 1.0, if the file
+    /// handler can estimate it.
+    pub fraction_done: Option<f32>,
+
+    /// The estimated time until the operation finishes, if the file handler
+    /// can estimate it.
+    pub remaining: Option<Duration>,
+}
+
+struct ProgressState {
+    callback: Box<dyn FnMut(&Progress) -> bool + Send>,
+    aborted: bool,
+}
+
+extern "C" fn progress_trampoline(
+    context: *mut c_void,
+    elapsed_time: f32,
+    fraction_done: f32,
+    seconds_to_go: f32,
+) -> c_int {
+    let state = unsafe { &mut *(context as *mut ProgressState) };
+
+    // Clamp to a range `Duration` can represent (NaN and negative values
+    // become zero).
+    let to_duration = |seconds: f32| {
+        if seconds > 0.0 {
+            Duration::from_secs_f32(seconds.min(1.0e9))
+        } else {
+            Duration::from_secs(0)
+        }
+    };
+    let progress = Progress {
+        elapsed: to_duration(elapsed_time),
+        fraction_done: if fraction_done > 0.0 {
+            Some(fraction_done.min(1.0))
+        } else {
+            None
+        },
+        remaining: if seconds_to_go > 0.0 {
+            Some(to_duration(seconds_to_go))
+        } else {
+            None
+        },
+    };
+
+    // A panic must not unwind into C++; treat it as a request to abort.
+    let proceed =
+        panic::catch_unwind(AssertUnwindSafe(|| (state.callback)(&progress))).unwrap_or(false);
+
+    if !proceed {
+        state.aborted = true;
+    }
+
+    proceed as c_int
 }
 
+// The underlying SXMPFiles object is not tied to the thread that created it.
+unsafe impl Send for XmpFile {}
+
 /// Describes the potential error conditions that might arise from `XmpFile` operations.
 #[derive(Debug)]
 pub enum XmpFileError {
     CantOpenFile,
+
+    /// The new XMP can't be written without moving other data in the file;
+    /// see `XmpFile::put_xmp_in_place()`.
+    CantUpdateInPlace,
+
+    /// The file could not be written when it was closed.
+    CantWriteFile,
+
+    /// The operation was stopped by the progress callback;
+    /// see `XmpFile::set_progress_callback()`.
+    Aborted,
 }
 
 impl Drop for XmpFile {
@@ -97,6 +433,7 @@ impl XmpFile {
     pub fn new() -> XmpFile {
         XmpFile {
             f: unsafe { ffi::CXmpFileNew() },
+            progress: None,
         }
     }
 
@@ -123,41 +460,223 @@ impl XmpFile {
     ///
     /// * `path`: The path for the file.
     ///
+    /// * `format`: The format of the file, if known. The handler for this format is
+    /// tried first, which avoids probing the file with each handler in turn. Pass
+    /// `XmpFileFormat::Unknown` to let the toolkit determine the format; it then
+    /// tries the handler suggested by the file's extension first. For files with
+    /// missing or misleading extensions, `XmpFileFormat::sniff_file()` provides a
+    /// cheap hint from the first few bytes of the file.
+    ///
     /// * `flags`: A set of option flags that describe the desired access. By default (zero)
     /// the file is opened for read-only access and the format handler decides on the level of
     /// reconciliation that will be performed. See `OpenFileOptions`.
     pub fn open_file<P: AsRef<Path>>(
         &mut self,
         path: P,
+        format: XmpFileFormat,
         flags: OpenFileOptions,
     ) -> Result<(), XmpFileError> {
+        let _t = metrics::time(Phase::Open);
+        self.clear_aborted();
+
         match path_to_cstr(path.as_ref()) {
             Some(c_path) => {
-                let ok = unsafe { ffi::CXmpFileOpen(self.f, c_path.as_ptr(), flags.bits()) };
+                let ok = unsafe {
+                    ffi::CXmpFileOpen(self.f, c_path.as_ptr(), format as u32, flags.bits())
+                };
                 if ok != 0 {
                     Ok(())
                 } else {
-                    Err(XmpFileError::CantOpenFile)
+                    Err(self.failure(XmpFileError::CantOpenFile))
                 }
             }
             None => Err(XmpFileError::CantOpenFile),
         }
     }
 
-    /// Retrieves the XMP metadata from an open file.
+    /// Opens an in-memory file image for the requested forms of metadata access.
     ///
-    /// If no XMP is present, will return `None`.
-    pub fn xmp(&mut self) -> Option<XmpMeta> {
+    /// This behaves like `open_file()`, but reads the file from `data` rather
+    /// than from the file system. Use it when the file's contents are already
+    /// in memory (for example, after receiving them over the network), to avoid
+    /// writing them to a temporary file only so the toolkit can read them again.
+    ///
+    /// The contents of `data` are copied into a buffer owned by this struct, so
+    /// `data` need not outlive the open file.
+    ///
+    /// If the file is opened for update (passing `OpenFileOptions::OPEN_FOR_UPDATE`),
+    /// the modified file image can be retrieved via `bytes()` after calling `close()`.
+    ///
+    /// Handlers that need a file path (for example, folder-based video formats or
+    /// formats that use a sidecar file) can not be used with in-memory files.
+    ///
+    /// ## Arguments
+    ///
+    /// * `data`: The complete contents of the file.
+    ///
+    /// * `format`: The format of the file, if known. See `open_file()`. An in-memory
+    /// file has no name from which to guess the format, so if `XmpFileFormat::Unknown`
+    /// is passed, the format is sniffed from the leading bytes of `data`
+    /// (see `XmpFileFormat::sniff()`) and used as a hint.
+    ///
+    /// * `flags`: A set of option flags that describe the desired access.
+    /// See `open_file()`.
+    pub fn open_from_bytes(
+        &mut self,
+        data: &[u8],
+        format: XmpFileFormat,
+        flags: OpenFileOptions,
+    ) -> Result<(), XmpFileError> {
+        let _t = metrics::time(Phase::Open);
+        self.clear_aborted();
+
+        let format = match format {
+            XmpFileFormat::Unknown => XmpFileFormat::sniff(data),
+            _ => format,
+        };
+
+        let ok = unsafe {
+            ffi::CXmpFileOpenFromBytes(
+                self.f,
+                data.as_ptr() as *const c_char,
+                data.len(),
+                format as u32,
+                flags.bits(),
+            )
+        };
+        self.report_io();
+
+        if ok != 0 {
+            Ok(())
+        } else {
+            Err(self.failure(XmpFileError::CantOpenFile))
+        }
+    }
+
+    /// Opens a file for read-only metadata access through a memory-mapped view.
+    ///
+    /// This behaves like `open_file()` with `OpenFileOptions::OPEN_FOR_READ`, but the
+    /// file handler's seeks and reads are served from a mapped view of the file rather
+    /// than by individual read calls. This can be considerably faster for large media
+    /// files (MPEG-4, AVI, WAV, and similar), whose handlers walk many small boxes or
+    /// chunks, especially on network storage.
+    ///
+    /// Mapped files can only be opened for read-only access; passing
+    /// `OpenFileOptions::OPEN_FOR_UPDATE` returns an error. As with `open_from_bytes()`,
+    /// handlers that need a file path can not be used.
+    ///
+    /// The file must not be truncated by another process while it is open.
+    ///
+    /// ## Arguments
+    ///
+    /// * `path`: The path for the file.
+    ///
+    /// * `format`: The format of the file, if known. See `open_file()`. As with
+    /// `open_from_bytes()`, if `XmpFileFormat::Unknown` is passed, the format is
+    /// sniffed from the first few bytes of the file and used as a hint.
+    ///
+    /// * `flags`: A set of option flags that describe the desired access.
+    /// See `open_file()`.
+    pub fn open_file_mapped<P: AsRef<Path>>(
+        &mut self,
+        path: P,
+        format: XmpFileFormat,
+        flags: OpenFileOptions,
+    ) -> Result<(), XmpFileError> {
+        let _t = metrics::time(Phase::Open);
+        self.clear_aborted();
+
+        let format = match format {
+            XmpFileFormat::Unknown => XmpFileFormat::sniff_file(path.as_ref()),
+            _ => format,
+        };
+
+        match path_to_cstr(path.as_ref()) {
+            Some(c_path) => {
+                let ok = unsafe {
+                    ffi::CXmpFileOpenMapped(self.f, c_path.as_ptr(), format as u32, flags.bits())
+                };
+                self.report_io();
+                if ok != 0 {
+                    Ok(())
+                } else {
+                    Err(self.failure(XmpFileError::CantOpenFile))
+                }
+            }
+            None => Err(XmpFileError::CantOpenFile),
+        }
+    }
+
+    /// Determines the format of a file without opening it for metadata access.
+    ///
+    /// The result can be passed to `open_file()` (typically with
+    /// `OpenFileOptions::OPEN_STRICTLY`) when the same file is opened
+    /// repeatedly, so that the handler probing is done only once.
+    ///
+    /// Returns `XmpFileFormat::Unknown` if no handler recognizes the file
+    /// or the file can not be read.
+    pub fn check_file_format<P: AsRef<Path>>(path: P) -> XmpFileFormat {
+        match path_to_cstr(path.as_ref()) {
+            Some(c_path) => {
+                let code = unsafe { ffi::CXmpFileCheckFileFormat(c_path.as_ptr()) };
+                XmpFileFormat::from_u32(code)
+            }
+            None => XmpFileFormat::Unknown,
+        }
+    }
+
+    /// Returns the current contents of a file opened with `open_from_bytes()`.
+    ///
+    /// For a file opened for update, call this after `close()` to obtain the
+    /// file image with the updated metadata.
+    ///
+    /// Returns `None` if this struct was not opened with `open_from_bytes()`.
+    pub fn bytes(&self) -> Option<Vec<u8>> {
+        let mut length: usize = 0;
+
         unsafe {
-            let m = ffi::CXmpFileGetXmp(self.f);
-            if m.is_null() {
+            let data = ffi::CXmpFileGetBytes(self.f, &mut length);
+            if data.is_null() {
                 None
             } else {
-                Some(XmpMeta { m })
+                Some(slice::from_raw_parts(data as *const u8, length).to_vec())
             }
         }
     }
 
+    /// Retrieves the XMP metadata from an open file.
+    ///
+    /// If no XMP is present, will return `None`.
+    pub fn xmp(&mut self) -> Option<XmpMeta> {
+        let _t = metrics::time(Phase::GetXmp);
+
+        let m = unsafe { ffi::CXmpFileGetXmp(self.f) };
+        self.report_io();
+
+        if m.is_null() {
+            None
+        } else {
+            Some(XmpMeta { m })
+        }
+    }
+
+    /// Retrieves the XMP metadata from an open file into an existing
+    /// `XmpMeta`, replacing its contents.
+    ///
+    /// This is equivalent to `xmp()`, but fills `meta` instead of creating
+    /// a new metadata object. When reading many files in a loop, reusing
+    /// the same `XmpMeta` avoids creating one per file.
+    ///
+    /// Returns `true` if XMP is present. Otherwise, `meta` is left unchanged.
+    pub fn xmp_into(&mut self, meta: &mut XmpMeta) -> bool {
+        let _t = metrics::time(Phase::GetXmp);
+
+        let r = unsafe { ffi::CXmpFileGetXmpInto(self.f, meta.m) };
+        self.report_io();
+
+        r != 0
+    }
+
     /// Reports whether this file can be updated with a specific XMP packet.
     ///
     /// Use this functino to determine if the file can probably be updated with a
@@ -177,7 +696,60 @@ impl XmpFile {
     /// the struct is closed with `close()`. The options provided when the file was opened
     /// determine if reconciliation is done with other forms of metadata.
     pub fn put_xmp(&mut self, meta: &XmpMeta) {
+        let _t = metrics::time(Phase::PutXmp);
+
         unsafe { ffi::CXmpFilePutXmp(self.f, meta.m) };
+        self.report_io();
+    }
+
+    /// Reports whether this file can be updated with a specific XMP packet
+    /// without rewriting any of the rest of the file.
+    ///
+    /// This is true if the file was opened for update, the handler knows
+    /// where the existing packet is, and `meta` can be serialized to
+    /// exactly the size of that packet (using up some or all of its
+    /// padding).
+    ///
+    /// Whether the handler then overwrites the old packet is decided by the
+    /// handler when the file is closed, and the XMP Toolkit's handler flags
+    /// don't describe it, so it can't be checked here. A handler that also
+    /// keeps legacy metadata (such as Exif or IPTC) in sync with the XMP may
+    /// still rewrite the file if the new XMP changes that metadata. For a
+    /// file opened with `open_from_bytes()`, `CloseReport::bytes_written`
+    /// shows how much was actually written.
+    ///
+    /// Like `can_put_xmp()`, this does not modify the file.
+    pub fn can_update_in_place(&self, meta: &XmpMeta) -> bool {
+        let r = unsafe { ffi::CXmpFileCanUpdateInPlace(self.f, meta.m) };
+        r != 0
+    }
+
+    /// Updates the XMP metadata in this object, but only if the new XMP
+    /// fits in the space of the existing packet.
+    ///
+    /// This behaves like `put_xmp()`, but first checks that the new XMP
+    /// fits; see `can_update_in_place()`. For a large file whose handler
+    /// then overwrites the old packet, that turns what may otherwise be a
+    /// rewrite of the entire file into a write of a few kilobytes. The
+    /// handler serializes the XMP again when the file is closed, so the
+    /// in-place write relies on its own policy of reusing the existing
+    /// packet when the new XMP fits.
+    ///
+    /// Returns `XmpFileError::CantUpdateInPlace`, and leaves the pending XMP
+    /// unchanged, if that isn't possible. `close_with()` also refuses to
+    /// write XMP supplied this way with `CloseOptions::UPDATE_SAFELY`,
+    /// which would copy the whole file.
+    pub fn put_xmp_in_place(&mut self, meta: &XmpMeta) -> Result<(), XmpFileError> {
+        let _t = metrics::time(Phase::PutXmp);
+
+        let r = unsafe { ffi::CXmpFilePutXmpInPlace(self.f, meta.m) };
+        self.report_io();
+
+        if r != 0 {
+            Ok(())
+        } else {
+            Err(XmpFileError::CantUpdateInPlace)
+        }
     }
 
     /// Explicitly closes an opened file.
@@ -195,8 +767,160 @@ impl XmpFile {
     /// If the file is opened for update (passing `OpenFileOptions::OPEN_FOR_UPDATE`),
     /// the disk file remains open until `close()` is called. The disk file is only updated
     /// once, when `close()` is called, regardless of how many calls are made to `put_xmp()`.
+    ///
+    /// After `close()`, the same struct can be used to open another file. When processing
+    /// many files one after another, reusing one `XmpFile` this way is cheaper than creating
+    /// a new one for each file.
     pub fn close(&mut self) {
+        let _t = metrics::time(Phase::Close);
+
         unsafe { ffi::CXmpFileClose(self.f) };
+        self.report_io();
+    }
+
+    /// Closes an opened file, choosing how it is written.
+    ///
+    /// This behaves like `close()`, but takes `CloseOptions` and reports
+    /// how the file was written. Use `CloseOptions::UPDATE_SAFELY` where
+    /// protection against a torn write matters more than the cost of
+    /// copying the whole file; otherwise, a direct update writes far less.
+    ///
+    /// Returns `XmpFileError::CantWriteFile` if the update fails, in which
+    /// case the file is still closed. Returns
+    /// `XmpFileError::CantUpdateInPlace`, without writing or closing the file,
+    /// if the XMP was supplied by `put_xmp_in_place()` and `options` includes
+    /// `CloseOptions::UPDATE_SAFELY`.
+    pub fn close_with(&mut self, options: CloseOptions) -> Result<CloseReport, XmpFileError> {
+        let _t = metrics::time(Phase::Close);
+        self.clear_aborted();
+
+        let mut strategy: u32 = 0;
+        let mut bytes_written: i64 = -1;
+        let mut estimated_bytes_written: i64 = -1;
+
+        let ok = unsafe {
+            ffi::CXmpFileCloseWith(
+                self.f,
+                options.bits(),
+                &mut strategy,
+                &mut bytes_written,
+                &mut estimated_bytes_written,
+            )
+        };
+        self.report_io();
+
+        if ok < 0 {
+            return Err(XmpFileError::CantUpdateInPlace);
+        }
+        if ok == 0 {
+            return Err(self.failure(XmpFileError::CantWriteFile));
+        }
+
+        let known = |n: i64| if n >= 0 { Some(n as u64) } else { None };
+
+        Ok(CloseReport {
+            requested: match strategy {
+                1 => CloseStrategy::Direct,
+                2 => CloseStrategy::Safe,
+                _ => CloseStrategy::NoUpdate,
+            },
+            bytes_written: known(bytes_written),
+            estimated_bytes_written: known(estimated_bytes_written),
+        })
+    }
+
+    /// Sets a function to be called periodically during long operations
+    /// on this file, and which can stop them.
+    ///
+    /// The callback receives a `Progress` report about every `interval`
+    /// while a file is being opened, read, or written, for file handlers
+    /// that support progress reporting (generally those for large formats,
+    /// such as MPEG-4 and RIFF, and only while updating). It returns `true`
+    /// to continue or `false` to abort; an aborted operation fails with
+    /// `XmpFileError::Aborted`. A callback that panics also aborts.
+    ///
+    /// Aborting stops the file handler wherever it is. During a direct
+    /// update (`close()`, or `close_with()` without
+    /// `CloseOptions::UPDATE_SAFELY`), that can leave the file half-written
+    /// and unreadable. If the callback may abort while a file is being
+    /// written, close it with `CloseOptions::UPDATE_SAFELY`, so that an
+    /// abort discards the temporary copy and leaves the original intact.
+    ///
+    /// Set the callback before opening the file. It stays in effect for
+    /// every later file opened with this struct, until it is replaced or
+    /// removed with `clear_progress_callback()`.
+    pub fn set_progress_callback<F>(&mut self, interval: Duration, callback: F)
+    where
+        F: FnMut(&Progress) -> bool + Send + 'static,
+    {
+        let mut state = Box::new(ProgressState {
+            callback: Box::new(callback),
+            aborted: false,
+        });
+
+        unsafe {
+            ffi::CXmpFileSetProgressCallback(
+                self.f,
+                Some(progress_trampoline),
+                &mut *state as *mut ProgressState as *mut c_void,
+                interval.as_secs_f32(),
+                0,
+            );
+        }
+
+        // Replacing the previous state only after the C++ side stops
+        // referring to it.
+        self.progress = Some(state);
+    }
+
+    /// Removes the callback set by `set_progress_callback()`.
+    pub fn clear_progress_callback(&mut self) {
+        unsafe {
+            ffi::CXmpFileSetProgressCallback(self.f, None, std::ptr::null_mut(), 0.0, 0);
+        }
+        self.progress = None;
+    }
+
+    fn clear_aborted(&mut self) {
+        if let Some(state) = self.progress.as_mut() {
+            state.aborted = false;
+        }
+    }
+
+    // Adds the reads and writes made through this file's in-memory or
+    // mapped image since the last call to the metrics.
+    fn report_io(&mut self) {
+        if !metrics::is_enabled() {
+            return;
+        }
+
+        let (mut bytes_read, mut read_calls) = (0i64, 0i64);
+        let (mut bytes_written, mut write_calls) = (0i64, 0i64);
+        unsafe {
+            ffi::CXmpFileTakeIoCounts(
+                self.f,
+                &mut bytes_read,
+                &mut read_calls,
+                &mut bytes_written,
+                &mut write_calls,
+            )
+        };
+
+        metrics::add_io(
+            bytes_read as u64,
+            read_calls as u64,
+            bytes_written as u64,
+            write_calls as u64,
+        );
+    }
+
+    // Returns `Aborted` instead of `e` if the progress callback
+    // stopped the operation that failed.
+    fn failure(&self, e: XmpFileError) -> XmpFileError {
+        match self.progress.as_ref() {
+            Some(state) if state.aborted => XmpFileError::Aborted,
+            _ => e,
+        }
     }
 }
 
@@ -220,6 +944,7 @@ mod tests {
     use tempfile::tempdir;
 
     use crate::xmp_const::*;
+    #[cfg(feature = "photo-handlers")]
     use crate::xmp_date_time::XmpDateTime;
 
     use super::*;
@@ -242,6 +967,30 @@ mod tests {
     }
 
     #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn xmp_into_replaces_contents() {
+        let mut f = XmpFile::new();
+        f.open_file(
+            fixture_path("Purple Square.psd"),
+            XmpFileFormat::Unknown,
+            OpenFileOptions::OPEN_FOR_READ,
+        )
+        .unwrap();
+
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "Nickname", "stale");
+
+        assert!(f.xmp_into(&mut m));
+        assert_eq!(m.property(XMP_NS_XMP, "Nickname"), None);
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "Adobe Photoshop CS2 Windows"
+        );
+        f.close();
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
     fn open_and_edit_file() {
         let tempdir = tempdir().unwrap();
         let purple_square = temp_copy_of_fixture(tempdir.path(), "Purple Square.psd");
@@ -252,6 +1001,7 @@ mod tests {
             assert!(f
                 .open_file(
                     &purple_square,
+                    XmpFileFormat::Unknown,
                     OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
                 )
                 .is_ok());
@@ -259,7 +1009,7 @@ mod tests {
             let opt_m = f.xmp();
             assert!(opt_m.is_some());
 
-            XmpMeta::register_namespace("http://purl.org/dc/terms/", "dcterms");
+            XmpMeta::register_namespace("http://purl.org/dc/terms/", "dcterms").unwrap();
 
             let mut m = opt_m.unwrap();
             m.set_property("http://purl.org/dc/terms/", "provenance", "blah");
@@ -291,6 +1041,7 @@ mod tests {
             assert!(f
                 .open_file(
                     &purple_square,
+                    XmpFileFormat::Unknown,
                     OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
                 )
                 .is_ok());
@@ -306,6 +1057,499 @@ mod tests {
         }
     }
 
+    // Returns the offset and length of the only XMP packet in `data`.
+    #[cfg(feature = "photo-handlers")]
+    fn packet_span(data: &[u8]) -> (usize, usize) {
+        let packets: Vec<_> = crate::packet_scan::find_packets(data).collect();
+        assert_eq!(packets.len(), 1);
+        (packets[0].offset, packets[0].bytes.len())
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn update_in_place() {
+        let tempdir = tempdir().unwrap();
+        let purple_square = temp_copy_of_fixture(tempdir.path(), "Purple Square.psd");
+        let original = fs::read(&purple_square).unwrap();
+        let (offset, length) = packet_span(&original);
+
+        {
+            let mut f = XmpFile::new();
+            assert!(f
+                .open_file(
+                    &purple_square,
+                    XmpFileFormat::Unknown,
+                    OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
+                )
+                .is_ok());
+
+            let mut m = f.xmp().unwrap();
+            m.set_property(XMP_NS_XMP, "Label", "in place");
+            assert!(f.can_update_in_place(&m));
+
+            // Far too large to fit in the existing padding.
+            let mut big = f.xmp().unwrap();
+            big.set_property(XMP_NS_XMP, "Nickname", &"x".repeat(1 << 20));
+            assert!(!f.can_update_in_place(&big));
+            assert!(f.put_xmp_in_place(&big).is_err());
+
+            f.put_xmp_in_place(&m).unwrap();
+            f.close();
+        }
+
+        // Only the packet itself was rewritten, at the same size.
+        let updated = fs::read(&purple_square).unwrap();
+        assert_eq!(updated.len(), original.len());
+        assert_eq!(packet_span(&updated), (offset, length));
+        assert_eq!(updated[..offset], original[..offset]);
+        assert_eq!(updated[offset + length..], original[offset + length..]);
+        assert_ne!(
+            updated[offset..offset + length],
+            original[offset..offset + length]
+        );
+
+        let mut f = XmpFile::new();
+        assert!(f
+            .open_file(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_READ
+            )
+            .is_ok());
+
+        let m = f.xmp().unwrap();
+        assert_eq!(m.property(XMP_NS_XMP, "Label").unwrap(), "in place");
+        assert!(!f.can_update_in_place(&m));
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn update_in_place_refuses_safe_close() {
+        let tempdir = tempdir().unwrap();
+        let purple_square = temp_copy_of_fixture(tempdir.path(), "Purple Square.psd");
+        let original = fs::read(&purple_square).unwrap();
+
+        let mut f = XmpFile::new();
+        assert!(f
+            .open_file(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
+            )
+            .is_ok());
+
+        let mut m = f.xmp().unwrap();
+        m.set_property(XMP_NS_XMP, "Label", "in place");
+        f.put_xmp_in_place(&m).unwrap();
+
+        match f.close_with(CloseOptions::UPDATE_SAFELY) {
+            Err(XmpFileError::CantUpdateInPlace) => {}
+            r => panic!("unexpected result {:?}", r),
+        }
+        assert_eq!(fs::read(&purple_square).unwrap(), original);
+
+        // The file is still open, with the XMP pending.
+        let report = f.close_with(CloseOptions::empty()).unwrap();
+        assert_eq!(report.requested, CloseStrategy::Direct);
+        assert_eq!(fs::read(&purple_square).unwrap().len(), original.len());
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn close_with_options() {
+        let tempdir = tempdir().unwrap();
+        let purple_square = temp_copy_of_fixture(tempdir.path(), "Purple Square.psd");
+        let open_for_update =
+            OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER;
+
+        let mut f = XmpFile::new();
+
+        // Nothing to write.
+        assert!(f
+            .open_file(&purple_square, XmpFileFormat::Unknown, open_for_update)
+            .is_ok());
+        let report = f.close_with(CloseOptions::empty()).unwrap();
+        assert_eq!(report.requested, CloseStrategy::NoUpdate);
+        assert_eq!(report.bytes_written, None);
+        assert_eq!(report.estimated_bytes_written, Some(0));
+
+        // Safe update writes the whole file.
+        assert!(f
+            .open_file(&purple_square, XmpFileFormat::Unknown, open_for_update)
+            .is_ok());
+        let mut m = f.xmp().unwrap();
+        m.set_property(XMP_NS_XMP, "Label", "safe");
+        f.put_xmp(&m);
+        let report = f.close_with(CloseOptions::UPDATE_SAFELY).unwrap();
+        assert_eq!(report.requested, CloseStrategy::Safe);
+        assert_eq!(
+            report.estimated_bytes_written,
+            Some(fs::metadata(&purple_square).unwrap().len())
+        );
+
+        // In-place update writes only the packet.
+        assert!(f
+            .open_file(&purple_square, XmpFileFormat::Unknown, open_for_update)
+            .is_ok());
+        let mut m = f.xmp().unwrap();
+        m.set_property(XMP_NS_XMP, "Label", "direct");
+        f.put_xmp_in_place(&m).unwrap();
+        let report = f.close_with(CloseOptions::empty()).unwrap();
+        assert_eq!(report.requested, CloseStrategy::Direct);
+        assert_eq!(report.bytes_written, None);
+        let estimate = report.estimated_bytes_written.unwrap();
+        assert!(estimate > 0);
+        assert!(estimate < fs::metadata(&purple_square).unwrap().len());
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn close_with_bytes_counts_writes() {
+        let purple_square = fs::read(fixture_path("Purple Square.psd")).unwrap();
+
+        let mut f = XmpFile::new();
+        assert!(f
+            .open_from_bytes(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
+            )
+            .is_ok());
+
+        let mut m = f.xmp().unwrap();
+        m.set_property(XMP_NS_XMP, "Label", "counted");
+        f.put_xmp(&m);
+
+        let report = f.close_with(CloseOptions::empty()).unwrap();
+        assert_eq!(report.requested, CloseStrategy::Direct);
+        assert!(report.bytes_written.unwrap() > 0);
+        assert_eq!(report.estimated_bytes_written, None);
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn io_metrics() {
+        let purple_square = fs::read(fixture_path("Purple Square.psd")).unwrap();
+
+        // Metrics are global and other tests may be running, so only
+        // lower bounds are checked.
+        metrics::enable();
+        let before = metrics::snapshot();
+
+        let mut f = XmpFile::new();
+        assert!(f
+            .open_from_bytes(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
+            )
+            .is_ok());
+        let mut m = f.xmp().unwrap();
+        m.set_property(XMP_NS_XMP, "Label", "metrics");
+        f.put_xmp(&m);
+        let report = f.close_with(CloseOptions::empty()).unwrap();
+
+        let after = metrics::snapshot();
+        assert!(after.read_calls > before.read_calls);
+        assert!(after.bytes_read > before.bytes_read);
+        assert!(after.write_calls > before.write_calls);
+        assert!(after.bytes_written - before.bytes_written >= report.bytes_written.unwrap());
+    }
+
+    // Writes a PCM WAV file with `data_len` bytes of silence, large
+    // enough that updating it takes a while.
+    #[cfg(feature = "media-handlers")]
+    fn write_wav(path: &Path, data_len: u32) {
+        let mut wav = Vec::new();
+        wav.extend_from_slice(b"RIFF");
+        wav.extend_from_slice(&(4 + 24 + 8 + data_len).to_le_bytes());
+        wav.extend_from_slice(b"WAVE");
+
+        wav.extend_from_slice(b"fmt ");
+        wav.extend_from_slice(&16u32.to_le_bytes());
+        wav.extend_from_slice(&1u16.to_le_bytes()); // PCM
+        wav.extend_from_slice(&2u16.to_le_bytes()); // channels
+        wav.extend_from_slice(&44_100u32.to_le_bytes());
+        wav.extend_from_slice(&176_400u32.to_le_bytes()); // bytes per second
+        wav.extend_from_slice(&4u16.to_le_bytes()); // block align
+        wav.extend_from_slice(&16u16.to_le_bytes()); // bits per sample
+
+        wav.extend_from_slice(b"data");
+        wav.extend_from_slice(&data_len.to_le_bytes());
+        wav.resize(wav.len() + data_len as usize, 0);
+
+        fs::write(path, wav).unwrap();
+    }
+
+    #[test]
+    #[cfg(feature = "media-handlers")]
+    fn progress_callback() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+        use std::sync::Arc;
+
+        let tempdir = tempdir().unwrap();
+        let wav = tempdir.path().join("silence.wav");
+        let open_for_update =
+            OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER;
+
+        let calls = Arc::new(AtomicUsize::new(0));
+        let mut f = XmpFile::new();
+        {
+            let calls = calls.clone();
+            f.set_progress_callback(Duration::from_millis(0), move |_| {
+                calls.fetch_add(1, Ordering::Relaxed);
+                true
+            });
+        }
+
+        write_wav(&wav, 32 * 1024 * 1024);
+        f.open_file(&wav, XmpFileFormat::Wav, open_for_update)
+            .unwrap();
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "Label", &"x".repeat(100_000));
+        f.put_xmp(&m);
+        f.close_with(CloseOptions::empty()).unwrap();
+        assert!(calls.load(Ordering::Relaxed) > 0);
+
+        // An aborting callback makes the update fail with `Aborted`.
+        f.set_progress_callback(Duration::from_millis(0), |_| false);
+        write_wav(&wav, 32 * 1024 * 1024);
+        f.open_file(&wav, XmpFileFormat::Wav, open_for_update)
+            .unwrap();
+        f.put_xmp(&m);
+        match f.close_with(CloseOptions::empty()) {
+            Err(XmpFileError::Aborted) => {}
+            r => panic!("unexpected result {:?}", r),
+        }
+
+        f.clear_progress_callback();
+        assert!(f
+            .open_file(&wav, XmpFileFormat::Wav, OpenFileOptions::OPEN_FOR_READ)
+            .is_ok());
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn open_and_edit_bytes() {
+        let purple_square = fs::read(fixture_path("Purple Square.psd")).unwrap();
+
+        let updated = {
+            let mut f = XmpFile::new();
+
+            assert!(f
+                .open_from_bytes(
+                    &purple_square,
+                    XmpFileFormat::Unknown,
+                    OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
+                )
+                .is_ok());
+
+            XmpMeta::register_namespace("http://purl.org/dc/terms/", "dcterms").unwrap();
+
+            let mut m = f.xmp().unwrap();
+            m.set_property("http://purl.org/dc/terms/", "provenance", "blah");
+
+            assert_eq!(f.can_put_xmp(&m), true);
+            f.put_xmp(&m);
+
+            f.close();
+            f.bytes().unwrap()
+        };
+
+        assert_ne!(updated, purple_square);
+
+        // The updated file image should carry the new property.
+        {
+            let mut f = XmpFile::new();
+
+            assert!(f
+                .open_from_bytes(
+                    &updated,
+                    XmpFileFormat::Unknown,
+                    OpenFileOptions::OPEN_FOR_READ
+                )
+                .is_ok());
+
+            let m = f.xmp().unwrap();
+
+            assert_eq!(
+                m.property("http://purl.org/dc/terms/", "provenance")
+                    .unwrap(),
+                "blah"
+            );
+        }
+    }
+
+    #[test]
+    fn open_mapped() {
+        let purple_square = fixture_path("Purple Square.psd");
+
+        let mut f = XmpFile::new();
+        assert!(f
+            .open_file_mapped(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_READ
+            )
+            .is_ok());
+
+        let m = f.xmp().unwrap();
+        assert_eq!(m.does_property_exist(XMP_NS_XMP, "CreatorTool"), true);
+
+        assert!(f.bytes().is_none());
+        f.close();
+    }
+
+    #[test]
+    fn open_mapped_for_update_fails() {
+        let tempdir = tempdir().unwrap();
+        let purple_square = temp_copy_of_fixture(tempdir.path(), "Purple Square.psd");
+
+        let mut f = XmpFile::new();
+        assert!(f
+            .open_file_mapped(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_UPDATE
+            )
+            .is_err());
+    }
+
+    #[test]
+    fn open_on_another_thread() {
+        let purple_square = fixture_path("Purple Square.psd");
+        let mut f = XmpFile::new();
+
+        let m = std::thread::spawn(move || {
+            f.open_file(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_READ,
+            )
+            .unwrap();
+            f.xmp()
+        })
+        .join()
+        .unwrap()
+        .unwrap();
+
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "Adobe Photoshop CS2 Windows"
+        );
+    }
+
+    #[test]
+    fn bytes_not_from_memory() {
+        let f = XmpFile::new();
+        assert!(f.bytes().is_none());
+    }
+
+    #[test]
+    fn reopen_after_close() {
+        let purple_square = fixture_path("Purple Square.psd");
+        let purple_square_bytes = fs::read(&purple_square).unwrap();
+
+        let mut f = XmpFile::new();
+
+        for i in 0..10 {
+            if i % 2 == 0 {
+                f.open_file(
+                    &purple_square,
+                    XmpFileFormat::Unknown,
+                    OpenFileOptions::OPEN_FOR_READ,
+                )
+                .unwrap();
+            } else {
+                f.open_from_bytes(
+                    &purple_square_bytes,
+                    XmpFileFormat::Unknown,
+                    OpenFileOptions::OPEN_FOR_READ,
+                )
+                .unwrap();
+            }
+
+            let m = f.xmp().unwrap();
+            assert_eq!(
+                m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+                "Adobe Photoshop CS2 Windows"
+            );
+
+            f.close();
+        }
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn check_file_format() {
+        let purple_square = fixture_path("Purple Square.psd");
+        assert_eq!(
+            XmpFile::check_file_format(&purple_square),
+            XmpFileFormat::Photoshop
+        );
+
+        assert_eq!(
+            XmpFile::check_file_format("doesnotexist.jpg"),
+            XmpFileFormat::Unknown
+        );
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn open_with_format_hint() {
+        let purple_square = fixture_path("Purple Square.psd");
+        let mut f = XmpFile::new();
+
+        assert!(f
+            .open_file(
+                &purple_square,
+                XmpFileFormat::Photoshop,
+                OpenFileOptions::OPEN_FOR_READ | OpenFileOptions::OPEN_STRICTLY
+            )
+            .is_ok());
+        assert!(f.xmp().is_some());
+        f.close();
+
+        // With OPEN_STRICTLY, only the handler for the given format is tried.
+        assert!(f
+            .open_file(
+                &purple_square,
+                XmpFileFormat::Jpeg,
+                OpenFileOptions::OPEN_FOR_READ | OpenFileOptions::OPEN_STRICTLY
+            )
+            .is_err());
+    }
+
+    #[test]
+    #[cfg(feature = "photo-handlers")]
+    fn open_bytes_with_sniffed_format() {
+        let purple_square = fs::read(fixture_path("Purple Square.psd")).unwrap();
+        let mut f = XmpFile::new();
+
+        // The PSD signature is sniffed from the data, so the Photoshop
+        // handler is selected even though OPEN_STRICTLY permits no probing.
+        assert!(f
+            .open_from_bytes(
+                &purple_square,
+                XmpFileFormat::Unknown,
+                OpenFileOptions::OPEN_FOR_READ | OpenFileOptions::OPEN_STRICTLY
+            )
+            .is_ok());
+        assert!(f.xmp().is_some());
+        f.close();
+    }
+
+    #[test]
+    fn format_codes() {
+        assert_eq!(XmpFileFormat::Jpeg as u32, 0x4A50_4547);
+        assert_eq!(XmpFileFormat::Unknown as u32, 0x2020_2020);
+        assert_eq!(
+            XmpFileFormat::from_u32(XmpFileFormat::Photoshop as u32),
+            XmpFileFormat::Photoshop
+        );
+        assert_eq!(XmpFileFormat::from_u32(0x1234_5678), XmpFileFormat::Unknown);
+    }
+
     #[test]
     fn open_fail() {
         let bad_path = PathBuf::from("doesnotexist.jpg");
@@ -316,6 +1560,7 @@ mod tests {
             assert!(f
                 .open_file(
                     &bad_path,
+                    XmpFileFormat::Unknown,
                     OpenFileOptions::OPEN_FOR_UPDATE | OpenFileOptions::OPEN_USE_SMART_HANDLER
                 )
                 .is_err());
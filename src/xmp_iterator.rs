@@ -0,0 +1,290 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use bitflags::bitflags;
+use std::collections::VecDeque;
+use std::ffi::CString;
+use std::marker::PhantomData;
+use std::os::raw::c_void;
+
+use crate::ffi;
+use crate::xmp_meta::XmpMeta;
+
+bitflags! {
+    /// Option flags for `XmpMeta::iter()`.
+    pub struct IterOptions: u32 {
+        /// Just do the immediate children of the root, default is subtree.
+        const JUST_CHILDREN = 0x0100;
+
+        /// Just do the leaf nodes, default is all nodes in the subtree.
+        const JUST_LEAF_NODES = 0x0200;
+
+        /// Return just the leaf part of the path, default is the full path.
+        const JUST_LEAF_NAME = 0x0400;
+
+        /// Omit all qualifiers.
+        const OMIT_QUALIFIERS = 0x1000;
+    }
+}
+
+bitflags! {
+    /// Flags describing a node of the metadata tree.
+    pub struct PropertyFlags: u32 {
+        /// The value is a URI, use `rdf:resource` attribute.
+        const VALUE_IS_URI = 0x0000_0002;
+
+        /// The property has qualifiers, includes `rdf:type` and `xml:lang`.
+        const HAS_QUALIFIERS = 0x0000_0010;
+
+        /// This is a qualifier for some other property.
+        const IS_QUALIFIER = 0x0000_0020;
+
+        /// Implies `HAS_QUALIFIERS`, property has `xml:lang`.
+        const HAS_LANG = 0x0000_0040;
+
+        /// Implies `HAS_QUALIFIERS`, property has `rdf:type`.
+        const HAS_TYPE = 0x0000_0080;
+
+        /// The value is a structure with nested fields.
+        const VALUE_IS_STRUCT = 0x0000_0100;
+
+        /// The value is an array (RDF alt/bag/seq).
+        const VALUE_IS_ARRAY = 0x0000_0200;
+
+        /// The item order matters (RDF `seq`).
+        const ARRAY_IS_ORDERED = 0x0000_0400;
+
+        /// The items are mutually exclusive alternates (RDF `alt`).
+        const ARRAY_IS_ALTERNATE = 0x0000_0800;
+
+        /// The items are text alternatives for different languages.
+        const ARRAY_IS_ALT_TEXT = 0x0000_1000;
+
+        /// The property is an alias.
+        const IS_ALIAS = 0x0001_0000;
+
+        /// This property is the base value (actual) for a set of aliases.
+        const HAS_ALIASES = 0x0002_0000;
+
+        /// The value of this property is "owned" by the application,
+        /// and should not generally be editable in a UI.
+        const IS_INTERNAL = 0x0004_0000;
+
+        /// The value of this property is not derived from the document content.
+        const IS_STABLE = 0x0010_0000;
+
+        /// The value of this property is derived from the document content.
+        const IS_DERIVED = 0x0020_0000;
+
+        /// This node is the top-level node for a schema.
+        const SCHEMA_NODE = 0x8000_0000;
+    }
+}
+
+/// One node of a metadata tree, as returned by `XmpIterator`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct XmpProperty {
+    /// The namespace URI of the schema that contains this node.
+    pub schema_ns: String,
+
+    /// The path of this node within the schema (or just the leaf name,
+    /// with `IterOptions::JUST_LEAF_NAME`). Empty for schema nodes.
+    pub name: String,
+
+    /// The value of this node. Empty for schema nodes, structs, and arrays.
+    pub value: String,
+
+    /// Flags describing this node.
+    pub options: PropertyFlags,
+}
+
+// The number of nodes fetched from the XMP Toolkit per call.
+const PAGE_SIZE: usize = 256;
+
+/// An iterator over the nodes of a metadata tree.
+///
+/// Created by `XmpMeta::iter()`. Nodes are fetched from the XMP Toolkit
+/// a page at a time, so a walk over the entire tree costs one call per
+/// page rather than one per node.
+pub struct XmpIterator<'a> {
+    i: *mut ffi::CXmpIterator,
+    page: VecDeque<XmpProperty>,
+    done: bool,
+    _meta: PhantomData<&'a XmpMeta>,
+}
+
+impl<'a> Drop for XmpIterator<'a> {
+    fn drop(&mut self) {
+        if !self.i.is_null() {
+            unsafe {
+                ffi::CXmpIteratorDrop(self.i);
+            }
+        }
+    }
+}
+
+impl<'a> XmpIterator<'a> {
+    pub(crate) fn new(
+        m: &'a XmpMeta,
+        schema_ns: &str,
+        prop_name: &str,
+        options: IterOptions,
+    ) -> XmpIterator<'a> {
+        let c_ns = CString::new(schema_ns).unwrap();
+        let c_name = CString::new(prop_name).unwrap();
+
+        let i =
+            unsafe { ffi::CXmpIteratorNew(m.m, c_ns.as_ptr(), c_name.as_ptr(), options.bits()) };
+
+        XmpIterator {
+            i,
+            page: VecDeque::new(),
+            done: i.is_null(),
+            _meta: PhantomData,
+        }
+    }
+
+    fn fetch_page(&mut self) {
+        let mut options: Vec<u32> = vec![0; PAGE_SIZE];
+        let mut packed: Vec<u8> = Vec::new();
+
+        let count = unsafe {
+            ffi::CXmpIteratorNextPage(
+                self.i,
+                PAGE_SIZE,
+                options.as_mut_ptr(),
+                ffi::bytes_sink,
+                &mut packed as *mut Vec<u8> as *mut c_void,
+            )
+        };
+
+        if count < PAGE_SIZE {
+            self.done = true;
+        }
+
+        let mut fields = packed
+            .split(|b| *b == 0)
+            .map(|f| String::from_utf8_lossy(f).into_owned());
+
+        for opts in options.iter().take(count) {
+            let schema_ns = fields.next().unwrap_or_default();
+            let name = fields.next().unwrap_or_default();
+            let value = fields.next().unwrap_or_default();
+
+            self.page.push_back(XmpProperty {
+                schema_ns,
+                name,
+                value,
+                options: PropertyFlags::from_bits_truncate(*opts),
+            });
+        }
+    }
+}
+
+impl<'a> Iterator for XmpIterator<'a> {
+    type Item = XmpProperty;
+
+    fn next(&mut self) -> Option<XmpProperty> {
+        if self.page.is_empty() && !self.done {
+            self.fetch_page();
+        }
+        self.page.pop_front()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::xmp_const::*;
+    use crate::xmp_meta::XmpMeta;
+
+    use super::*;
+
+    const PACKET: &str = r#"<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+    xmlns:dc="http://purl.org/dc/elements/1.1/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows">
+   <dc:subject>
+    <rdf:Bag>
+     <rdf:li>purple</rdf:li>
+     <rdf:li>square</rdf:li>
+    </rdf:Bag>
+   </dc:subject>
+  </rdf:Description>
+ </rdf:RDF>
+</x:xmpmeta>"#;
+
+    #[test]
+    fn iter_all() {
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let nodes: Vec<XmpProperty> = m.iter(IterOptions::empty()).collect();
+
+        let schemas: Vec<&str> = nodes
+            .iter()
+            .filter(|n| n.options.contains(PropertyFlags::SCHEMA_NODE))
+            .map(|n| n.schema_ns.as_str())
+            .collect();
+        assert_eq!(schemas.len(), 2);
+        assert!(schemas.contains(&XMP_NS_XMP));
+        assert!(schemas.contains(&XMP_NS_DC));
+
+        let creator_tool = nodes.iter().find(|n| n.name == "xmp:CreatorTool").unwrap();
+        assert_eq!(creator_tool.schema_ns, XMP_NS_XMP);
+        assert_eq!(creator_tool.value, "Adobe Photoshop CS2 Windows");
+
+        let subject = nodes.iter().find(|n| n.name == "dc:subject").unwrap();
+        assert!(subject.options.contains(PropertyFlags::VALUE_IS_ARRAY));
+        assert!(!subject.options.contains(PropertyFlags::ARRAY_IS_ORDERED));
+
+        let items: Vec<&str> = nodes
+            .iter()
+            .filter(|n| n.name.starts_with("dc:subject["))
+            .map(|n| n.value.as_str())
+            .collect();
+        assert_eq!(items, vec!["purple", "square"]);
+    }
+
+    #[test]
+    fn iter_leaf_nodes() {
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let names: Vec<String> = m
+            .iter(IterOptions::JUST_LEAF_NODES)
+            .map(|n| n.name)
+            .collect();
+
+        assert_eq!(names.len(), 3);
+        assert!(names.contains(&"xmp:CreatorTool".to_owned()));
+        assert!(!names.contains(&"dc:subject".to_owned()));
+    }
+
+    #[test]
+    fn iter_many_pages() {
+        let mut m = XmpMeta::new();
+        for i in 0..(PAGE_SIZE * 2 + 10) {
+            m.set_property(XMP_NS_XMP, &format!("Prop{}", i), &i.to_string());
+        }
+
+        let count = m
+            .iter(IterOptions::JUST_LEAF_NODES)
+            .filter(|n| n.schema_ns == XMP_NS_XMP)
+            .count();
+        assert_eq!(count, PAGE_SIZE * 2 + 10);
+    }
+
+    #[test]
+    fn iter_empty() {
+        let m = XmpMeta::new();
+        assert_eq!(m.iter(IterOptions::empty()).count(), 0);
+    }
+}
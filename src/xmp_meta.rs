@@ -11,21 +11,114 @@
 // specific language governing permissions and limitations under
 // each license.
 
-use std::ffi::{CStr, CString};
+use bitflags::bitflags;
+use std::ffi::CString;
+use std::os::raw::{c_char, c_int, c_void};
 
 use crate::ffi;
+use crate::metrics::{self, Phase};
 use crate::xmp_date_time::XmpDateTime;
+use crate::xmp_diff::{self, MergeOptions, XmpChange};
+use crate::xmp_edit::{XmpEdit, XmpEditError};
+use crate::xmp_iterator::{IterOptions, XmpIterator};
+use crate::xmp_path::XmpPath;
+use crate::xmp_snapshot::XmpSnapshot;
+
+bitflags! {
+    /// Option flags for `XmpMeta::to_packet()`.
+    pub struct SerializeOptions: u32 {
+        /// Omit the XML packet wrapper.
+        const OMIT_PACKET_WRAPPER = 0x0010;
+
+        /// Default is a writeable packet.
+        const READ_ONLY_PACKET = 0x0020;
+
+        /// Use a compact form of RDF.
+        const USE_COMPACT_FORMAT = 0x0040;
+
+        /// Use a canonical form of RDF.
+        const USE_CANONICAL_FORMAT = 0x0080;
+
+        /// Include a padding allowance for a thumbnail image.
+        const INCLUDE_THUMBNAIL_PAD = 0x0100;
+
+        /// The padding parameter is the overall packet length.
+        const EXACT_PACKET_LENGTH = 0x0200;
+
+        /// Omit all formatting whitespace.
+        const OMIT_ALL_FORMATTING = 0x0800;
+
+        /// Omit the x:xmpmeta element surrounding the rdf:RDF element.
+        const OMIT_XMP_META_ELEMENT = 0x1000;
+
+        /// Serialize as UTF-16, big endian. The default is UTF-8.
+        const ENCODE_UTF16_BIG = 0x0002;
+
+        /// Serialize as UTF-16, little endian.
+        const ENCODE_UTF16_LITTLE = 0x0003;
+
+        /// Serialize as UTF-32, big endian.
+        const ENCODE_UTF32_BIG = 0x0004;
+
+        /// Serialize as UTF-32, little endian.
+        const ENCODE_UTF32_LITTLE = 0x0005;
+    }
+}
+
+/// Describes the potential error conditions that might arise from `XmpMeta` operations.
+#[derive(Debug)]
+pub enum XmpMetaError {
+    /// The XMP packet could not be parsed.
+    BadPacket,
+
+    /// The metadata could not be serialized with the requested options.
+    CantSerialize,
+
+    /// The metadata could not be merged with the requested options.
+    CantMerge,
+
+    /// The XMP Toolkit reported an error while comparing two trees.
+    CantDiff,
+
+    /// The namespace URI or prefix could not be registered.
+    BadNamespace,
+}
 
 /// The `XmpMeta` struct allows access to the XMP Toolkit core services.
 ///
 /// You can create `XmpMeta` structs from metadata that you construct,
 /// or that you obtain from files using the XMP Toolkit's `XmpFile` struct.
+///
+/// ## Thread safety
+///
+/// `XmpMeta` is `Send`, so it may be moved to another thread, and `Sync`,
+/// so several threads may read the same metadata (through `&XmpMeta`)
+/// at once. The XMP Toolkit guards each metadata object with its own
+/// read/write lock, so concurrent readers of one object are safe, as is
+/// concurrent use of distinct objects. Modification requires `&mut XmpMeta`
+/// and is therefore exclusive.
+///
+/// ## Memory use
+///
+/// The metadata tree is owned by the XMP Toolkit, which allocates each
+/// node (and its name, value, and child lists) separately on the C++ heap.
+/// Parsing a large packet therefore costs many small allocations, and
+/// dropping the `XmpMeta` frees them one by one. To keep this in proportion
+/// to the metadata actually needed, prune unwanted schemas with
+/// `retain_schemas()` soon after reading, and drop metadata promptly
+/// rather than holding large trees for the lifetime of a worker.
 pub struct XmpMeta {
     pub(crate) m: *mut ffi::CXmpMeta,
     // pub(crate) is used because XmpFile::xmp
     // can create this struct.
 }
 
+// The underlying SXMPMeta object is not tied to the thread that created
+// it, and the toolkit takes the object's read lock for each of the
+// read-only (`&self`) accessors exposed here.
+unsafe impl Send for XmpMeta {}
+unsafe impl Sync for XmpMeta {}
+
 impl Drop for XmpMeta {
     fn drop(&mut self) {
         unsafe {
@@ -40,6 +133,22 @@ impl Default for XmpMeta {
     }
 }
 
+impl Clone for XmpMeta {
+    /// Returns a deep copy of this metadata.
+    ///
+    /// The tree is copied by the XMP Toolkit in a single call, which is
+    /// much cheaper than rebuilding it property by property or serializing
+    /// and parsing it again. This makes it practical to build a template
+    /// once and clone it for each document that needs it.
+    fn clone(&self) -> Self {
+        let m = unsafe { ffi::CXmpMetaClone(self.m) };
+        if m.is_null() {
+            panic!("XMP Toolkit failed to clone XmpMeta");
+        }
+        XmpMeta { m }
+    }
+}
+
 impl XmpMeta {
     /// Creates a new, empty metadata struct.
     pub fn new() -> XmpMeta {
@@ -47,6 +156,73 @@ impl XmpMeta {
         XmpMeta { m }
     }
 
+    /// Creates a metadata struct by parsing a serialized XMP packet.
+    ///
+    /// Use this to read XMP that is stored apart from any file, such as a
+    /// sidecar packet kept in a database. The packet is parsed directly from
+    /// `packet`; it is not copied first.
+    ///
+    /// `packet` may be in any of the encodings the XMP Toolkit recognizes
+    /// (UTF-8, UTF-16, or UTF-32), and may or may not include the XML packet
+    /// wrapper and the `x:xmpmeta` element.
+    pub fn from_packet(packet: &[u8]) -> Result<XmpMeta, XmpMetaError> {
+        let _t = metrics::time(Phase::Parse);
+
+        let m = unsafe {
+            ffi::CXmpMetaParseFromBuffer(packet.as_ptr() as *const c_char, packet.len(), 0)
+        };
+
+        if m.is_null() {
+            Err(XmpMetaError::BadPacket)
+        } else {
+            Ok(XmpMeta { m })
+        }
+    }
+
+    /// Serializes this metadata as an XMP packet.
+    ///
+    /// The result can be stored and later parsed again with `from_packet()`.
+    /// By default (no options), the packet is UTF-8 encoded, includes the
+    /// XML packet wrapper, and is padded to allow in-place updates; see
+    /// `SerializeOptions` for alternatives. For compact storage,
+    /// `OMIT_PACKET_WRAPPER | USE_COMPACT_FORMAT` is typical.
+    pub fn to_packet(&self, options: SerializeOptions) -> Result<Vec<u8>, XmpMetaError> {
+        self.to_packet_with_padding(options, 0)
+    }
+
+    /// Serializes this metadata as an XMP packet with a chosen amount of padding.
+    ///
+    /// `padding` is the number of bytes of whitespace added to the packet to
+    /// leave room for later in-place edits; zero means the XMP Toolkit's
+    /// default (2 KiB). With `SerializeOptions::EXACT_PACKET_LENGTH`, `padding`
+    /// is instead the total length of the packet, and serialization fails if
+    /// the metadata doesn't fit.
+    pub fn to_packet_with_padding(
+        &self,
+        options: SerializeOptions,
+        padding: u32,
+    ) -> Result<Vec<u8>, XmpMetaError> {
+        let _t = metrics::time(Phase::Serialize);
+
+        let mut packet: Vec<u8> = Vec::new();
+
+        let ok = unsafe {
+            ffi::CXmpMetaSerializeToBuffer(
+                self.m,
+                options.bits(),
+                padding,
+                ffi::bytes_sink,
+                &mut packet as *mut Vec<u8> as *mut c_void,
+            )
+        };
+
+        if ok != 0 {
+            Ok(packet)
+        } else {
+            Err(XmpMetaError::CantSerialize)
+        }
+    }
+
     /// Registers a namespace URI with a suggested prefix.
     ///
     /// If the URI is not registered but the suggested prefix
@@ -62,19 +238,34 @@ impl XmpMeta {
     /// * `suggested_prefix`: The suggested prefix to be used if
     /// the URI is not yet registered. Must be a valid XML name.
     ///
-    /// Returns the prefix actually registered for this URI.
-    ///
-    /// **NOTE:** No checking is done on either the URI or the prefix.
-    pub fn register_namespace(namespace_uri: &str, suggested_prefix: &str) -> String {
+    /// Returns the prefix actually registered for this URI, or
+    /// `XmpMetaError::BadNamespace` if the XMP Toolkit rejects the URI or
+    /// the prefix.
+    pub fn register_namespace(
+        namespace_uri: &str,
+        suggested_prefix: &str,
+    ) -> Result<String, XmpMetaError> {
         // These .unwrap() calls are deemed unlikely to panic as this
         // function is typically called with known, standardized strings
         // in the ASCII space.
         let c_ns = CString::new(namespace_uri).unwrap();
         let c_sp = CString::new(suggested_prefix).unwrap();
 
-        unsafe {
-            let c_result = ffi::CXmpMetaRegisterNamespace(c_ns.as_ptr(), c_sp.as_ptr());
-            CStr::from_ptr(c_result).to_string_lossy().into_owned()
+        let mut result = String::new();
+
+        let ok = unsafe {
+            ffi::CXmpMetaRegisterNamespace(
+                c_ns.as_ptr(),
+                c_sp.as_ptr(),
+                ffi::string_sink,
+                &mut result as *mut String as *mut c_void,
+            )
+        };
+
+        if ok != 0 {
+            Ok(result)
+        } else {
+            Err(XmpMetaError::BadNamespace)
         }
     }
 
@@ -98,18 +289,187 @@ impl XmpMeta {
     /// The prefix must be for a registered namespace, and if a namespace URI is
     /// specified, must match the registered prefix for that namespace.
     pub fn property(&self, schema_ns: &str, prop_name: &str) -> Option<String> {
+        let mut value = String::new();
+
+        if self.property_into(schema_ns, prop_name, &mut value) {
+            Some(value)
+        } else {
+            None
+        }
+    }
+
+    /// Gets a property value into an existing `String`.
+    ///
+    /// This is equivalent to `property()`, but stores the value in `value`
+    /// instead of allocating a new `String`. When reading many properties
+    /// in a loop, reusing the same `String` avoids an allocation per read.
+    ///
+    /// Returns `true` if the property exists. In that case, the previous
+    /// contents of `value` are replaced with the property value. Otherwise,
+    /// `value` is left unchanged.
+    ///
+    /// ## Arguments
+    ///
+    /// * `schema_ns`: The namespace URI; see `property()`.
+    ///
+    /// * `prop_name`: The name of the property; see `property()`.
+    ///
+    /// * `value`: Receives the property value.
+    pub fn property_into(&self, schema_ns: &str, prop_name: &str, value: &mut String) -> bool {
         let c_ns = CString::new(schema_ns).unwrap();
         let c_name = CString::new(prop_name).unwrap();
 
-        unsafe {
-            let c_result = ffi::CXmpMetaGetProperty(self.m, c_ns.as_ptr(), c_name.as_ptr());
+        let r = unsafe {
+            ffi::CXmpMetaGetProperty(
+                self.m,
+                c_ns.as_ptr(),
+                c_name.as_ptr(),
+                ffi::string_sink,
+                value as *mut String as *mut c_void,
+            )
+        };
+
+        r != 0
+    }
+
+    /// Gets a property value as an integer.
+    ///
+    /// The value is converted by the XMP Toolkit without returning a string
+    /// to Rust, so no allocation is made.
+    ///
+    /// Returns `None` if the property doesn't exist or its value can not be
+    /// read as an integer.
+    ///
+    /// ## Arguments
+    ///
+    /// * `schema_ns`: The namespace URI; see `property()`.
+    ///
+    /// * `prop_name`: The name of the property; see `property()`.
+    pub fn property_i64(&self, schema_ns: &str, prop_name: &str) -> Option<i64> {
+        let c_ns = CString::new(schema_ns).unwrap();
+        let c_name = CString::new(prop_name).unwrap();
+        let mut value: i64 = 0;
+
+        let r = unsafe {
+            ffi::CXmpMetaGetPropertyInt64(self.m, c_ns.as_ptr(), c_name.as_ptr(), &mut value)
+        };
+
+        if r != 0 {
+            Some(value)
+        } else {
+            None
+        }
+    }
+
+    /// Gets a property value as a floating-point number.
+    ///
+    /// See `property_i64()`.
+    pub fn property_f64(&self, schema_ns: &str, prop_name: &str) -> Option<f64> {
+        let c_ns = CString::new(schema_ns).unwrap();
+        let c_name = CString::new(prop_name).unwrap();
+        let mut value: f64 = 0.0;
+
+        let r = unsafe {
+            ffi::CXmpMetaGetPropertyFloat(self.m, c_ns.as_ptr(), c_name.as_ptr(), &mut value)
+        };
+
+        if r != 0 {
+            Some(value)
+        } else {
+            None
+        }
+    }
+
+    /// Gets a property value as a Boolean.
+    ///
+    /// The XMP Toolkit accepts only `True`, `False`, `t`, `f`, `1`, and `0`,
+    /// in any case. Other spellings, such as `yes` or `on`, give `None`.
+    ///
+    /// See `property_i64()`.
+    pub fn property_bool(&self, schema_ns: &str, prop_name: &str) -> Option<bool> {
+        let c_ns = CString::new(schema_ns).unwrap();
+        let c_name = CString::new(prop_name).unwrap();
+        let mut value: c_int = 0;
+
+        let r = unsafe {
+            ffi::CXmpMetaGetPropertyBool(self.m, c_ns.as_ptr(), c_name.as_ptr(), &mut value)
+        };
+
+        if r != 0 {
+            Some(value != 0)
+        } else {
+            None
+        }
+    }
+
+    /// Gets a property value as a date and time.
+    ///
+    /// See `property_i64()`.
+    pub fn property_date(&self, schema_ns: &str, prop_name: &str) -> Option<XmpDateTime> {
+        let c_ns = CString::new(schema_ns).unwrap();
+        let c_name = CString::new(prop_name).unwrap();
+        let mut value = XmpDateTime::new();
+
+        let r = unsafe {
+            ffi::CXmpMetaGetPropertyDate(self.m, c_ns.as_ptr(), c_name.as_ptr(), &mut value)
+        };
+
+        if r != 0 {
+            Some(value)
+        } else {
+            None
+        }
+    }
+
+    /// Gets several property values at once.
+    ///
+    /// This is equivalent to calling `property()` for each (namespace, path)
+    /// pair in `paths`, but all of the lookups are made in a single call into
+    /// the C++ toolkit and the values are returned in one contiguous buffer.
+    /// Prefer this when reading more than a handful of properties from the
+    /// same metadata.
+    ///
+    /// Returns one entry per pair in `paths`, in the same order. An entry is
+    /// `None` if the property doesn't exist or its path is invalid.
+    ///
+    /// ## Arguments
+    ///
+    /// * `paths`: Pairs of (`schema_ns`, `prop_name`); see `property()`.
+    pub fn properties(&self, paths: &[(&str, &str)]) -> Vec<Option<String>> {
+        let mut packed_paths: Vec<u8> = Vec::new();
+        for (schema_ns, prop_name) in paths {
+            push_c_str(&mut packed_paths, schema_ns);
+            push_c_str(&mut packed_paths, prop_name);
+        }
 
-            if c_result.is_null() {
-                None
-            } else {
-                Some(CStr::from_ptr(c_result).to_string_lossy().into_owned())
-            }
+        let mut lengths: Vec<i64> = vec![-1; paths.len()];
+        let mut packed_values: Vec<u8> = Vec::new();
+
+        unsafe {
+            ffi::CXmpMetaGetProperties(
+                self.m,
+                packed_paths.as_ptr() as *const c_char,
+                paths.len(),
+                lengths.as_mut_ptr(),
+                ffi::bytes_sink,
+                &mut packed_values as *mut Vec<u8> as *mut c_void,
+            );
         }
+
+        let mut offset = 0;
+        lengths
+            .iter()
+            .map(|&len| {
+                if len < 0 {
+                    None
+                } else {
+                    let end = offset + len as usize;
+                    let value = String::from_utf8_lossy(&packed_values[offset..end]).into_owned();
+                    offset = end;
+                    Some(value)
+                }
+            })
+            .collect()
     }
 
     /// Creates or sets a property value.
@@ -126,6 +486,11 @@ impl XmpMeta {
     /// for namespace prefix usage.
     ///
     /// * `prop_value`: The new value.
+    ///
+    /// If the property can't be set (for example, because the path is
+    /// invalid or the namespace isn't registered), the XMP Toolkit's error
+    /// is printed to standard error and otherwise ignored. Use
+    /// `try_set_property()` to find out whether the property was set.
     pub fn set_property(&mut self, schema_ns: &str, prop_name: &str, prop_value: &str) {
         let c_ns = CString::new(schema_ns).unwrap();
         let c_name = CString::new(prop_name).unwrap();
@@ -136,6 +501,20 @@ impl XmpMeta {
         }
     }
 
+    /// Creates or sets a property value, reporting failure.
+    ///
+    /// This is equivalent to `set_property()`, but returns the XMP Toolkit's
+    /// error if the property can't be set. The error's `index` is always 0.
+    pub fn try_set_property(
+        &mut self,
+        schema_ns: &str,
+        prop_name: &str,
+        prop_value: &str,
+    ) -> Result<(), XmpEditError> {
+        self.apply(XmpEdit::new().set(schema_ns, prop_name, prop_value))
+            .map_err(|mut errors| errors.remove(0))
+    }
+
     /// Creates or sets a property value using an `XmpDateTeim` structure.
     ///
     /// This is the simplest property setter. Use it for top-level
@@ -160,10 +539,72 @@ impl XmpMeta {
         let c_name = CString::new(prop_name).unwrap();
 
         unsafe {
-            ffi::CXmpMetaSetPropertyDate(self.m, c_ns.as_ptr(), c_name.as_ptr(), prop_value.dt);
+            ffi::CXmpMetaSetPropertyDate(self.m, c_ns.as_ptr(), c_name.as_ptr(), prop_value);
+        }
+    }
+
+    /// Makes all of the changes in an `XmpEdit` batch in a single call
+    /// into the XMP Toolkit.
+    ///
+    /// Changes are made in the order they were added to the batch. A change
+    /// that fails (for example, because its path is invalid or its namespace
+    /// isn't registered) is skipped, and the remaining changes are still made.
+    ///
+    /// Returns an error listing each change that failed, in order.
+    pub fn apply(&mut self, edit: &XmpEdit) -> Result<(), Vec<XmpEditError>> {
+        edit.apply_to(self)
+    }
+
+    /// Gets a property value using a prepared `XmpPath`.
+    ///
+    /// This is equivalent to `property()`, but avoids converting the
+    /// namespace and path to C strings on every call. The XMP Toolkit
+    /// still expands the path expression each time; see `XmpPath`.
+    pub fn property_at(&self, path: &XmpPath) -> Option<String> {
+        let mut value = String::new();
+
+        if self.property_at_into(path, &mut value) {
+            Some(value)
+        } else {
+            None
+        }
+    }
+
+    /// Gets a property value using a prepared `XmpPath` into an existing `String`.
+    ///
+    /// See `property_into()` and `property_at()`.
+    pub fn property_at_into(&self, path: &XmpPath, value: &mut String) -> bool {
+        let r = unsafe {
+            ffi::CXmpMetaGetPropertyAt(
+                self.m,
+                path.p,
+                ffi::string_sink,
+                value as *mut String as *mut c_void,
+            )
+        };
+
+        r != 0
+    }
+
+    /// Creates or sets a property value using a prepared `XmpPath`.
+    ///
+    /// See `set_property()`.
+    pub fn set_property_at(&mut self, path: &XmpPath, prop_value: &str) {
+        let c_value = CString::new(prop_value).unwrap();
+
+        unsafe {
+            ffi::CXmpMetaSetPropertyAt(self.m, path.p, c_value.as_ptr());
         }
     }
 
+    /// Reports whether a property exists, using a prepared `XmpPath`.
+    ///
+    /// See `does_property_exist()`.
+    pub fn does_property_exist_at(&self, path: &XmpPath) -> bool {
+        let r = unsafe { ffi::CXmpMetaDoesPropertyExistAt(self.m, path.p) };
+        r != 0
+    }
+
     /// Rreports whether a property currently exists.
     ///
     /// ## Arguments
@@ -180,10 +621,104 @@ impl XmpMeta {
         let r = unsafe { ffi::CXmpMetaDoesPropertyExist(self.m, c_ns.as_ptr(), c_name.as_ptr()) };
         r != 0
     }
+
+    /// Returns an iterator over the nodes of this metadata tree.
+    ///
+    /// By default every node is visited: each schema node, followed by
+    /// the properties of that schema and their fields, array items, and
+    /// qualifiers, in depth-first order. Use `options` to restrict the walk.
+    ///
+    /// This is the way to discover the contents of metadata whose property
+    /// paths aren't known in advance.
+    pub fn iter(&self, options: IterOptions) -> XmpIterator<'_> {
+        XmpIterator::new(self, "", "", options)
+    }
+
+    /// Returns an immutable, flattened copy of this metadata tree.
+    ///
+    /// The snapshot is built in a single pass over the tree. Afterwards,
+    /// it can be scanned without any calls into the XMP Toolkit (and so
+    /// without taking this object's lock), shared between threads, and
+    /// stored; see `XmpSnapshot`.
+    pub fn snapshot(&self) -> XmpSnapshot {
+        XmpSnapshot::new(self)
+    }
+
+    /// Lists the differences between this metadata and `other`.
+    ///
+    /// Both trees are walked once in the XMP Toolkit, and only the nodes
+    /// that differ are returned: first the changed and added nodes, in
+    /// `other`'s order, then the removed nodes, in this tree's order.
+    /// This is much cheaper than serializing both trees to compare them,
+    /// especially when little or nothing has changed.
+    ///
+    /// Returns `XmpMetaError::CantDiff` if the XMP Toolkit reports an error
+    /// during the comparison; no partial list is returned.
+    pub fn diff(&self, other: &XmpMeta) -> Result<Vec<XmpChange>, XmpMetaError> {
+        xmp_diff::diff(self, other)
+    }
+
+    /// Merges properties from `other` into this metadata.
+    ///
+    /// This uses the XMP Toolkit's `ApplyTemplate`, with `other` as the
+    /// template; `options` selects whether properties are added, replaced,
+    /// or removed. For example, `ADD_NEW_PROPERTIES` copies only the
+    /// properties this metadata lacks, and adding `REPLACE_EXISTING_PROPERTIES`
+    /// makes this metadata match `other` wherever `other` has a value.
+    pub fn merge(&mut self, other: &XmpMeta, options: MergeOptions) -> Result<(), XmpMetaError> {
+        let ok = unsafe { ffi::CXmpMetaMerge(self.m, other.m, options.bits()) };
+        if ok != 0 {
+            Ok(())
+        } else {
+            Err(XmpMetaError::CantMerge)
+        }
+    }
+
+    /// Removes every schema except those listed.
+    ///
+    /// Metadata read from files often carries large structures that are of
+    /// no interest to a given application (`xmpMM:History`, Photoshop's
+    /// `DocumentAncestors`, Camera Raw settings, and so on). Pruning them
+    /// right after reading releases their memory, and makes later operations
+    /// that visit the whole tree, such as `to_packet()`, proportionally cheaper.
+    ///
+    /// ## Arguments
+    ///
+    /// * `schema_ns`: The namespace URIs of the schemas to keep.
+    pub fn retain_schemas(&mut self, schema_ns: &[&str]) {
+        let mut packed_namespaces: Vec<u8> = Vec::new();
+        for ns in schema_ns {
+            push_c_str(&mut packed_namespaces, ns);
+        }
+
+        unsafe {
+            ffi::CXmpMetaRetainSchemas(
+                self.m,
+                packed_namespaces.as_ptr() as *const c_char,
+                schema_ns.len(),
+            );
+        }
+    }
+}
+
+// Appends `s` to `buf` as a NUL-terminated C string.
+//
+// Panics (as `CString::new` would) if `s` contains a NUL byte.
+pub(crate) fn push_c_str(buf: &mut Vec<u8>, s: &str) {
+    assert!(
+        !s.as_bytes().contains(&0),
+        "string contains an interior NUL byte: {:?}",
+        s
+    );
+
+    buf.extend_from_slice(s.as_bytes());
+    buf.push(0);
 }
 
 #[cfg(test)]
 mod tests {
+    use crate::xmp_const::*;
+
     use super::*;
 
     #[test]
@@ -191,11 +726,329 @@ mod tests {
         let mut _m = XmpMeta::new();
     }
 
+    #[test]
+    fn property_into() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+        m.set_property(XMP_NS_XMP, "Label", "red");
+
+        let mut value = String::with_capacity(32);
+
+        assert!(m.property_into(XMP_NS_XMP, "CreatorTool", &mut value));
+        assert_eq!(value, "xmp_toolkit");
+
+        assert!(m.property_into(XMP_NS_XMP, "Label", &mut value));
+        assert_eq!(value, "red");
+
+        assert!(!m.property_into(XMP_NS_XMP, "Nickname", &mut value));
+        assert_eq!(value, "red");
+    }
+
+    #[test]
+    fn properties() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+        m.set_property(XMP_NS_XMP, "Label", "");
+        m.set_property(XMP_NS_XMP, "Nickname", "purple");
+
+        let values = m.properties(&[
+            (XMP_NS_XMP, "CreatorTool"),
+            (XMP_NS_XMP, "Rating"),
+            (XMP_NS_XMP, "Label"),
+            ("http://ns.example.com/unregistered/", "foo"),
+            (XMP_NS_XMP, "Nickname"),
+        ]);
+
+        assert_eq!(
+            values,
+            vec![
+                Some("xmp_toolkit".to_owned()),
+                None,
+                Some("".to_owned()),
+                None,
+                Some("purple".to_owned()),
+            ]
+        );
+
+        assert!(m.properties(&[]).is_empty());
+    }
+
+    #[test]
+    fn typed_properties() {
+        const PACKET: &str = r#"<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+    xmlns:tiff="http://ns.adobe.com/tiff/1.0/"
+    xmlns:exif="http://ns.adobe.com/exif/1.0/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows"
+   xmp:CreateDate="2006-04-25T15:32:01+02:00"
+   tiff:ImageWidth="4000"
+   exif:ExposureBiasValue="-0.5"
+   exif:FlashpixVersion="True"
+   exif:Flash="yes"/>
+ </rdf:RDF>
+</x:xmpmeta>"#;
+
+        const TIFF: &str = "http://ns.adobe.com/tiff/1.0/";
+        const EXIF: &str = "http://ns.adobe.com/exif/1.0/";
+
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+
+        assert_eq!(m.property_i64(TIFF, "ImageWidth"), Some(4000));
+        assert_eq!(m.property_f64(EXIF, "ExposureBiasValue"), Some(-0.5));
+        assert_eq!(m.property_bool(EXIF, "FlashpixVersion"), Some(true));
+
+        let created = m.property_date(XMP_NS_XMP, "CreateDate").unwrap();
+        assert_eq!((created.year, created.month, created.day), (2006, 4, 25));
+        assert_eq!((created.hour, created.minute, created.second), (15, 32, 1));
+        assert!(created.has_time_zone);
+        assert_eq!((created.tz_sign, created.tz_hour), (1, 2));
+
+        // Wrong type or missing property.
+        assert_eq!(m.property_i64(XMP_NS_XMP, "CreatorTool"), None);
+        assert_eq!(m.property_date(XMP_NS_XMP, "CreatorTool"), None);
+        assert_eq!(m.property_bool(TIFF, "Orientation"), None);
+        assert_eq!(m.property_bool(EXIF, "Flash"), None);
+    }
+
+    #[test]
+    fn try_set_property() {
+        let mut m = XmpMeta::new();
+        m.try_set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit")
+            .unwrap();
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "xmp_toolkit"
+        );
+
+        let err = m
+            .try_set_property("http://ns.example.com/unregistered/", "foo", "bar")
+            .unwrap_err();
+        assert_eq!(err.index, 0);
+        assert!(err.code != 0 && !err.message.is_empty());
+
+        assert!(m.try_set_property(XMP_NS_XMP, "Bad[", "bar").is_err());
+        assert!(!m.does_property_exist(XMP_NS_XMP, "Bad"));
+    }
+
+    #[test]
+    fn set_property_date() {
+        let mut m = XmpMeta::new();
+        let dt = XmpDateTime::current();
+        m.set_property_date(XMP_NS_XMP, "MetadataDate", &dt);
+
+        let read = m.property_date(XMP_NS_XMP, "MetadataDate").unwrap();
+        assert_eq!(
+            (read.year, read.month, read.day),
+            (dt.year, dt.month, dt.day)
+        );
+        assert_eq!(
+            (read.hour, read.minute, read.second),
+            (dt.hour, dt.minute, dt.second)
+        );
+    }
+
+    #[test]
+    fn property_at() {
+        let creator_tool = XmpPath::new(XMP_NS_XMP, "CreatorTool").unwrap();
+        let label = XmpPath::new(XMP_NS_XMP, "Label").unwrap();
+
+        let mut m = XmpMeta::new();
+        m.set_property_at(&creator_tool, "xmp_toolkit");
+
+        assert!(m.does_property_exist_at(&creator_tool));
+        assert!(!m.does_property_exist_at(&label));
+
+        assert_eq!(m.property_at(&creator_tool).unwrap(), "xmp_toolkit");
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "xmp_toolkit"
+        );
+        assert_eq!(m.property_at(&label), None);
+    }
+
+    #[test]
+    fn read_from_many_threads() {
+        use std::sync::Arc;
+        use std::thread;
+
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+        let m = Arc::new(m);
+
+        let threads: Vec<_> = (0..4)
+            .map(|_| {
+                let m = Arc::clone(&m);
+                thread::spawn(move || {
+                    let mut value = String::new();
+                    for _ in 0..1000 {
+                        assert!(m.property_into(XMP_NS_XMP, "CreatorTool", &mut value));
+                        assert_eq!(value, "xmp_toolkit");
+                    }
+                })
+            })
+            .collect();
+
+        for t in threads {
+            t.join().unwrap();
+        }
+    }
+
+    const PURPLE_SQUARE_PACKET: &str = r#"<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows"
+   xmp:CreateDate="2006-04-25T15:32:01+02:00"/>
+ </rdf:RDF>
+</x:xmpmeta>"#;
+
+    #[test]
+    fn from_packet() {
+        let m = XmpMeta::from_packet(PURPLE_SQUARE_PACKET.as_bytes()).unwrap();
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "Adobe Photoshop CS2 Windows"
+        );
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreateDate").unwrap(),
+            "2006-04-25T15:32:01+02:00"
+        );
+    }
+
+    #[test]
+    fn from_packet_bad() {
+        assert!(XmpMeta::from_packet(b"<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">").is_err());
+    }
+
+    #[test]
+    fn to_packet_round_trip() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+
+        let packet = m.to_packet(SerializeOptions::empty()).unwrap();
+        let packet_str = std::str::from_utf8(&packet).unwrap();
+        assert!(packet_str.starts_with("<?xpacket begin="));
+        assert!(packet_str.contains("xmp_toolkit"));
+
+        let compact = m
+            .to_packet(SerializeOptions::OMIT_PACKET_WRAPPER | SerializeOptions::USE_COMPACT_FORMAT)
+            .unwrap();
+        assert!(compact.len() < packet.len());
+        assert!(compact.starts_with(b"<x:xmpmeta"));
+
+        for p in &[packet, compact] {
+            let m2 = XmpMeta::from_packet(p).unwrap();
+            assert_eq!(
+                m2.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+                "xmp_toolkit"
+            );
+        }
+    }
+
+    #[test]
+    fn clone() {
+        let mut template = XmpMeta::new();
+        template.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+        template.set_property(XMP_NS_DC, "rights", "all rights reserved");
+
+        let mut m = template.clone();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "derivative");
+        m.set_property(XMP_NS_XMP, "Label", "copy");
+
+        assert_eq!(m.property(XMP_NS_XMP, "CreatorTool").unwrap(), "derivative");
+        assert_eq!(
+            m.property(XMP_NS_DC, "rights").unwrap(),
+            "all rights reserved"
+        );
+
+        assert_eq!(
+            template.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+            "xmp_toolkit"
+        );
+        assert!(!template.does_property_exist(XMP_NS_XMP, "Label"));
+    }
+
+    #[test]
+    fn to_packet_with_padding() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+
+        let small = m
+            .to_packet_with_padding(SerializeOptions::empty(), 100)
+            .unwrap();
+        let large = m
+            .to_packet_with_padding(SerializeOptions::empty(), 10_000)
+            .unwrap();
+        assert!(large.len() >= small.len() + 9_000);
+
+        let exact = m
+            .to_packet_with_padding(SerializeOptions::EXACT_PACKET_LENGTH, 4_000)
+            .unwrap();
+        assert_eq!(exact.len(), 4_000);
+
+        assert!(m
+            .to_packet_with_padding(SerializeOptions::EXACT_PACKET_LENGTH, 10)
+            .is_err());
+    }
+
+    #[test]
+    fn retain_schemas() {
+        let mut m = XmpMeta::from_packet(
+            br#"<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+    xmlns:dc="http://purl.org/dc/elements/1.1/"
+    xmlns:photoshop="http://ns.adobe.com/photoshop/1.0/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows"
+   photoshop:ColorMode="3">
+   <dc:format>application/vnd.adobe.photoshop</dc:format>
+  </rdf:Description>
+ </rdf:RDF>
+</x:xmpmeta>"#,
+        )
+        .unwrap();
+
+        m.retain_schemas(&[XMP_NS_XMP, XMP_NS_DC]);
+
+        assert!(m.does_property_exist(XMP_NS_XMP, "CreatorTool"));
+        assert!(m.does_property_exist(XMP_NS_DC, "format"));
+        assert!(!m.does_property_exist(XMP_NS_PHOTOSHOP, "ColorMode"));
+
+        m.retain_schemas(&[]);
+        assert!(!m.does_property_exist(XMP_NS_XMP, "CreatorTool"));
+        assert!(!m.does_property_exist(XMP_NS_DC, "format"));
+    }
+
     #[test]
     fn register_namespace() {
         assert_eq!(
-            XmpMeta::register_namespace("http://purl.org/dc/terms/", "dcterms"),
+            XmpMeta::register_namespace("http://purl.org/dc/terms/", "dcterms").unwrap(),
             "dcterms:"
         );
     }
+
+    #[test]
+    fn register_bad_namespace() {
+        assert!(XmpMeta::register_namespace("http://ns.example.com/bad/", "").is_err());
+    }
+
+    #[test]
+    fn property_in_unregistered_namespace() {
+        let mut m = XmpMeta::new();
+        m.set_property(XMP_NS_XMP, "CreatorTool", "xmp_toolkit");
+
+        let ns = "http://ns.example.com/unregistered/";
+        assert_eq!(m.property(ns, "foo"), None);
+        assert!(!m.does_property_exist(ns, "foo"));
+
+        let mut value = "unchanged".to_owned();
+        assert!(!m.property_into(ns, "foo", &mut value));
+        assert_eq!(value, "unchanged");
+
+        // So is a path whose prefix doesn't match the namespace.
+        assert_eq!(m.property(XMP_NS_DC, "xmp:CreatorTool"), None);
+    }
 }
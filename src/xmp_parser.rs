@@ -0,0 +1,192 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::io;
+use std::os::raw::c_char;
+use std::ptr;
+
+use crate::ffi;
+use crate::metrics::{self, Phase};
+use crate::xmp_meta::{XmpMeta, XmpMetaError};
+
+/// Parses an XMP packet that arrives in pieces.
+///
+/// Use this instead of `XmpMeta::from_packet()` when the packet is received
+/// incrementally, for example from an HTTP response body or a message stream.
+/// Each chunk is handed to the XML parser as it arrives, so the serialized
+/// packet never needs to be buffered in full; the parser holds on to at most
+/// an incomplete character or token from the end of the previous chunk.
+/// (The parsed metadata itself, of course, grows with the packet.)
+///
+/// `XmpParser` also implements `std::io::Write`, so a packet can be parsed
+/// straight from a reader with `std::io::copy()`.
+pub struct XmpParser {
+    m: *mut ffi::CXmpMeta,
+    failed: bool,
+}
+
+// As with `XmpMeta`, the partially parsed object is not tied to
+// the thread that created it.
+unsafe impl Send for XmpParser {}
+
+impl Drop for XmpParser {
+    fn drop(&mut self) {
+        if !self.m.is_null() {
+            unsafe {
+                ffi::CXmpMetaDrop(self.m);
+            }
+        }
+    }
+}
+
+impl Default for XmpParser {
+    fn default() -> Self {
+        XmpParser::new()
+    }
+}
+
+impl XmpParser {
+    /// Creates a parser with no input.
+    pub fn new() -> XmpParser {
+        XmpParser {
+            m: unsafe { ffi::CXmpMetaNew() },
+            failed: false,
+        }
+    }
+
+    /// Parses the next piece of the packet.
+    ///
+    /// Chunks may be of any size and may split characters or XML tokens.
+    ///
+    /// Once a chunk fails to parse, the parser can not recover; this and
+    /// all later calls (including `finish()`) return an error.
+    pub fn feed(&mut self, chunk: &[u8]) -> Result<(), XmpMetaError> {
+        self.parse(chunk, false)
+    }
+
+    /// Finishes parsing and returns the resulting metadata.
+    ///
+    /// Returns an error if any chunk failed to parse or if the packet
+    /// is incomplete.
+    pub fn finish(mut self) -> Result<XmpMeta, XmpMetaError> {
+        self.parse(&[], true)?;
+
+        let m = self.m;
+        self.m = ptr::null_mut();
+        Ok(XmpMeta { m })
+    }
+
+    fn parse(&mut self, chunk: &[u8], is_last: bool) -> Result<(), XmpMetaError> {
+        if self.failed {
+            return Err(XmpMetaError::BadPacket);
+        }
+
+        let _t = metrics::time(Phase::Parse);
+
+        let ok = unsafe {
+            ffi::CXmpMetaParseChunk(
+                self.m,
+                chunk.as_ptr() as *const c_char,
+                chunk.len(),
+                is_last as i32,
+            )
+        };
+
+        if ok != 0 {
+            Ok(())
+        } else {
+            self.failed = true;
+            Err(XmpMetaError::BadPacket)
+        }
+    }
+}
+
+impl io::Write for XmpParser {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        match self.feed(buf) {
+            Ok(()) => Ok(buf.len()),
+            Err(_) => Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "XMP packet could not be parsed",
+            )),
+        }
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::{self, Write};
+
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    const PACKET: &str = r#"<?xpacket begin="" id="W5M0MpCehiHzreSzNTczkc9d"?>
+<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows"
+   xmp:CreateDate="2006-04-25T15:32:01+02:00"/>
+ </rdf:RDF>
+</x:xmpmeta>
+<?xpacket end="w"?>"#;
+
+    #[test]
+    fn feed_in_chunks() {
+        for chunk_size in &[1, 7, 64, PACKET.len()] {
+            let mut parser = XmpParser::new();
+            for chunk in PACKET.as_bytes().chunks(*chunk_size) {
+                parser.feed(chunk).unwrap();
+            }
+
+            let m = parser.finish().unwrap();
+            assert_eq!(
+                m.property(XMP_NS_XMP, "CreatorTool").unwrap(),
+                "Adobe Photoshop CS2 Windows"
+            );
+        }
+    }
+
+    #[test]
+    fn copy_from_reader() {
+        let mut parser = XmpParser::new();
+        io::copy(&mut PACKET.as_bytes(), &mut parser).unwrap();
+        parser.flush().unwrap();
+
+        let m = parser.finish().unwrap();
+        assert_eq!(
+            m.property(XMP_NS_XMP, "CreateDate").unwrap(),
+            "2006-04-25T15:32:01+02:00"
+        );
+    }
+
+    #[test]
+    fn incomplete_packet() {
+        let mut parser = XmpParser::new();
+        parser.feed(&PACKET.as_bytes()[..100]).unwrap();
+        assert!(parser.finish().is_err());
+    }
+
+    #[test]
+    fn error_is_sticky() {
+        let mut parser = XmpParser::new();
+        assert!(parser.feed(b"<x:xmpmeta></y:oops>").is_err());
+        assert!(parser.feed(PACKET.as_bytes()).is_err());
+        assert!(parser.finish().is_err());
+    }
+}
@@ -0,0 +1,94 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::ffi::CString;
+
+use crate::ffi;
+
+/// A property path that has been prepared for repeated use.
+///
+/// Each call to `XmpMeta::property()` and similar accessors converts its
+/// namespace and path to C strings before calling into the XMP Toolkit.
+/// An `XmpPath` does that conversion once, and checks up front that the
+/// namespace is registered and the path expression is valid; it can then
+/// be used with `XmpMeta::property_at()` and related functions on any
+/// number of `XmpMeta` structs.
+///
+/// The XMP Toolkit's client API has no way to hold on to a parsed path, so
+/// the toolkit still expands the path expression on each access. Only the
+/// string conversion (and the allocation that goes with it) is saved.
+///
+/// Prepare the paths you read most often (for example, `dc:title` or
+/// `xmp:CreateDate`) once and reuse them for every document.
+pub struct XmpPath {
+    pub(crate) p: *mut ffi::CXmpPath,
+}
+
+// An `XmpPath` is immutable once created, so it may be shared
+// freely between threads.
+unsafe impl Send for XmpPath {}
+unsafe impl Sync for XmpPath {}
+
+impl Drop for XmpPath {
+    fn drop(&mut self) {
+        unsafe {
+            ffi::CXmpPathDrop(self.p);
+        }
+    }
+}
+
+impl XmpPath {
+    /// Prepares a property path for repeated use.
+    ///
+    /// ## Arguments
+    ///
+    /// * `schema_ns`: The namespace URI; see `XmpMeta::property()`.
+    ///
+    /// * `prop_name`: The name of the property; see `XmpMeta::property()`.
+    ///
+    /// Returns `None` if the namespace is not registered or the path
+    /// expression is not valid.
+    pub fn new(schema_ns: &str, prop_name: &str) -> Option<XmpPath> {
+        let c_ns = CString::new(schema_ns).unwrap();
+        let c_name = CString::new(prop_name).unwrap();
+
+        let p = unsafe { ffi::CXmpPathNew(c_ns.as_ptr(), c_name.as_ptr()) };
+        if p.is_null() {
+            None
+        } else {
+            Some(XmpPath { p })
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::xmp_const::*;
+
+    use super::*;
+
+    #[test]
+    fn new_valid() {
+        assert!(XmpPath::new(XMP_NS_XMP, "CreatorTool").is_some());
+    }
+
+    #[test]
+    fn new_unregistered_namespace() {
+        assert!(XmpPath::new("http://ns.example.com/unregistered/", "foo").is_none());
+    }
+
+    #[test]
+    fn new_bad_path() {
+        assert!(XmpPath::new(XMP_NS_XMP, "CreatorTool[").is_none());
+    }
+}
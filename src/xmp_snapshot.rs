@@ -0,0 +1,435 @@
+// Copyright 2020 Adobe. All rights reserved.
+// This file is licensed to you under the Apache License,
+// Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0)
+// or the MIT license (http://opensource.org/licenses/MIT),
+// at your option.
+
+// Unless required by applicable law or agreed to in writing,
+// this software is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR REPRESENTATIONS OF ANY KIND, either express or
+// implied. See the LICENSE-MIT and LICENSE-APACHE files for the
+// specific language governing permissions and limitations under
+// each license.
+
+use std::convert::TryInto;
+use std::os::raw::c_void;
+use std::str;
+
+use crate::ffi;
+use crate::xmp_iterator::PropertyFlags;
+use crate::xmp_meta::XmpMeta;
+
+// Snapshot layout (all integers are little-endian u32):
+//
+//   header:  b"XMPS", version (1), node count, arena length
+//   nodes:   NODE_FIELDS values per node, see the `F_*` indices
+//   arena:   UTF-8 strings referenced by (offset, length) pairs
+//
+// `NONE` marks an absent parent, child, or sibling.
+
+const MAGIC: &[u8; 4] = b"XMPS";
+const VERSION: u32 = 1;
+const HEADER_LEN: usize = 16;
+const NONE: u32 = 0xFFFF_FFFF;
+
+const F_PARENT: usize = 0;
+const F_FIRST_CHILD: usize = 1;
+const F_NEXT_SIBLING: usize = 2;
+const F_FLAGS: usize = 3;
+const F_NS: usize = 4;
+const F_PATH: usize = 6;
+const F_VALUE: usize = 8;
+const NODE_FIELDS: usize = 10;
+const NODE_LEN: usize = NODE_FIELDS * 4;
+
+/// An immutable, flattened copy of a metadata tree.
+///
+/// Created by `XmpMeta::snapshot()`. The whole tree is held in a single
+/// contiguous buffer: a fixed-size record per node (with parent, first
+/// child, and next sibling indices, flags, and string offsets), followed
+/// by an arena containing all the strings. Reading a snapshot involves
+/// no calls into the XMP Toolkit and takes no locks, so it is cheap to
+/// scan and may be shared freely between threads.
+///
+/// The buffer is position-independent and has a fixed byte order, so it
+/// can be written out with `as_bytes()` and later read back (for example,
+/// from a memory-mapped file) with `SnapshotView::from_bytes()`.
+#[derive(Clone, Debug)]
+pub struct XmpSnapshot {
+    data: Vec<u8>,
+
+    // Cached from `data`, which is validated on construction.
+    node_count: usize,
+}
+
+impl XmpSnapshot {
+    pub(crate) fn new(m: &XmpMeta) -> XmpSnapshot {
+        let mut data: Vec<u8> = Vec::new();
+
+        unsafe {
+            ffi::CXmpMetaSnapshot(
+                m.m,
+                ffi::bytes_sink,
+                &mut data as *mut Vec<u8> as *mut c_void,
+            );
+        }
+
+        match SnapshotView::from_bytes(&data).map(|v| v.node_count) {
+            Some(node_count) => XmpSnapshot { data, node_count },
+            None => XmpSnapshot::empty(),
+        }
+    }
+
+    fn empty() -> XmpSnapshot {
+        let mut data = Vec::with_capacity(HEADER_LEN);
+        data.extend_from_slice(MAGIC);
+        data.extend_from_slice(&VERSION.to_le_bytes());
+        data.extend_from_slice(&0u32.to_le_bytes());
+        data.extend_from_slice(&0u32.to_le_bytes());
+
+        XmpSnapshot {
+            data,
+            node_count: 0,
+        }
+    }
+
+    /// Returns a view through which the nodes can be read.
+    pub fn view(&self) -> SnapshotView<'_> {
+        SnapshotView::new_unchecked(&self.data, self.node_count)
+    }
+
+    /// Returns the serialized form of this snapshot.
+    pub fn as_bytes(&self) -> &[u8] {
+        &self.data
+    }
+
+    /// Consumes the snapshot, returning its serialized form.
+    pub fn into_bytes(self) -> Vec<u8> {
+        self.data
+    }
+}
+
+/// A read-only view of a snapshot's nodes.
+///
+/// Obtained from `XmpSnapshot::view()`, or directly from a serialized
+/// snapshot with `from_bytes()`.
+#[derive(Clone, Copy, Debug)]
+pub struct SnapshotView<'a> {
+    nodes: &'a [u8],
+    arena: &'a str,
+    node_count: usize,
+}
+
+impl<'a> SnapshotView<'a> {
+    /// Reads a snapshot previously serialized with `XmpSnapshot::as_bytes()`.
+    ///
+    /// The buffer is validated (its header, every index, and every string
+    /// offset) but not copied. Parent, child, and sibling links must follow
+    /// the pre-order numbering that `XmpMeta::snapshot()` produces, so the
+    /// links in a validated view can't form a cycle. Returns `None` if it is not a well-formed
+    /// snapshot.
+    pub fn from_bytes(data: &'a [u8]) -> Option<SnapshotView<'a>> {
+        if data.len() < HEADER_LEN || &data[0..4] != MAGIC || read_u32(data, 4) != VERSION {
+            return None;
+        }
+
+        let node_count = read_u32(data, 8) as usize;
+        let arena_len = read_u32(data, 12) as usize;
+
+        let nodes_len = node_count.checked_mul(NODE_LEN)?;
+        if data.len() != HEADER_LEN.checked_add(nodes_len)?.checked_add(arena_len)? {
+            return None;
+        }
+
+        let view = SnapshotView {
+            nodes: &data[HEADER_LEN..HEADER_LEN + nodes_len],
+            arena: str::from_utf8(&data[HEADER_LEN + nodes_len..]).ok()?,
+            node_count,
+        };
+
+        for i in 0..node_count {
+            // Nodes are stored in pre-order, so a parent always comes before
+            // its node, and a child or sibling after it. Requiring that keeps
+            // crafted links from forming a cycle.
+            let parent = view.field(i, F_PARENT);
+            if parent != NONE && parent as usize >= i {
+                return None;
+            }
+
+            for &f in &[F_FIRST_CHILD, F_NEXT_SIBLING] {
+                let link = view.field(i, f);
+                if link != NONE && (link as usize <= i || link as usize >= node_count) {
+                    return None;
+                }
+            }
+
+            for &f in &[F_NS, F_PATH, F_VALUE] {
+                let start = view.field(i, f) as usize;
+                let end = start.checked_add(view.field(i, f + 1) as usize)?;
+                view.arena.get(start..end)?;
+            }
+        }
+
+        Some(view)
+    }
+
+    fn new_unchecked(data: &'a [u8], node_count: usize) -> SnapshotView<'a> {
+        let nodes_end = HEADER_LEN + node_count * NODE_LEN;
+        SnapshotView {
+            nodes: &data[HEADER_LEN..nodes_end],
+            // The arena was validated as UTF-8 when the snapshot was created,
+            // and the snapshot is immutable.
+            arena: unsafe { str::from_utf8_unchecked(&data[nodes_end..]) },
+            node_count,
+        }
+    }
+
+    /// Returns the number of nodes in the snapshot.
+    pub fn len(&self) -> usize {
+        self.node_count
+    }
+
+    /// Returns `true` if the snapshot contains no nodes.
+    pub fn is_empty(&self) -> bool {
+        self.node_count == 0
+    }
+
+    /// Returns the node at `index`, or `None` if `index` is out of range.
+    ///
+    /// Nodes are numbered in depth-first order, as visited by `XmpMeta::iter()`.
+    pub fn node(&self, index: usize) -> Option<SnapshotNode<'a>> {
+        if index < self.node_count {
+            Some(SnapshotNode { view: *self, index })
+        } else {
+            None
+        }
+    }
+
+    /// Returns an iterator over all nodes, in depth-first order.
+    pub fn nodes(&self) -> impl Iterator<Item = SnapshotNode<'a>> {
+        let view = *self;
+        (0..self.node_count).map(move |index| SnapshotNode { view, index })
+    }
+
+    /// Returns an iterator over the top-level (schema) nodes.
+    pub fn schemas(&self) -> Siblings<'a> {
+        Siblings {
+            view: *self,
+            next: if self.node_count > 0 { 0 } else { NONE },
+        }
+    }
+
+    fn field(&self, index: usize, field: usize) -> u32 {
+        read_u32(self.nodes, index * NODE_LEN + field * 4)
+    }
+
+    fn string(&self, index: usize, field: usize) -> &'a str {
+        let start = self.field(index, field) as usize;
+        let len = self.field(index, field + 1) as usize;
+        self.arena.get(start..start + len).unwrap_or("")
+    }
+}
+
+/// One node of a snapshot.
+#[derive(Clone, Copy, Debug)]
+pub struct SnapshotNode<'a> {
+    view: SnapshotView<'a>,
+    index: usize,
+}
+
+impl<'a> SnapshotNode<'a> {
+    /// Returns this node's position in depth-first order.
+    pub fn index(&self) -> usize {
+        self.index
+    }
+
+    /// Returns the namespace URI of the schema containing this node.
+    pub fn schema_ns(&self) -> &'a str {
+        self.view.string(self.index, F_NS)
+    }
+
+    /// Returns the full path of this node. Empty for schema nodes.
+    pub fn path(&self) -> &'a str {
+        self.view.string(self.index, F_PATH)
+    }
+
+    /// Returns the value of this node. Empty for schema nodes,
+    /// structs, and arrays.
+    pub fn value(&self) -> &'a str {
+        self.view.string(self.index, F_VALUE)
+    }
+
+    /// Returns the flags describing this node.
+    pub fn options(&self) -> PropertyFlags {
+        PropertyFlags::from_bits_truncate(self.view.field(self.index, F_FLAGS))
+    }
+
+    /// Returns the parent of this node, or `None` for a schema node.
+    pub fn parent(&self) -> Option<SnapshotNode<'a>> {
+        self.link(F_PARENT)
+    }
+
+    /// Returns an iterator over the children of this node (fields, array
+    /// items, and qualifiers, or for a schema node its top-level properties).
+    pub fn children(&self) -> Siblings<'a> {
+        Siblings {
+            view: self.view,
+            next: self.view.field(self.index, F_FIRST_CHILD),
+        }
+    }
+
+    fn link(&self, field: usize) -> Option<SnapshotNode<'a>> {
+        match self.view.field(self.index, field) {
+            NONE => None,
+            index => self.view.node(index as usize),
+        }
+    }
+}
+
+/// An iterator over a run of sibling nodes in a snapshot.
+pub struct Siblings<'a> {
+    view: SnapshotView<'a>,
+    next: u32,
+}
+
+impl<'a> Iterator for Siblings<'a> {
+    type Item = SnapshotNode<'a>;
+
+    fn next(&mut self) -> Option<SnapshotNode<'a>> {
+        let node = self.view.node(self.next as usize)?;
+        self.next = node.view.field(node.index, F_NEXT_SIBLING);
+        Some(node)
+    }
+}
+
+fn read_u32(data: &[u8], offset: usize) -> u32 {
+    u32::from_le_bytes(data[offset..offset + 4].try_into().unwrap())
+}
+
+#[cfg(test)]
+mod tests {
+    use std::thread;
+
+    use crate::xmp_const::*;
+    use crate::xmp_iterator::IterOptions;
+
+    use super::*;
+
+    const PACKET: &str = r#"<x:xmpmeta xmlns:x="adobe:ns:meta/">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+    xmlns:dc="http://purl.org/dc/elements/1.1/"
+   xmp:CreatorTool="Adobe Photoshop CS2 Windows">
+   <dc:title>
+    <rdf:Alt>
+     <rdf:li xml:lang="x-default">Purple Square</rdf:li>
+    </rdf:Alt>
+   </dc:title>
+  </rdf:Description>
+ </rdf:RDF>
+</x:xmpmeta>"#;
+
+    #[test]
+    fn snapshot_tree() {
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let snapshot = m.snapshot();
+        let view = snapshot.view();
+
+        // Same nodes, in the same order, as a full iteration.
+        let iterated: Vec<String> = m
+            .iter(IterOptions::empty())
+            .map(|n| format!("{} {}", n.schema_ns, n.name))
+            .collect();
+        let snapped: Vec<String> = view
+            .nodes()
+            .map(|n| format!("{} {}", n.schema_ns(), n.path()))
+            .collect();
+        assert_eq!(iterated, snapped);
+
+        let schemas: Vec<&str> = view.schemas().map(|n| n.schema_ns()).collect();
+        assert_eq!(schemas.len(), 2);
+        assert!(schemas.contains(&XMP_NS_DC));
+
+        let dc = view.schemas().find(|n| n.schema_ns() == XMP_NS_DC).unwrap();
+        assert!(dc.options().contains(PropertyFlags::SCHEMA_NODE));
+        assert!(dc.parent().is_none());
+
+        let title = dc.children().next().unwrap();
+        assert_eq!(title.path(), "dc:title");
+        assert!(title.options().contains(PropertyFlags::ARRAY_IS_ALT_TEXT));
+        assert_eq!(title.parent().unwrap().index(), dc.index());
+
+        let item = title.children().next().unwrap();
+        assert_eq!(item.path(), "dc:title[1]");
+        assert_eq!(item.value(), "Purple Square");
+
+        let lang = item.children().next().unwrap();
+        assert_eq!(lang.path(), "dc:title[1]/?xml:lang");
+        assert_eq!(lang.value(), "x-default");
+        assert!(lang.options().contains(PropertyFlags::IS_QUALIFIER));
+    }
+
+    #[test]
+    fn snapshot_from_bytes() {
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let bytes = m.snapshot().into_bytes();
+
+        let view = SnapshotView::from_bytes(&bytes).unwrap();
+        assert!(view
+            .nodes()
+            .any(|n| n.path() == "xmp:CreatorTool" && n.value() == "Adobe Photoshop CS2 Windows"));
+
+        assert!(SnapshotView::from_bytes(&bytes[..bytes.len() - 1]).is_none());
+        assert!(SnapshotView::from_bytes(b"XMPS").is_none());
+
+        let mut corrupt = bytes.clone();
+        corrupt[HEADER_LEN + F_PARENT * 4] = 0xFE;
+        assert!(SnapshotView::from_bytes(&corrupt).is_none());
+    }
+
+    #[test]
+    fn snapshot_rejects_cycles() {
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let bytes = m.snapshot().into_bytes();
+        let second = HEADER_LEN + NODE_LEN;
+
+        let set = |offset: usize, link: u32| {
+            let mut b = bytes.clone();
+            b[offset..offset + 4].copy_from_slice(&link.to_le_bytes());
+            b
+        };
+
+        // A node that is its own sibling or child, or that links back.
+        assert!(SnapshotView::from_bytes(&set(second + F_NEXT_SIBLING * 4, 1)).is_none());
+        assert!(SnapshotView::from_bytes(&set(second + F_FIRST_CHILD * 4, 0)).is_none());
+        assert!(SnapshotView::from_bytes(&set(HEADER_LEN + F_PARENT * 4, 1)).is_none());
+        assert!(SnapshotView::from_bytes(&set(second + F_PARENT * 4, 1)).is_none());
+    }
+
+    #[test]
+    fn snapshot_empty() {
+        let snapshot = XmpMeta::new().snapshot();
+        assert!(snapshot.view().is_empty());
+        assert_eq!(snapshot.view().schemas().count(), 0);
+        assert!(SnapshotView::from_bytes(snapshot.as_bytes()).is_some());
+    }
+
+    #[test]
+    fn snapshot_shared_between_threads() {
+        let m = XmpMeta::from_packet(PACKET.as_bytes()).unwrap();
+        let snapshot = std::sync::Arc::new(m.snapshot());
+        drop(m);
+
+        let handles: Vec<_> = (0..4)
+            .map(|_| {
+                let snapshot = snapshot.clone();
+                thread::spawn(move || snapshot.view().len())
+            })
+            .collect();
+
+        for h in handles {
+            assert_eq!(h.join().unwrap(), snapshot.view().len());
+        }
+    }
+}